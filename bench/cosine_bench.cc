@@ -0,0 +1,103 @@
+#include "src/sparse_cosine.h"
+#include "bench/synthetic.h"
+#include <iostream>
+#include <random>
+#include <omp.h>
+#include <unsupported/Eigen/SparseExtra>
+
+using namespace std; 
+using namespace Eigen; 
+
+//microbenchmark for the sparse cosine kernel against SparseVector copies
+//usage: cosine_bench [feature_matrix.mtx | num_rows num_features] [num_pairs]
+//with a feature matrix (as written by the ExtractFeatures stage), its rows are used as they are; otherwise rows are
+//generated with power-law lengths and power-law feature frequencies, as in our PMI matrices. candidate pairs share at
+//least one feature, as in graph construction, and are reported by how skewed their lengths are
+
+//random row, random feature of that row, random other row with that feature
+vector<pair<int,int> > samplePairs(const SparseMatrix<double,RowMajor>& mat, const int num_pairs){
+  const SparseMatrix<double,ColMajor> postings(mat); 
+  mt19937 gen(5678); 
+  uniform_int_distribution<int> row(0, mat.rows() - 1); 
+  vector<pair<int,int> > pairs = vector<pair<int,int> >(); 
+  while ((int) pairs.size() < num_pairs){
+    const int i = row(gen); 
+    const SparseRow row_i = sparseRow(mat, i); 
+    if (row_i.size == 0)
+      continue; 
+    const int f = row_i.idx[gen() % row_i.size]; 
+    const int num_postings = postings.outerIndexPtr()[f+1] - postings.outerIndexPtr()[f]; 
+    const int j = postings.innerIndexPtr()[postings.outerIndexPtr()[f] + gen() % num_postings]; 
+    if (j != i) //filtering for self similarity
+      pairs.push_back(make_pair(i, j)); 
+  }
+  return pairs; 
+}
+
+double scalarDot(const SparseRow& a, const SparseRow& b){ //plain merge, for comparison
+  double dp = 0; 
+  int i = 0, j = 0; 
+  while (i < a.size && j < b.size){
+    if (a.idx[i] == b.idx[j])
+      dp += a.val[i++] * b.val[j++]; 
+    else if (a.idx[i] < b.idx[j])
+      i++; 
+    else
+      j++; 
+  }
+  return dp; 
+}
+
+int main(int argc, char** argv){
+  SparseMatrix<double,RowMajor> mat; 
+  int arg = 1; 
+  if (argc > 1 && string(argv[1]).find(".") != string::npos){
+    loadMarket(mat, argv[1]); 
+    arg = 2; 
+  }
+  else {
+    const int num_rows = (argc > 2) ? atoi(argv[1]) : 100000; 
+    const int num_features = (argc > 2) ? atoi(argv[2]) : 50000; 
+    mat = generatePMIMatrix(num_rows, num_features); 
+    arg = (argc > 2) ? 3 : 1; 
+  }
+  const int num_pairs = (argc > arg) ? atoi(argv[arg]) : 1000000; 
+  cout << "Feature matrix: " << mat.rows() << " x " << mat.cols() << "; NNZs: " << mat.nonZeros() << endl; 
+  const vector<pair<int,int> > pairs = samplePairs(mat, num_pairs); 
+  const vector<double> norms = rowNorms(mat); 
+  const string bucket_names[3] = {"ratio < 4", "4 <= ratio <= 32", "ratio > 32 (galloping)"}; 
+  vector<vector<pair<int,int> > > buckets(3); 
+  for (unsigned int p = 0; p < pairs.size(); p++){
+    const int len_i = sparseRow(mat, pairs[p].first).size, len_j = sparseRow(mat, pairs[p].second).size; 
+    const double ratio = (double) max(len_i, len_j) / max(1, min(len_i, len_j)); 
+    buckets[(ratio < 4) ? 0 : ((ratio <= GALLOP_RATIO) ? 1 : 2)].push_back(pairs[p]); 
+  }
+  for (int b = 0; b < 3; b++){
+    const vector<pair<int,int> >& bucket = buckets[b]; 
+    if (bucket.empty())
+      continue; 
+    vector<double> eigen_sims(bucket.size()), scalar_sims(bucket.size()), kernel_sims(bucket.size()); 
+    double start = omp_get_wtime(); 
+    for (unsigned int p = 0; p < bucket.size(); p++){ //the previous implementation: row copies, norms per call
+      SparseVector<double> vec1 = mat.row(bucket[p].first); 
+      SparseVector<double> vec2 = mat.row(bucket[p].second); 
+      eigen_sims[p] = vec1.dot(vec2) / (vec1.norm() * vec2.norm()); 
+    }
+    const double eigen_time = omp_get_wtime() - start; 
+    start = omp_get_wtime(); 
+    for (unsigned int p = 0; p < bucket.size(); p++)
+      scalar_sims[p] = scalarDot(sparseRow(mat, bucket[p].first), sparseRow(mat, bucket[p].second)) / (norms[bucket[p].first] * norms[bucket[p].second]); 
+    const double scalar_time = omp_get_wtime() - start; 
+    start = omp_get_wtime(); 
+    for (unsigned int p = 0; p < bucket.size(); p++)
+      kernel_sims[p] = cosineSimilarity(sparseRow(mat, bucket[p].first), sparseRow(mat, bucket[p].second), norms[bucket[p].first], norms[bucket[p].second]); 
+    const double kernel_time = omp_get_wtime() - start; 
+    unsigned int mismatches = 0; 
+    for (unsigned int p = 0; p < bucket.size(); p++){
+      if (eigen_sims[p] != kernel_sims[p] || scalar_sims[p] != kernel_sims[p])
+	mismatches++; 
+    }
+    cout << bucket_names[b] << ": " << bucket.size() << " pairs; ns per pair: SparseVector " << 1e9 * eigen_time / bucket.size() << ", scalar merge on rows " << 1e9 * scalar_time / bucket.size() << ", kernel " << 1e9 * kernel_time / bucket.size() << "; results differing from SparseVector: " << mismatches << endl; 
+  }
+  return 0; 
+}
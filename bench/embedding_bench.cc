@@ -0,0 +1,106 @@
+#include "src/embeddings.h"
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <limits>
+#include <stdio.h>
+#include <unistd.h>
+#include <omp.h>
+
+using namespace std; 
+
+//checks and times target similarities from dense embeddings (EmbeddingSimilarity) against cosines in double precision
+//usage: embedding_bench [num_phrases] [dim] [num_pairs]
+//writes synthetic target phrase IDs and text embeddings (every 10th phrase has none, and some lines are for phrases
+//that are not in the phrase IDs), converts them to the binary format, maps it, and looks up random pairs with the SIMD
+//kernel in src/embeddings.h and with a plain loop over the same rows
+
+//one float at a time, in order, as a loop over the unpadded rows would
+float plainDot(const float* a, const float* b, const int len){
+  float dp = 0; 
+  for (int k = 0; k < len; k++)
+    dp += a[k] * b[k]; 
+  return dp; 
+}
+
+int main(int argc, char** argv){
+  const int num_phrases = (argc > 1) ? atoi(argv[1]) : 100000; 
+  const int dim = (argc > 2) ? atoi(argv[2]) : 300; 
+  const int num_pairs = (argc > 3) ? atoi(argv[3]) : 5000000; 
+  cout << "Target phrases: " << num_phrases << "; dimension: " << dim << "; pairs: " << num_pairs << endl; 
+  const string prefix = string(P_tmpdir) + "/embedding_bench." + to_string(getpid()); 
+  mt19937 gen(1234); 
+  normal_distribution<double> normal(0.0, 1.0); 
+  vector<vector<double> > vecs(num_phrases); 
+  ofstream ids((prefix + ".ids").c_str()), text((prefix + ".txt").c_str()); 
+  text.precision(9); 
+  for (int i = 0; i < num_phrases; i++){
+    ids << "w" << i << " x" << i % 7 << " ||| " << i << '\n'; 
+    if (i % 10 == 9)
+      continue; 
+    vecs[i].resize(dim); 
+    text << "w" << i << " x" << i % 7 << " |||"; 
+    for (int k = 0; k < dim; k++){
+      vecs[i][k] = (float) (normal(gen) + ((k % 3 == 0) ? 0.5 : 0)); //a shared component, so that many cosines are positive
+      text << ' ' << vecs[i][k]; 
+    }
+    text << '\n'; 
+    if (i % 1000 == 0){
+      text << "unknown" << i << " |||"; 
+      for (int k = 0; k < dim; k++)
+	text << " 1"; 
+      text << '\n'; 
+    }
+  }
+  ids.close(); 
+  text.close(); 
+  Phrases tgt_phrases; 
+  tgt_phrases.readPhraseIDsFromFile(prefix + ".ids", false); 
+  double start = omp_get_wtime(); 
+  EmbeddingSimilarity::convert(prefix + ".txt", prefix + ".emb", &tgt_phrases); 
+  const double convert_time = omp_get_wtime() - start; 
+  EmbeddingSimilarity emb(prefix + ".emb"); 
+  uniform_int_distribution<int> phrase(0, num_phrases - 1); 
+  vector<pair<int,int> > pairs(num_pairs); 
+  for (int p = 0; p < num_pairs; p++)
+    pairs[p] = make_pair(phrase(gen), phrase(gen)); 
+  double max_diff = 0; 
+  for (int p = 0; p < min(num_pairs, 100000); p++){
+    const vector<double>& a = vecs[pairs[p].first]; 
+    const vector<double>& b = vecs[pairs[p].second]; 
+    double dp = 0, norm_a = 0, norm_b = 0; 
+    for (unsigned int k = 0; k < a.size() && k < b.size(); k++){
+      dp += a[k] * b[k]; 
+      norm_a += a[k] * a[k]; 
+      norm_b += b[k] * b[k]; 
+    }
+    const double sim = (dp > 0) ? dp / sqrt(norm_a * norm_b) : 0; 
+    max_diff = max(max_diff, fabs(sim - emb.getSimilarity(pairs[p].first, pairs[p].second))); 
+  }
+  start = omp_get_wtime(); 
+  double simd_sum = 0; 
+  for (int p = 0; p < num_pairs; p++)
+    simd_sum += emb.getSimilarity(pairs[p].first, pairs[p].second); 
+  const double simd_time = omp_get_wtime() - start; 
+  start = omp_get_wtime(); 
+  double plain_sum = 0; 
+  for (int p = 0; p < num_pairs; p++){
+    const float sim = plainDot(emb.getRow(pairs[p].first), emb.getRow(pairs[p].second), dim); 
+    plain_sum += (sim < 0) ? 0 : sim; 
+  }
+  const double plain_time = omp_get_wtime() - start; 
+  remove((prefix + ".ids").c_str()); 
+  remove((prefix + ".txt").c_str()); 
+  remove((prefix + ".emb").c_str()); 
+#if defined(__AVX__)
+  const string kernel = "AVX"; 
+#elif defined(__SSE2__)
+  const string kernel = "SSE2"; 
+#else
+  const string kernel = "plain"; 
+#endif
+  cout << "Conversion: " << convert_time << " seconds; binary file: " << emb.memoryUsage("")["embeddings"] / (1024.0 * 1024.0) << " MB" << endl; 
+  cout << "Lookups (" << kernel << " kernel): " << num_pairs / simd_time / 1e6 << " M/s; plain loop: " << num_pairs / plain_time / 1e6 << " M/s (sums: " << simd_sum << ", " << plain_sum << ")" << endl; 
+  cout << "Largest difference from double precision cosines: " << max_diff << endl; 
+  return (max_diff < 1e-5) ? 0 : 1; 
+}
@@ -0,0 +1,74 @@
+#include "src/graph.h"
+#include "src/metrics.h"
+#include <omp.h>
+#include <random>
+
+using namespace std;
+using namespace Eigen;
+
+//memory high-water benchmark for symmetrizing and row-normalizing a synthetic kNN graph
+//usage: graph_bench num_nodes k [csr|eigen]
+//each method should be run in its own process, since the peak resident set size is reported for the whole process
+
+//k random out-neighbors per node with random positive similarities, plus the self similarity, in the same form
+//as the triplets that Graph::Graph builds
+vector<triplet> generateKNNTriplets(const int num_nodes, const int k){
+  vector<triplet> triplets = vector<triplet>(); 
+  triplets.reserve((long) num_nodes * (k+1)); 
+  mt19937 gen(1234); 
+  uniform_int_distribution<int> node(0, num_nodes - 1); 
+  uniform_real_distribution<double> sim(0.01, 1.0); 
+  for (int i = 0; i < num_nodes; i++){
+    set<int> neighbors = set<int>(); 
+    while ((int) neighbors.size() < min(k, num_nodes - 1)){
+      int j = node(gen); 
+      if (j != i)
+	neighbors.insert(j); 
+    }
+    for (set<int>::iterator it = neighbors.begin(); it != neighbors.end(); it++)
+      triplets.push_back(triplet(i, *it, sim(gen))); 
+    triplets.push_back(triplet(i, i, 1.0)); 
+  }
+  return triplets; 
+}
+
+//the previous implementation: transposed copy plus a diagonal left multiplication
+void eigenSymmetrizeAndNormalize(vector<triplet>& triplets, const int num_nodes, SparseMatrix<double,RowMajor>& sim_mat){
+  sim_mat.resize(num_nodes, num_nodes); 
+  sim_mat.reserve(triplets.size()); 
+  sim_mat.setFromTriplets(triplets.begin(), triplets.end()); 
+  vector<triplet>().swap(triplets); 
+  sim_mat = 0.5*(SparseMatrix<double,RowMajor>(sim_mat.transpose()) + sim_mat); 
+  VectorXd indSimSumRowInv = (sim_mat*VectorXd::Ones(sim_mat.cols())).cwiseInverse(); 
+  SparseMatrix<double,RowMajor> left_mult(sim_mat.rows(), sim_mat.rows()); 
+  vector<triplet> left_mult_diagonal = vector<triplet>(); 
+  for (unsigned int i = 0; i < indSimSumRowInv.size(); i++)
+    left_mult_diagonal.push_back(triplet(i, i, indSimSumRowInv[i])); 
+  left_mult.reserve(left_mult_diagonal.size()); 
+  left_mult.setFromTriplets(left_mult_diagonal.begin(), left_mult_diagonal.end()); 
+  sim_mat = left_mult * sim_mat; 
+}
+
+int main(int argc, char** argv){
+  if (argc < 3){
+    cerr << "Usage: " << argv[0] << " num_nodes k [csr|eigen]" << endl; 
+    return 1; 
+  }
+  const int num_nodes = atoi(argv[1]); 
+  const int k = atoi(argv[2]); 
+  const string method = (argc > 3) ? argv[3] : "csr"; 
+  vector<triplet> triplets = generateKNNTriplets(num_nodes, k); 
+  const double triplets_mb = Metrics::peakMemoryMB(); 
+  cout << "Generated " << triplets.size() << " triplets for " << num_nodes << " nodes; peak memory: " << triplets_mb << " MB" << endl; 
+  SparseMatrix<double,RowMajor> sim_mat; 
+  double start = omp_get_wtime(); 
+  if (method == "eigen")
+    eigenSymmetrizeAndNormalize(triplets, num_nodes, sim_mat); 
+  else
+    Graph::symmetrizeAndNormalize(triplets, num_nodes, sim_mat); 
+  const double final_mb = sim_mat.nonZeros() * (sizeof(double) + sizeof(int)) / (1024.0 * 1024.0); 
+  cout << "Method: " << method << "; threads: " << omp_get_max_threads() << "; NNZs: " << sim_mat.nonZeros() << endl; 
+  cout << "Wall time: " << omp_get_wtime() - start << " seconds" << endl; 
+  cout << "Peak memory: " << Metrics::peakMemoryMB() << " MB (" << triplets_mb << " MB after generating triplets; final matrix: " << final_mb << " MB)" << endl; 
+  return 0; 
+}
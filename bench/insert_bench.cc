@@ -0,0 +1,99 @@
+#include "src/graph.h"
+#include "src/sparse_cosine.h"
+#include "src/compact_matrix.h"
+#include "bench/synthetic.h"
+#include <iostream>
+#include <random>
+#include <limits>
+#include <stdio.h>
+#include <unistd.h>
+#include <omp.h>
+
+using namespace std; 
+using namespace Eigen; 
+
+//checks and times inserting phrases into a kNN graph (Graph::insertNodes) against building it from scratch
+//usage: insert_bench [feature_matrix.mtx | num_rows num_features] [num_new] [batch_size] [k]
+//the last num_new rows of the feature matrix are held out of the graph and inserted batch_size at a time; the graph is
+//then compared entry by entry with Graph(features, k) over all rows, and so is the graph before the insertions, read
+//back from a file, with the written delta applied. synthetic rows come from generatePMIMatrix in
+//bench/synthetic.h, and every 20th row repeats an earlier one, so that some neighbors are equally similar
+
+vector<vector<pair<int,double> > > matrixRows(const SparseMatrix<double,RowMajor>& mat, const int begin, const int end){
+  vector<vector<pair<int,double> > > rows(end - begin); 
+  for (int i = begin; i < end; i++){
+    const SparseRow row = sparseRow(mat, i); 
+    for (int p = 0; p < row.size; p++)
+      rows[i - begin].push_back(make_pair(row.idx[p], row.val[p])); 
+  }
+  return rows; 
+}
+
+//largest absolute difference of two matrices' entries; infinite if their dimensions or sparsity patterns differ
+double maxDifference(const SparseMatrix<double,RowMajor>& lhs, const SparseMatrix<double,RowMajor>& rhs){
+  if (lhs.rows() != rhs.rows() || lhs.cols() != rhs.cols() || lhs.nonZeros() != rhs.nonZeros())
+    return numeric_limits<double>::infinity(); 
+  double max_diff = 0; 
+  for (int i = 0; i < lhs.rows(); i++){
+    const SparseRow a = sparseRow(lhs, i), b = sparseRow(rhs, i); 
+    if (a.size != b.size || !equal(a.idx, a.idx + a.size, b.idx))
+      return numeric_limits<double>::infinity(); 
+    for (int p = 0; p < a.size; p++)
+      max_diff = max(max_diff, fabs(a.val[p] - b.val[p])); 
+  }
+  return max_diff; 
+}
+
+int main(int argc, char** argv){
+  SparseMatrix<double,RowMajor> mat; 
+  int arg = 1; 
+  if (argc > 1 && string(argv[1]).find(".") != string::npos){
+    readMarket(argv[1], mat); 
+    arg = 2; 
+  }
+  else {
+    const int num_rows = (argc > 2) ? atoi(argv[1]) : 20000; 
+    const int num_features = (argc > 2) ? atoi(argv[2]) : 50000; 
+    mat = generatePMIMatrix(num_rows, num_features, 20); 
+    arg = (argc > 2) ? 3 : 1; 
+  }
+  const int num_new = min((int) mat.rows(), (argc > arg) ? atoi(argv[arg]) : 1000); 
+  const int batch_size = max(1, (argc > arg + 1) ? atoi(argv[arg+1]) : 100); 
+  const int k = (argc > arg + 2) ? atoi(argv[arg+2]) : 20; 
+  const int num_rows = mat.rows(), first_new = num_rows - num_new; 
+  cout << "Feature matrix: " << mat.rows() << " x " << mat.cols() << "; NNZs: " << mat.nonZeros() << "; inserting " << num_new << " rows, " << batch_size << " at a time; k = " << k << endl; 
+  FeatureExtractor all_features; 
+  all_features.addFeatureRows(matrixRows(mat, 0, num_rows), mat.cols()); 
+  double start = omp_get_wtime(); 
+  Graph rebuilt(&all_features, k); 
+  const double rebuild_time = omp_get_wtime() - start; 
+  FeatureExtractor features; 
+  features.addFeatureRows(matrixRows(mat, 0, first_new), mat.cols()); 
+  Graph graph(&features, k, vector<Phrases::Phrase*>(), true); 
+  const string prefix = string(P_tmpdir) + "/insert_bench." + to_string(getpid()); 
+  graph.writeToFile(prefix + ".simmat"); 
+  vector<double> norms = rowNorms(features.getFeatureMatrix()); 
+  double insert_time = 0, max_batch_time = 0; 
+  for (int b = first_new; b < num_rows; b += batch_size){
+    const int end = min(num_rows, b + batch_size); 
+    features.addFeatureRows(matrixRows(mat, b, end), mat.cols()); 
+    for (int i = b; i < end; i++)
+      norms.push_back(sparseNorm(sparseRow(features.getFeatureMatrix(), i))); 
+    start = omp_get_wtime(); 
+    graph.insertNodes(&features, norms, b); 
+    const double batch_time = omp_get_wtime() - start; 
+    insert_time += batch_time; 
+    max_batch_time = max(max_batch_time, batch_time); 
+  }
+  const double diff = maxDifference(graph.getSimilarityMatrix(), rebuilt.getSimilarityMatrix()); 
+  graph.writeDelta(prefix + ".delta"); 
+  Graph from_file(prefix + ".simmat"); 
+  from_file.applyDelta(prefix + ".delta"); 
+  const double file_diff = maxDifference(from_file.getSimilarityMatrix(), rebuilt.getSimilarityMatrix()); 
+  remove((prefix + ".simmat").c_str()); 
+  remove((prefix + ".delta").c_str()); 
+  cout << "Threads: " << omp_get_max_threads() << "; NNZs: " << rebuilt.getSimilarityMatrix().nonZeros() << endl; 
+  cout << "Rebuild: " << rebuild_time << " seconds; insertion: " << insert_time << " seconds (" << insert_time / ((num_new + batch_size - 1) / batch_size) << " per batch, at most " << max_batch_time << ")" << endl; 
+  cout << "Largest difference from the rebuilt graph: " << diff << " (inserted), " << file_diff << " (read from file, with the delta applied)" << endl; 
+  return (diff == 0) ? 0 : 1; 
+}
@@ -0,0 +1,85 @@
+#include "src/line_reader.h"
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <omp.h>
+
+using namespace std; 
+
+//checks and times LineReader against std::getline on a plain and a gzipped copy of the same text
+//usage: line_reader_bench [num_lines]
+//the text has short lines of random length, and lines longer than the read buffer in a row (10 MB, then 7 MB, then
+//a 20 MB one), so that a batch starts with the rest of a line that outgrew the previous one; its last line has no
+//newline. the lines are also read from the offset of a line in the middle, as a restarted reader would
+
+vector<string> readAll(const string filename){
+  ifstream file(filename.c_str()); 
+  vector<string> lines; 
+  string line; 
+  while (std::getline(file, line))
+    lines.push_back(line); 
+  return lines; 
+}
+
+//the file's lines with LineReader, from the given offset; also the offset just past line mid_line
+vector<string> readLines(const string filename, const long offset, const unsigned int mid_line, long& mid_offset){
+  LineReader reader(filename, offset); 
+  if (!reader.is_open()){ cerr << "Could not read " << filename << endl; exit(1); }
+  vector<string> lines; 
+  for (const LineBatch* batch = reader.next(); batch != NULL; batch = reader.next()){
+    for (unsigned int i = 0; i < batch->lines.size(); i++){
+      if (lines.size() == mid_line)
+	mid_offset = batch->endOffset(i); 
+      lines.push_back(batch->lines[i].to_string()); 
+    }
+  }
+  return lines; 
+}
+
+int main(int argc, char** argv){
+  const int num_lines = (argc > 1) ? atoi(argv[1]) : 1000000; 
+  const string prefix = string(P_tmpdir) + "/line_reader_bench." + to_string(getpid()); 
+  mt19937 gen(1234); 
+  uniform_int_distribution<int> length(0, 200), letter('a', 'z'); 
+  const long long_lines[3] = {10L << 20, 7L << 20, 20L << 20}; 
+  ofstream text((prefix + ".txt").c_str()); 
+  gzFile gz = gzopen((prefix + ".txt.gz").c_str(), "wb1"); 
+  long text_bytes = 0; 
+  for (int i = 0; i < num_lines + 3; i++){
+    string line(((i >= num_lines / 2) && (i < num_lines / 2 + 3)) ? long_lines[i - num_lines / 2] : length(gen), ' '); 
+    for (unsigned int k = 0; k < line.size(); k++)
+      line[k] = letter(gen); 
+    if (i < num_lines + 2) //the last line has no newline
+      line += '\n'; 
+    text << line; 
+    gzwrite(gz, line.data(), line.size()); 
+    text_bytes += line.size(); 
+  }
+  text.close(); 
+  gzclose(gz); 
+  cout << "Lines: " << num_lines + 3 << "; text: " << text_bytes / (1024.0 * 1024.0) << " MB" << endl; 
+  double start = omp_get_wtime(); 
+  const vector<string> expected = readAll(prefix + ".txt"); 
+  const double getline_time = omp_get_wtime() - start; 
+  const unsigned int mid_line = num_lines / 2 - 1; //the restart is just before the long lines
+  const vector<string> expected_rest(expected.begin() + mid_line + 1, expected.end()); 
+  bool same = true; 
+  const string suffixes[2] = {".txt", ".txt.gz"}; 
+  for (int s = 0; s < 2; s++){
+    long mid_offset = -1, unused = -1; 
+    start = omp_get_wtime(); 
+    const vector<string> lines = readLines(prefix + suffixes[s], 0, mid_line, mid_offset); 
+    const double reader_time = omp_get_wtime() - start; 
+    const vector<string> rest = readLines(prefix + suffixes[s], mid_offset, 0, unused); 
+    const bool same_lines = (lines == expected), same_rest = (rest == expected_rest); 
+    same = same && same_lines && same_rest; 
+    cout << suffixes[s] << ": LineReader " << text_bytes / reader_time / (1024.0 * 1024.0) << " MB/s; lines " << (same_lines ? "match" : "DIFFER") << ", from the middle " << (same_rest ? "match" : "DIFFER") << endl; 
+  }
+  cout << "std::getline on .txt: " << text_bytes / getline_time / (1024.0 * 1024.0) << " MB/s" << endl; 
+  remove((prefix + ".txt").c_str()); 
+  remove((prefix + ".txt.gz").c_str()); 
+  return same ? 0 : 1; 
+}
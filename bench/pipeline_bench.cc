@@ -0,0 +1,209 @@
+#include "bench/synthetic.h"
+#include "src/phrases.h"
+#include "src/featext.h"
+#include "src/graph.h"
+#include "src/lexical.h"
+#include "src/metrics.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <omp.h>
+
+using namespace std; 
+
+//end-to-end benchmark of the pipeline stages on synthetic inputs (see bench/synthetic.h)
+//usage: pipeline_bench work_dir [scales] [thread_counts] [cdec|moses]
+//       pipeline_bench generate work_dir scale [cdec|moses]
+//scales and thread counts are comma-separated lists (default: 1,2,4 for both). the inputs for each scale are generated
+//once, under work_dir/scale<N>; each thread count then runs all stages in a process of its own, so that peak resident
+//set sizes are comparable. per stage, the wall time, throughput, peak RSS so far, and speedup over the first thread
+//count are reported; the stages' own output goes to stages.log next to the inputs. 'generate' only writes the inputs,
+//along with a graph_prop configuration file for them (add a 'stage' line to run graph_prop on it)
+
+const int NUM_STOP_WORDS = 20; 
+const int WINDOW_SIZE = 2; 
+const int MAX_PHRASE_COUNT = 100; 
+const int MAX_TARGET_PHRASE_LENGTH = 5; 
+const int K = 50; 
+const int MAX_CANDIDATES = 20; 
+const int PROPAGATION_ITERATIONS = 3; 
+
+long countLines(const string filename){
+  ifstream file(filename.c_str()); 
+  long lines = 0; 
+  for (string line; getline(file, line);)
+    lines++; 
+  return lines; 
+}
+
+vector<int> parseList(const string list){
+  vector<int> values = vector<int>(); 
+  stringstream ss(list); 
+  for (string value; getline(ss, value, ',');){
+    if (atoi(value.c_str()) < 1){ cerr << "Invalid list '" << list << "': values must be positive integers" << endl; exit(0); }
+    values.push_back(atoi(value.c_str())); 
+  }
+  return values; 
+}
+
+//one line per stage: name, wall time in seconds, items processed, unit of the items, peak RSS in MB
+void record(ofstream& results, const string name, const double seconds, const long items, const string unit){
+  results << name << "\t" << seconds << "\t" << items << "\t" << unit << "\t" << Metrics::peakMemoryMB() << endl; 
+}
+
+FeatureExtractor* extractFeatures(ofstream& results, SyntheticCorpus& corpus, Phrases* phrases, const string side, const unsigned int minPL, const unsigned int maxPL){
+  double start = omp_get_wtime(); 
+  FeatureExtractor* extractor = new FeatureExtractor(); 
+  extractor->readStopWords(corpus.location("stopwords." + side), NUM_STOP_WORDS); 
+  extractor->extractFeatures(phrases, corpus.location(side + ".selected"), WINDOW_SIZE, minPL, maxPL); 
+  phrases->setMarginals(extractor->getCoocRowSums()); 
+  const double seconds = omp_get_wtime() - start; 
+  record(results, "extractFeatures(" + side + ")", seconds, countLines(corpus.location(side + ".selected")), "sentences"); 
+  start = omp_get_wtime(); 
+  extractor->rescaleCoocToPMI(); 
+  record(results, "rescaleCoocToPMI(" + side + ")", omp_get_wtime() - start, extractor->getFeatureMatrix().nonZeros(), "entries"); 
+  return extractor; 
+}
+
+//propagates from the initial candidate distributions, which are restored afterwards
+void propagate(ofstream& results, Phrases* src_phrases, Graph* src_graph, Graph* tgt_graph, const bool structured){
+  vector<Phrases::Phrase*> unlabeled_phrases = src_phrases->getUnlabeledPhrases(); 
+  vector<map<int,double> > initial_distributions = vector<map<int,double> >(); 
+  vector<unsigned int> active_set = vector<unsigned int>(); 
+  for (unsigned int i = 0; i < unlabeled_phrases.size(); i++){
+    initial_distributions.push_back(unlabeled_phrases[i]->label_distribution); 
+    active_set.push_back(unlabeled_phrases[i]->id); 
+  }
+  long updates = 0; 
+  const double start = omp_get_wtime(); 
+  for (int i = 0; i < PROPAGATION_ITERATIONS && active_set.size() > 0; i++){
+    updates += active_set.size(); 
+    if (structured)
+      src_graph->structLabelProp(src_phrases, tgt_graph, active_set, 0); 
+    else
+      src_graph->labelProp(src_phrases, active_set, 0); 
+  }
+  record(results, structured ? "structLabelProp" : "labelProp", omp_get_wtime() - start, updates, "phrase_updates"); 
+  for (unsigned int i = 0; i < unlabeled_phrases.size(); i++)
+    unlabeled_phrases[i]->label_distribution = initial_distributions[i]; 
+}
+
+//the stages in the order graph_prop runs them: SelectUnlabeled, SelectCorpora (both sides), ExtractFeatures,
+//ConstructGraphs (both sides), PropagateGraph
+void runStages(SyntheticCorpus& corpus, const string pt_format, const string results_loc){
+  ofstream results(results_loc.c_str()); 
+  if (!results.is_open()){ cerr << "Could not write benchmark results to location " << results_loc << endl; exit(0); }
+  const int pl = SyntheticCorpus::PHRASE_LENGTH; 
+  double start = omp_get_wtime(); 
+  Phrases* src_phrases = new Phrases(); 
+  src_phrases->addLabeledPhrasesFromFile(corpus.location("phrase_table.gz"), pl, pt_format); 
+  src_phrases->normalizeLabelDistributions(); 
+  src_phrases->addUnlabeledPhrasesFromFile(corpus.location("eval.txt"), pl, corpus.location("unlabeled.txt"), false); 
+  record(results, "readPhrases", omp_get_wtime() - start, corpus.numPhraseTableLines(), "lines"); 
+  Phrases* tgt_phrases = new Phrases(src_phrases); 
+  FeatureExtractor* selector = new FeatureExtractor(); 
+  start = omp_get_wtime(); 
+  selector->filterSentences(corpus.location("mono_source"), src_phrases, pl, pl, MAX_PHRASE_COUNT, corpus.location("source.selected")); 
+  record(results, "filterSentences(source)", omp_get_wtime() - start, corpus.numMonolingualSentences(), "sentences"); 
+  Phrases* mbest_phrases = new Phrases(); 
+  const int maxPL = min(MAX_TARGET_PHRASE_LENGTH, mbest_phrases->readMBestListFromFile(corpus.location("mbest.txt"), corpus.location("mbest.processed"), src_phrases->getUnlabeledPhrases())); 
+  start = omp_get_wtime(); 
+  vector<string> generated_candidates = selector->filterSentences(corpus.location("mono_target"), mbest_phrases, 1, maxPL, MAX_PHRASE_COUNT, corpus.location("target.selected")); 
+  record(results, "filterSentences(target)", omp_get_wtime() - start, corpus.numMonolingualSentences(), "sentences"); 
+  tgt_phrases->addGeneratedPhrases(generated_candidates); 
+  tgt_phrases->writePhraseIDsToFile(corpus.location("target.phraseIDs"), false); 
+  src_phrases->readLabelPhraseIDsFromFile(corpus.location("target.phraseIDs")); 
+  delete mbest_phrases; 
+  delete selector; 
+  FeatureExtractor* src_features = extractFeatures(results, corpus, src_phrases, "source", pl, pl); 
+  FeatureExtractor* tgt_features = extractFeatures(results, corpus, tgt_phrases, "target", 1, maxPL); 
+  start = omp_get_wtime(); 
+  Graph* src_graph = new Graph(src_features, K); 
+  record(results, "Graph::Graph(source)", omp_get_wtime() - start, src_features->getNumPoints(), "phrases"); 
+  delete src_features; 
+  start = omp_get_wtime(); 
+  Graph* tgt_graph = new Graph(tgt_features, K); 
+  record(results, "Graph::Graph(target)", omp_get_wtime() - start, tgt_features->getNumPoints(), "phrases"); 
+  delete tgt_features; 
+  LexicalScorer* lex = new LexicalScorer(corpus.location("lex.bin")); 
+  start = omp_get_wtime(); 
+  src_graph->initLabelsWithLexScore(src_phrases, corpus.location("mbest.processed"), lex, MAX_CANDIDATES, false); 
+  record(results, "initLabelsWithLexScore", omp_get_wtime() - start, src_phrases->getNumUnlabeledPhrases(), "phrases"); 
+  propagate(results, src_phrases, src_graph, tgt_graph, false); 
+  propagate(results, src_phrases, src_graph, tgt_graph, true); 
+  start = omp_get_wtime(); 
+  src_phrases->writePhraseTable(tgt_phrases, pt_format, corpus.location("expanded.pt"), lex); 
+  const double seconds = omp_get_wtime() - start; 
+  record(results, "writePhraseTable", seconds, countLines(corpus.location("expanded.pt")), "lines"); 
+  delete lex; 
+  delete tgt_graph; 
+  delete src_graph; 
+  delete tgt_phrases; 
+  delete src_phrases; 
+  results.close(); 
+}
+
+int main(int argc, char** argv){
+  if (argc < 2 || (string(argv[1]) == "generate" && argc < 4)){
+    cerr << "Usage: " << argv[0] << " work_dir [scales] [thread_counts] [cdec|moses]" << endl; 
+    cerr << "       " << argv[0] << " generate work_dir scale [cdec|moses]" << endl; 
+    return 1; 
+  }
+  const bool generate_only = string(argv[1]) == "generate"; 
+  const string work_dir = generate_only ? argv[2] : argv[1]; 
+  const vector<int> scales = generate_only ? parseList(argv[3]) : parseList((argc > 2) ? argv[2] : "1,2,4"); 
+  const vector<int> thread_counts = parseList((!generate_only && argc > 3) ? argv[3] : "1,2,4"); 
+  const string pt_format = (argc > 4) ? argv[4] : "cdec"; 
+  if (pt_format != "cdec" && pt_format != "moses"){ cerr << "Phrase table format must be cdec or moses" << endl; return 1; }
+  for (unsigned int s = 0; s < scales.size(); s++){
+    const string dir = generate_only ? work_dir : work_dir + "/scale" + to_string(scales[s]); 
+    double start = omp_get_wtime(); 
+    SyntheticCorpus corpus(dir, scales[s], pt_format); 
+    corpus.write(); 
+    cout << "Scale " << scales[s] << ": vocabulary of " << corpus.getVocabSize() << " words per side; " << corpus.numPhraseTableLines() << " " << pt_format << " phrase table lines; "; 
+    cout << corpus.numEvaluationSentences() << " evaluation sentences; " << corpus.numMonolingualSentences() << " monolingual sentences per side; "; 
+    cout << corpus.numMBestLines() << " m-best hypotheses; generated in " << omp_get_wtime() - start << " seconds" << endl; 
+    if (generate_only){
+      cout << "Configuration for graph_prop written to " << corpus.location("graph_prop.ini") << endl; 
+      break; 
+    }
+    map<string, double> first_seconds = map<string, double>(); //per stage, for the speedups
+    int first_threads = 0; 
+    for (unsigned int t = 0; t < thread_counts.size(); t++){
+      const string results_loc = corpus.location("results." + to_string(thread_counts[t])); 
+      const pid_t pid = fork(); //the parent never enters a parallel region, so the child starts with no OpenMP threads
+      if (pid == 0){
+	if (freopen(corpus.location("stages.log").c_str(), "a", stdout) == NULL)
+	  _exit(1); 
+	omp_set_num_threads(thread_counts[t]); 
+	runStages(corpus, pt_format, results_loc); 
+	fflush(stdout); 
+	_exit(0); 
+      }
+      int status = 0; 
+      if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+	cerr << "Benchmark run with " << thread_counts[t] << " threads failed; see " << corpus.location("stages.log") << endl; 
+	continue; 
+      }
+      if (first_threads == 0)
+	first_threads = thread_counts[t]; 
+      ifstream results(results_loc.c_str()); 
+      string name, unit; 
+      double seconds, peak_mb; 
+      long items; 
+      while (results >> name >> seconds >> items >> unit >> peak_mb){
+	cout << "  " << thread_counts[t] << " threads, " << name << ": " << seconds << " seconds; " << items / max(seconds, 1e-9) << " " << unit << "/s; peak RSS " << peak_mb << " MB"; 
+	if (first_seconds.find(name) == first_seconds.end())
+	  first_seconds[name] = seconds; 
+	else
+	  cout << "; speedup over " << first_threads << " threads: " << first_seconds[name] / max(seconds, 1e-9) << "x"; 
+	cout << endl; 
+      }
+    }
+  }
+  return 0; 
+}
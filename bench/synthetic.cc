@@ -0,0 +1,313 @@
+#include "synthetic.h"
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <math.h>
+#include <stdio.h>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include "src/extractor/data_array.h"
+#include "src/extractor/alignment.h"
+#include "src/extractor/translation_table.h"
+
+using namespace std; 
+namespace fs = boost::filesystem; 
+namespace io = boost::iostreams; 
+const string DELIMITER = " ||| "; 
+
+SyntheticCorpus::SyntheticCorpus(const string dir, const int scale, const string pt_format, const unsigned int seed) :
+  dir(dir), scale(scale), pt_format(pt_format), gen(seed) {
+  vocab_size = 2000 * scale; 
+  zipf_cdf = vector<double>(vocab_size); 
+  double total = 0; 
+  for (int r = 0; r < vocab_size; r++){
+    total += 1.0 / (r + 1); 
+    zipf_cdf[r] = total; 
+  }
+  labeled = set<string>(); 
+  unlabeled = set<string>(); 
+  mbest_hyps = vector<string>(); 
+  num_pt_lines = 0, num_eval_sentences = 0, num_mono_sentences = 0, num_mbest_lines = 0; 
+}
+
+int SyntheticCorpus::zipf(){
+  return min(vocab_size - 1, (int) (upper_bound(zipf_cdf.begin(), zipf_cdf.end(), uniform() * zipf_cdf.back()) - zipf_cdf.begin())); 
+}
+
+int SyntheticCorpus::translate(const int rank){
+  const double u = uniform(); 
+  if (u < 0.7)
+    return rank; 
+  else if (u < 0.9)
+    return min(vocab_size - 1, rank + 1 + rank % 4); 
+  return zipf(); 
+}
+
+string SyntheticCorpus::sentence(const int len, const bool source){
+  string sent = ""; 
+  for (int i = 0; i < len; i++)
+    sent += ((i > 0) ? " " : "") + (source ? sourceWord(zipf()) : targetWord(translate(zipf()))); 
+  return sent; 
+}
+
+//word by word, with some dropped, inserted (frequent) and swapped words
+string SyntheticCorpus::translatePhrase(const vector<int>& src_ranks){
+  vector<string> words = vector<string>(); 
+  for (unsigned int i = 0; i < src_ranks.size(); i++)
+    words.push_back(targetWord(translate(src_ranks[i]))); 
+  if (words.size() > 1 && uniform() < 0.15)
+    words.pop_back(); 
+  if (uniform() < 0.15)
+    words.insert(words.begin() + gen() % (words.size() + 1), targetWord(gen() % 20)); 
+  if (words.size() > 1 && uniform() < 0.2)
+    swap(words[0], words[1]); 
+  string phrase = words[0]; 
+  for (unsigned int i = 1; i < words.size(); i++)
+    phrase += " " + words[i]; 
+  return phrase; 
+}
+
+static vector<int> parseRanks(const string phrase){
+  vector<int> ranks = vector<int>(); 
+  for (size_t start = 0; start < phrase.size(); ){
+    size_t end = phrase.find(' ', start); 
+    if (end == string::npos)
+      end = phrase.size(); 
+    ranks.push_back(atoi(phrase.substr(start + 1, end - start - 1).c_str())); 
+    start = end + 1; 
+  }
+  return ranks; 
+}
+
+static string formatScore(const double val){
+  char buf[32]; 
+  snprintf(buf, sizeof(buf), "%.6g", val); 
+  return string(buf); 
+}
+
+//unigrams for the more frequent half of the vocabulary, plus Zipfian bigrams; each with 1-5 target phrases
+void SyntheticCorpus::writePhraseTable(){
+  set<string> sources = set<string>(); 
+  for (int r = 0; r < vocab_size / 2; r++)
+    sources.insert(sourceWord(r)); 
+  while ((int) labeled.size() < 4000 * scale){
+    const string bigram = sourceWord(zipf()) + " " + sourceWord(zipf()); 
+    labeled.insert(bigram); 
+    sources.insert(bigram); 
+  }
+  ofstream file(location("phrase_table.gz").c_str(), ios_base::out | ios_base::binary); 
+  if (!file.is_open()){ cerr << "Could not write phrase table to location " << location("phrase_table.gz") << endl; exit(0); }
+  io::filtering_stream<io::output> out; 
+  out.push(io::gzip_compressor()); 
+  out.push(file); 
+  for (set<string>::const_iterator it = sources.begin(); it != sources.end(); it++){ //sorted by source, as extracted tables are
+    const vector<int> src_ranks = parseRanks(*it); 
+    const int num_candidates = 1 + gen() % 5; 
+    map<string, double> candidates = map<string, double>(); 
+    double total = 0; 
+    for (int c = 0; c < num_candidates; c++){
+      const double weight = uniform() + ((c == 0) ? 1.0 : 0.0); 
+      candidates[translatePhrase(src_ranks)] += weight; 
+      total += weight; 
+    }
+    for (map<string, double>::const_iterator cand = candidates.begin(); cand != candidates.end(); cand++){
+      const double egivenf = cand->second / total, fgivene = 0.05 + 0.95 * uniform(); 
+      const double lex_egivenf = 0.01 + 0.99 * uniform(), lex_fgivene = 0.01 + 0.99 * uniform(); 
+      const int count_ef = 1 + gen() % 50; 
+      if (pt_format == "cdec"){
+	out << "[X]" << DELIMITER << *it << DELIMITER << cand->first << DELIMITER << "EgivenFCoherent=" << formatScore(max(0.0, -log10(egivenf))); 
+	out << " SampleCountF=" << formatScore(log10(1 + count_ef / egivenf)) << " CountEF=" << formatScore(log10(1 + count_ef)); 
+	out << " MaxLexFgivenE=" << formatScore(-log10(lex_fgivene)) << " MaxLexEgivenF=" << formatScore(-log10(lex_egivenf)); 
+	out << " IsSingletonF=0 IsSingletonFE=" << ((count_ef == 1) ? 1 : 0) << DELIMITER << "0-0" << endl; 
+      }
+      else { //moses order is P(f|e) lex(f|e) P(e|f) lex(e|f)
+	out << *it << DELIMITER << cand->first << DELIMITER << formatScore(fgivene) << " " << formatScore(lex_fgivene) << " "; 
+	out << formatScore(egivenf) << " " << formatScore(lex_egivenf) << DELIMITER << "0-0" << DELIMITER; 
+	out << (int) (count_ef / fgivene) << " " << (int) (count_ef / egivenf) << " " << count_ef << endl; 
+      }
+      num_pt_lines++; 
+    }
+  }
+}
+
+//the bigrams of the evaluation set that are not in the phrase table become the unlabeled phrases
+void SyntheticCorpus::writeEvaluationSet(){
+  ofstream out(location("eval.txt").c_str()); 
+  if (!out.is_open()){ cerr << "Could not write evaluation set to location " << location("eval.txt") << endl; exit(0); }
+  for (num_eval_sentences = 0; num_eval_sentences < 250 * scale; num_eval_sentences++){
+    const string sent = sentence(8 + gen() % 17, true); 
+    out << sent << endl; 
+    const vector<int> ranks = parseRanks(sent); 
+    for (unsigned int i = 0; i + PHRASE_LENGTH <= ranks.size(); i++){
+      const string bigram = sourceWord(ranks[i]) + " " + sourceWord(ranks[i+1]); 
+      if (labeled.find(bigram) == labeled.end())
+	unlabeled.insert(bigram); 
+    }
+  }
+  out.close(); 
+}
+
+//cdec k-best format: index of the unlabeled phrase (in phrase ID order) ||| hypothesis ||| features ||| score
+void SyntheticCorpus::writeMBestList(){
+  ofstream out(location("mbest.txt").c_str()); 
+  if (!out.is_open()){ cerr << "Could not write m-best list to location " << location("mbest.txt") << endl; exit(0); }
+  int idx = 0; 
+  for (set<string>::const_iterator it = unlabeled.begin(); it != unlabeled.end(); it++, idx++){
+    const vector<int> src_ranks = parseRanks(*it); 
+    for (int m = 0; m < 5; m++){
+      const double lm = -5 - 10 * uniform(), wp = -1.0 * (1 + gen() % 3); 
+      const string hyp = translatePhrase(src_ranks); 
+      mbest_hyps.push_back(hyp); 
+      out << idx << DELIMITER << hyp << DELIMITER << "LanguageModel=" << formatScore(lm) << " WordPenalty=" << formatScore(wp); 
+      out << DELIMITER << formatScore(0.5 * lm + wp) << endl; 
+      num_mbest_lines++; 
+    }
+  }
+  out.close(); 
+}
+
+//target sentences are translations of Zipfian source sentences. half of the sentences contain an unlabeled phrase
+//(source) or an m-best hypothesis (target), so that corpus selection keeps them
+void SyntheticCorpus::writeMonolingual(const string subdir, const bool source){
+  fs::create_directories(location(subdir)); 
+  const vector<string> spliced = source ? vector<string>(unlabeled.begin(), unlabeled.end()) : mbest_hyps; 
+  const long num_sentences = 10000L * scale; 
+  for (int f = 0; f < MONO_FILES; f++){
+    const string filename = location(subdir + "/part" + to_string(f) + ".gz"); 
+    ofstream file(filename.c_str(), ios_base::out | ios_base::binary); 
+    if (!file.is_open()){ cerr << "Could not write monolingual corpus to location " << filename << endl; exit(0); }
+    io::filtering_stream<io::output> out; 
+    out.push(io::gzip_compressor()); 
+    out.push(file); 
+    for (long s = f * num_sentences / MONO_FILES; s < (f + 1) * num_sentences / MONO_FILES; s++){
+      const int len = 5 + gen() % 30; 
+      if (!spliced.empty() && uniform() < 0.5){
+	const int pos = gen() % len; 
+	const string prefix = (pos > 0) ? sentence(pos, source) + " " : ""; 
+	const string suffix = (pos < len - 1) ? " " + sentence(len - 1 - pos, source) : ""; 
+	out << prefix << spliced[gen() % spliced.size()] << suffix << endl; 
+      }
+      else
+	out << sentence(len, source) << endl; 
+    }
+  }
+  num_mono_sentences = num_sentences; 
+}
+
+//most frequent types first, with their expected counts in the monolingual corpus
+void SyntheticCorpus::writeStopWords(const string filename, const bool source){
+  ofstream out(location(filename).c_str()); 
+  if (!out.is_open()){ cerr << "Could not write stop words to location " << location(filename) << endl; exit(0); }
+  const double num_tokens = 10000.0 * scale * 19.5; 
+  for (int r = 0; r < min(100, vocab_size); r++)
+    out << (source ? sourceWord(r) : targetWord(r)) << "\t" << (long) (num_tokens * (1.0 / (r + 1)) / zipf_cdf.back()) << endl; 
+  out.close(); 
+}
+
+//a word-aligned bitext (source ||| target, and i-j alignment points), compiled into a lexical translation table with
+//the extractor, as a suffix array grammar extractor would for the real parallel corpus
+void SyntheticCorpus::writeLexicalModel(){
+  ofstream bitext(location("bitext.txt").c_str()); 
+  ofstream alignment(location("alignment.txt").c_str()); 
+  if (!bitext.is_open() || !alignment.is_open()){ cerr << "Could not write bitext to location " << location("bitext.txt") << endl; exit(0); }
+  for (int s = 0; s < 2500 * scale; s++){
+    const vector<int> src_ranks = parseRanks(sentence(5 + gen() % 20, true)); 
+    string src = "", tgt = "", links = ""; 
+    int j = 0; 
+    for (unsigned int i = 0; i < src_ranks.size(); i++){
+      src += ((i > 0) ? " " : "") + sourceWord(src_ranks[i]); 
+      if (uniform() < 0.05) //unaligned source word
+	continue; 
+      tgt += ((j > 0) ? " " : "") + targetWord(translate(src_ranks[i])); 
+      links += ((j > 0) ? " " : "") + to_string(i) + "-" + to_string(j); 
+      j++; 
+    }
+    if (j == 0)
+      tgt = targetWord(0); 
+    bitext << src << DELIMITER << tgt << endl; 
+    alignment << links << endl; 
+  }
+  bitext.close(); 
+  alignment.close(); 
+  shared_ptr<extractor::DataArray> src_data = make_shared<extractor::DataArray>(location("bitext.txt"), extractor::SOURCE); 
+  shared_ptr<extractor::DataArray> tgt_data = make_shared<extractor::DataArray>(location("bitext.txt"), extractor::TARGET); 
+  shared_ptr<extractor::Alignment> links = make_shared<extractor::Alignment>(location("alignment.txt")); 
+  extractor::TranslationTable table(src_data, tgt_data, links); 
+  ofstream table_file(location("lex.bin").c_str(), ios_base::out | ios_base::binary); 
+  if (!table_file.is_open()){ cerr << "Could not write lexical model to location " << location("lex.bin") << endl; exit(0); }
+  boost::archive::binary_oarchive oa(table_file); 
+  oa << table; 
+}
+
+void SyntheticCorpus::writeConfig(){
+  ofstream out(location("graph_prop.ini").c_str()); 
+  if (!out.is_open()){ cerr << "Could not write configuration to location " << location("graph_prop.ini") << endl; exit(0); }
+  out << "phrase_table=" << location("phrase_table.gz") << endl; 
+  out << "phrase_table_format=" << pt_format << endl; 
+  out << "phrase_length=" << PHRASE_LENGTH << endl; 
+  out << "evaluation_corpus=" << location("eval.txt") << endl; 
+  out << "write_unlabeled=" << location("unlabeled.txt") << endl; 
+  out << "source_mono_dir=" << location("mono_source") << endl; 
+  out << "target_mono_dir=" << location("mono_target") << endl; 
+  out << "source_monolingual=" << location("source.selected") << endl; 
+  out << "target_monolingual=" << location("target.selected") << endl; 
+  out << "mbest_fromdecoder_location=" << location("mbest.txt") << endl; 
+  out << "mbest_processed_location=" << location("mbest.processed") << endl; 
+  out << "target_phraseIDs=" << location("target.phraseIDs") << endl; 
+  out << "source_stopwords=" << location("stopwords.source") << endl; 
+  out << "target_stopwords=" << location("stopwords.target") << endl; 
+  const string sides[2] = {"source", "target"}; 
+  for (int s = 0; s < 2; s++){
+    out << sides[s] << "_feature_extractor=" << location(sides[s] + ".invidx") << endl; 
+    out << sides[s] << "_cooc_matrix=" << location(sides[s] + ".cooc") << endl; 
+    out << sides[s] << "_feature_matrix=" << location(sides[s] + ".featmat") << endl; 
+    out << sides[s] << "_similarity_matrix=" << location(sides[s] + ".simmat") << endl; 
+  }
+  out << "k_nearest_neighbors=50" << endl; 
+  out << "lexical_model_location=" << location("lex.bin") << endl; 
+  out << "expanded_phrase_table_loc=" << location("expanded.pt") << endl; 
+  out.close(); 
+}
+
+void SyntheticCorpus::write(){
+  fs::create_directories(dir); 
+  writePhraseTable(); 
+  writeEvaluationSet(); 
+  writeMBestList(); 
+  writeMonolingual("mono_source", true); 
+  writeMonolingual("mono_target", false); 
+  writeStopWords("stopwords.source", true); 
+  writeStopWords("stopwords.target", false); 
+  writeLexicalModel(); 
+  writeConfig(); 
+}
+
+SparseMatrix<double,RowMajor> generatePMIMatrix(const int num_rows, const int num_features, const int repeat_interval){
+  mt19937 gen(1234); 
+  uniform_real_distribution<double> unif(0.0, 1.0); 
+  vector<vector<pair<int,double> > > rows(num_rows); 
+  for (int i = 0; i < num_rows; i++){
+    if (repeat_interval > 0 && i % repeat_interval == repeat_interval - 1){
+      rows[i] = rows[gen() % i]; 
+      continue; 
+    }
+    const int len = min(num_features / 4, (int) (4 * pow(1.0 - unif(gen), -1.0 / 1.2))); //Pareto: mostly short rows, a few very long ones
+    set<int> features = set<int>(); 
+    while ((int) features.size() < len)
+      features.insert((int) (num_features * pow(unif(gen), 3))); //frequent contexts have low IDs
+    for (set<int>::iterator it = features.begin(); it != features.end(); it++)
+      rows[i].push_back(make_pair(*it, 10 * unif(gen))); 
+  }
+  vector<Triplet<double> > triplets = vector<Triplet<double> >(); 
+  for (int i = 0; i < num_rows; i++){
+    for (unsigned int p = 0; p < rows[i].size(); p++)
+      triplets.push_back(Triplet<double>(i, rows[i][p].first, rows[i][p].second)); 
+  }
+  SparseMatrix<double,RowMajor> mat(num_rows, num_features); 
+  mat.setFromTriplets(triplets.begin(), triplets.end()); 
+  return mat; 
+}
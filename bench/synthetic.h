@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <random>
+#include <Eigen/Sparse>
+
+using namespace std; 
+using namespace Eigen; 
+
+//deterministic synthetic inputs for every stage of the pipeline, growing linearly with one scale factor: a phrase table
+//(cdec or moses format), an evaluation set, Zipfian monolingual corpora (gzipped, one directory per side, as corpus
+//selection expects), stop word lists, a decoder m-best list for the unlabeled phrases, and a lexical model compiled
+//from a word-aligned bitext. target words are noisy translations of source words of similar rank, so that the phrase
+//table, m-best list, bitext and target corpus agree with each other. the same scale and seed always give the same files
+class SyntheticCorpus {
+ public:
+  SyntheticCorpus(const string dir, const int scale, const string pt_format, const unsigned int seed=1234); 
+  void write(); //all inputs, plus a graph_prop configuration (without a 'stage') that points at them
+  string location(const string name){ return dir + "/" + name; }
+  int getVocabSize(){ return vocab_size; }
+  long numPhraseTableLines(){ return num_pt_lines; }
+  long numEvaluationSentences(){ return num_eval_sentences; }
+  long numMonolingualSentences(){ return num_mono_sentences; } //per side
+  long numMBestLines(){ return num_mbest_lines; }
+  static const int PHRASE_LENGTH = 2; 
+  static const int MONO_FILES = 8; //per side; corpus selection reads the files in parallel
+
+ private:
+  int zipf(); //word rank, with P(r) proportional to 1/(r+1)
+  double uniform(){ return gen() / 4294967296.0; } //mt19937 is fully specified, unlike the standard distributions
+  int translate(const int rank); //a target rank for a source rank: usually the closest one, sometimes an alternative
+  string sourceWord(const int rank){ return "f" + to_string(rank); }
+  string targetWord(const int rank){ return "e" + to_string(rank); }
+  string sentence(const int len, const bool source); 
+  string translatePhrase(const vector<int>& src_ranks); 
+  void writePhraseTable(); 
+  void writeEvaluationSet(); 
+  void writeMonolingual(const string subdir, const bool source); 
+  void writeStopWords(const string filename, const bool source); 
+  void writeMBestList(); 
+  void writeLexicalModel(); 
+  void writeConfig(); 
+  string dir; 
+  int scale; 
+  string pt_format; 
+  mt19937 gen; 
+  int vocab_size; 
+  vector<double> zipf_cdf; 
+  set<string> labeled; //source phrases of the phrase table with PHRASE_LENGTH words
+  set<string> unlabeled; //in the order Phrases assigns them IDs, which the m-best list refers to
+  vector<string> mbest_hyps; 
+  long num_pt_lines; 
+  long num_eval_sentences; 
+  long num_mono_sentences; 
+  long num_mbest_lines; 
+}; 
+
+//a feature matrix like our PMI matrices, for the kernel and graph benchmarks: power-law row lengths and feature
+//frequencies, and positive values. with a repeat_interval, every repeat_interval-th row repeats an earlier one, so
+//that some rows have equally similar neighbors
+SparseMatrix<double,RowMajor> generatePMIMatrix(const int num_rows, const int num_features, const int repeat_interval=0); 
@@ -0,0 +1,90 @@
+#include "cache.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <stdio.h>
+
+using namespace std; 
+const string FINGERPRINT_EXT = ".fingerprint"; 
+const string FINGERPRINT_DELIM = " ||| "; 
+const unsigned int HASH_BUFFER_SIZE = 1 << 20; 
+
+StageCache::StageCache(const string output_loc) : output_loc(output_loc){
+  fingerprint_loc = output_loc + FINGERPRINT_EXT; 
+  fingerprint = map<string, string>(); 
+  outputs = vector<string>(1, output_loc); 
+}
+
+StageCache::~StageCache(){
+}
+
+void StageCache::addFile(const string key, const string filename){
+  fingerprint[key] = hashFile(filename); 
+}
+
+void StageCache::addValue(const string key, const string value){
+  fingerprint[key] = value; 
+}
+
+//other files the stage writes, which must also still exist for the cache to be valid
+void StageCache::addOutput(const string filename){
+  outputs.push_back(filename); 
+}
+
+//valid if the outputs exist and the fingerprint written alongside them matches the current one
+bool StageCache::isValid(){
+  for (unsigned int i = 0; i < outputs.size(); i++){
+    ifstream output(outputs[i].c_str()); 
+    if (!output.good())
+      return false; 
+  }
+  ifstream fingerprintFile(fingerprint_loc.c_str()); 
+  if (!fingerprintFile.is_open())
+    return false; 
+  map<string, string> stored = map<string, string>(); 
+  string line; 
+  while (getline(fingerprintFile, line)){
+    size_t pos = line.find(FINGERPRINT_DELIM); 
+    if (pos == string::npos)
+      return false; 
+    stored[line.substr(0, pos)] = line.substr(pos + FINGERPRINT_DELIM.length()); 
+  }
+  fingerprintFile.close(); 
+  return stored == fingerprint; 
+}
+
+void StageCache::commit(){
+  ofstream fingerprintFile(fingerprint_loc.c_str()); 
+  if (!fingerprintFile.is_open()){
+    cerr << "Could not write fingerprint to location " << fingerprint_loc << endl; 
+    return; 
+  }
+  for (map<string, string>::const_iterator it = fingerprint.begin(); it != fingerprint.end(); it++)
+    fingerprintFile << it->first << FINGERPRINT_DELIM << it->second << "\n"; 
+  fingerprintFile.close(); 
+}
+
+void StageCache::invalidate(){
+  remove(fingerprint_loc.c_str()); 
+}
+
+//64-bit FNV-1a hash over the raw bytes of the file (compressed files are hashed as is)
+string StageCache::hashFile(const string filename){
+  ifstream file(filename.c_str(), ios_base::in | ios_base::binary); 
+  if (!file.is_open())
+    return "missing"; 
+  unsigned long long hash = 14695981039346656037ULL; 
+  vector<char> buffer(HASH_BUFFER_SIZE); 
+  while (file){
+    file.read(&buffer[0], buffer.size()); 
+    const streamsize bytesRead = file.gcount(); 
+    for (streamsize i = 0; i < bytesRead; i++){
+      hash ^= (unsigned char) buffer[i]; 
+      hash *= 1099511628211ULL; 
+    }
+  }
+  file.close(); 
+  char hex[17]; 
+  snprintf(hex, sizeof(hex), "%016llx", hash); 
+  return string(hex); 
+}
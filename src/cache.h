@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+//records content hashes of a stage's inputs and the config values it depends on in a 
+//fingerprint file next to the stage's output, so that unchanged stages can be skipped
+class StageCache {
+ public:
+  explicit StageCache(const string output_loc); 
+  ~StageCache();
+  void addFile(const string key, const string filename); 
+  void addValue(const string key, const string value); 
+  void addOutput(const string filename); 
+  bool isValid(); 
+  void commit(); 
+  void invalidate(); //removes the fingerprint
+  string getOutput(){ return output_loc; }
+  static string hashFile(const string filename); 
+
+ private:
+  string output_loc; 
+  string fingerprint_loc; 
+  map<string, string> fingerprint; 
+  vector<string> outputs; 
+};
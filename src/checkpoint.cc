@@ -0,0 +1,86 @@
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/vector.hpp>
+#include "checkpoint.h"
+
+using namespace std; 
+const string CHECKPOINT_TMP_EXT = ".tmp"; 
+
+CheckpointWriter::CheckpointWriter(StageCache* fingerprint) : fingerprint(fingerprint){
+  committed = false; 
+}
+
+CheckpointWriter::~CheckpointWriter(){
+  wait(); 
+}
+
+void CheckpointWriter::wait(){
+  if (writer.joinable())
+    writer.join(); 
+}
+
+void CheckpointWriter::write(function<void(ostream&)> serializer){
+  wait(); 
+  const string checkpoint_loc = fingerprint->getOutput(); 
+  if (!committed){ //a stale checkpoint must not be resumed with the new fingerprint
+    ::remove(checkpoint_loc.c_str()); 
+    fingerprint->commit(); 
+    committed = true; 
+  }
+  writer = thread([checkpoint_loc, serializer](){
+      const string tmp_loc = checkpoint_loc + CHECKPOINT_TMP_EXT; 
+      ofstream outFile(tmp_loc.c_str(), ios_base::out | ios_base::binary); 
+      if (!outFile.is_open()){ cerr << "Could not write checkpoint to location " << tmp_loc << endl; return; }
+      serializer(outFile); 
+      outFile.close(); 
+      if (outFile.fail() || rename(tmp_loc.c_str(), checkpoint_loc.c_str()) != 0)
+	cerr << "Could not write checkpoint to location " << checkpoint_loc << endl; 
+    }); 
+}
+
+void CheckpointWriter::remove(){
+  wait(); 
+  fingerprint->invalidate(); 
+  ::remove(fingerprint->getOutput().c_str()); 
+}
+
+PropagationState PropagationState::capture(Phrases* src_phrases, const int iterations, const bool converged, const vector<unsigned int>& active_set, const vector<double>& residuals){
+  PropagationState state; 
+  state.iterations = iterations; 
+  state.converged = converged; 
+  state.active_set = active_set; 
+  state.residuals = residuals; 
+  vector<Phrases::Phrase*> unlabeled_phrases = src_phrases->getUnlabeledPhrases(); 
+  for (unsigned int i = 0; i < unlabeled_phrases.size(); i++){
+    state.phrase_ids.push_back(unlabeled_phrases[i]->id); 
+    state.distributions.push_back(unlabeled_phrases[i]->label_distribution); 
+  }
+  return state; 
+}
+
+void PropagationState::restore(Phrases* src_phrases){
+  for (unsigned int i = 0; i < phrase_ids.size(); i++)
+    src_phrases->getNthPhrase(phrase_ids[i])->label_distribution.swap(distributions[i]); 
+  vector<map<int, double> >().swap(distributions); 
+  vector<Phrases::Phrase*> labeled_phrases = src_phrases->getLabeledPhrases(); 
+  for (unsigned int i = 0; i < labeled_phrases.size(); i++) //as candidate initialization, which renormalizes all phrases
+    labeled_phrases[i]->normalizeDistribution(); 
+}
+
+void PropagationState::write(ostream& out) const {
+  boost::archive::binary_oarchive oa(out); 
+  oa << iterations << converged << active_set << residuals << phrase_ids << distributions; 
+}
+
+bool PropagationState::read(const string checkpointLoc){
+  ifstream inFile(checkpointLoc.c_str(), ios_base::in | ios_base::binary); 
+  if (!inFile.is_open())
+    return false; 
+  boost::archive::binary_iarchive ia(inFile); 
+  ia >> iterations >> converged >> active_set >> residuals >> phrase_ids >> distributions; 
+  return true; 
+}
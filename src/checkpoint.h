@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <functional>
+#include <ostream>
+#include "phrases.h"
+#include "cache.h"
+
+using namespace std; 
+
+//writes checkpoints on a background thread: the caller copies the state it needs into the serializer, which writes it
+//to a temporary file that is then renamed over the checkpoint, so the checkpoint on disk is always a complete one.
+//the checkpoint's fingerprint (a StageCache over the stage's inputs) is committed before the first write, after any
+//stale checkpoint is removed, so that only checkpoints written for the same inputs are ever resumed from
+class CheckpointWriter {
+ public:
+  explicit CheckpointWriter(StageCache* fingerprint); 
+  ~CheckpointWriter(); //waits for the last write
+  void write(function<void(ostream&)> serializer); //waits for the previous write, then starts this one
+  void wait(); 
+  void remove(); //once the stage is complete
+  static bool canResume(StageCache* fingerprint){ return fingerprint != NULL && fingerprint->isValid(); }
+
+ private:
+  StageCache* fingerprint; 
+  bool committed; 
+  thread writer; 
+}; 
+
+//graph propagation after some number of iterations; resuming from it skips candidate initialization
+struct PropagationState {
+  int iterations; //completed
+  bool converged; 
+  vector<unsigned int> active_set; 
+  vector<double> residuals; 
+  vector<int> phrase_ids; //unlabeled phrases
+  vector<map<int, double> > distributions; 
+  static PropagationState capture(Phrases* src_phrases, const int iterations, const bool converged, const vector<unsigned int>& active_set, const vector<double>& residuals); 
+  void restore(Phrases* src_phrases); 
+  void write(ostream& out) const; 
+  bool read(const string checkpointLoc); 
+}; 
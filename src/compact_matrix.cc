@@ -0,0 +1,205 @@
+#include <iostream>
+#include <string.h>
+#include <math.h>
+#include "compact_matrix.h"
+#include "line_reader.h"
+
+using namespace std; 
+
+const char COMPACT_MAGIC[8] = {'G', 'P', 'S', 'I', 'M', 'M', 'A', 'T'}; 
+const int PRECISION_FLOAT = 0, PRECISION_INT16 = 1, PRECISION_INT8 = 2; 
+const long HEADER_NNZ_OFFSET = sizeof(COMPACT_MAGIC) + 3*sizeof(int); 
+const long READ_WINDOW_BYTES = 1 << 20; 
+
+CompactMatrixWriter::CompactMatrixWriter(const string matLoc, const int rows, const int cols, const string precision) :
+  num_rows(rows) {
+  precision_code = (precision == "float") ? PRECISION_FLOAT : ((precision == "int16") ? PRECISION_INT16 : PRECISION_INT8); 
+  rows_written = 0, nnz = 0; 
+  buf = vector<unsigned char>(); 
+  file.open(matLoc.c_str(), ios_base::out | ios_base::binary); 
+  if (!file.is_open()){ cerr << "Could not write similarity matrix to location " << matLoc << endl; exit(0); }
+  file.write(COMPACT_MAGIC, sizeof(COMPACT_MAGIC)); 
+  file.write(reinterpret_cast<const char*>(&precision_code), sizeof(int)); 
+  file.write(reinterpret_cast<const char*>(&rows), sizeof(int)); 
+  file.write(reinterpret_cast<const char*>(&cols), sizeof(int)); 
+  file.write(reinterpret_cast<const char*>(&nnz), sizeof(int64_t)); //filled in by close()
+}
+
+CompactMatrixWriter::~CompactMatrixWriter(){
+  if (file.is_open())
+    close(); 
+}
+
+void CompactMatrixWriter::writeVarint(unsigned long value){
+  while (value >= 0x80){
+    buf.push_back((value & 0x7f) | 0x80); 
+    value >>= 7; 
+  }
+  buf.push_back(value); 
+}
+
+void CompactMatrixWriter::writeRow(const int* cols, const double* vals, const int size){
+  writeVarint(size); 
+  for (int k = 0; k < size; k++)
+    writeVarint((k == 0) ? cols[k] : cols[k] - cols[k-1]); 
+  if (precision_code == PRECISION_FLOAT){
+    for (int k = 0; k < size; k++){
+      const float val = vals[k]; 
+      buf.insert(buf.end(), reinterpret_cast<const unsigned char*>(&val), reinterpret_cast<const unsigned char*>(&val) + sizeof(float)); 
+    }
+  }
+  else {
+    float scale = 0; //largest value in the row
+    for (int k = 0; k < size; k++)
+      scale = max(scale, (float) vals[k]); 
+    buf.insert(buf.end(), reinterpret_cast<const unsigned char*>(&scale), reinterpret_cast<const unsigned char*>(&scale) + sizeof(float)); 
+    const double max_code = (precision_code == PRECISION_INT16) ? 65535.0 : 255.0; 
+    for (int k = 0; k < size; k++){
+      const unsigned int code = (scale > 0) ? (unsigned int) lround(min(1.0, vals[k] / scale) * max_code) : 0; 
+      buf.push_back(code & 0xff); 
+      if (precision_code == PRECISION_INT16)
+	buf.push_back(code >> 8); 
+    }
+  }
+  nnz += size; 
+  rows_written++; 
+  if (buf.size() > (1 << 20)){
+    file.write(reinterpret_cast<const char*>(&buf[0]), buf.size()); 
+    buf.clear(); 
+  }
+}
+
+void CompactMatrixWriter::close(){
+  const int cols = 0; 
+  const double vals = 0; 
+  while (rows_written < num_rows) //trailing empty rows
+    writeRow(&cols, &vals, 0); 
+  if (buf.size() > 0)
+    file.write(reinterpret_cast<const char*>(&buf[0]), buf.size()); 
+  buf.clear(); 
+  file.seekp(HEADER_NNZ_OFFSET); 
+  file.write(reinterpret_cast<const char*>(&nnz), sizeof(int64_t)); 
+  file.close(); 
+}
+
+void CompactMatrixWriter::write(const SparseMatrix<double,RowMajor>& mat, const string matLoc, const string precision){
+  CompactMatrixWriter writer(matLoc, mat.rows(), mat.cols(), precision); 
+  for (int i = 0; i < mat.rows(); i++){
+    const int begin = mat.outerIndexPtr()[i]; 
+    const int size = mat.isCompressed() ? mat.outerIndexPtr()[i+1] - begin : mat.innerNonZeroPtr()[i]; 
+    writer.writeRow(mat.innerIndexPtr() + begin, mat.valuePtr() + begin, size); 
+  }
+  writer.close(); 
+}
+
+//decodes straight into the CSR arrays of mat, reading the body through a fixed-size window rather than all at once
+bool CompactMatrixWriter::read(const string matLoc, SparseMatrix<double,RowMajor>& mat){
+  ifstream file(matLoc.c_str(), ios_base::in | ios_base::binary); 
+  if (!file.is_open()){ cerr << "Could not read similarity matrix at location " << matLoc << endl; exit(0); }
+  char magic[sizeof(COMPACT_MAGIC)]; 
+  file.read(magic, sizeof(magic)); 
+  if (!file || memcmp(magic, COMPACT_MAGIC, sizeof(magic)) != 0)
+    return false; 
+  int precision_code, rows, cols; 
+  int64_t nnz; 
+  file.read(reinterpret_cast<char*>(&precision_code), sizeof(int)); 
+  file.read(reinterpret_cast<char*>(&rows), sizeof(int)); 
+  file.read(reinterpret_cast<char*>(&cols), sizeof(int)); 
+  file.read(reinterpret_cast<char*>(&nnz), sizeof(int64_t)); 
+  const long body_start = file.tellg(); 
+  file.seekg(0, ios_base::end); 
+  const long body_bytes = (long) file.tellg() - body_start; 
+  file.seekg(body_start); 
+  if (!file || rows < 0 || cols < 0 || nnz < 0 || nnz > body_bytes){ cerr << "Similarity matrix at location " << matLoc << " is truncated or corrupt" << endl; exit(0); } //every entry takes at least 1 byte
+  mat = SparseMatrix<double,RowMajor>(rows, cols); 
+  mat.resizeNonZeros(nnz); 
+  int* outer = mat.outerIndexPtr(); 
+  int* inner = mat.innerIndexPtr(); 
+  double* values = mat.valuePtr(); 
+  vector<unsigned char> window(READ_WINDOW_BYTES); 
+  const unsigned char* pos = window.data(); 
+  const unsigned char* end = window.data(); 
+  auto checkBytes = [&file, &window, &pos, &end, &matLoc](const long bytes){ //refills the window; bytes is at most sizeof(float)
+    if (end - pos >= bytes)
+      return; 
+    const long left = end - pos; 
+    memmove(window.data(), pos, left); 
+    file.read(reinterpret_cast<char*>(window.data() + left), window.size() - left); 
+    pos = window.data(); 
+    end = window.data() + left + file.gcount(); 
+    if (end - pos < bytes){ cerr << "Similarity matrix at location " << matLoc << " is truncated or corrupt" << endl; exit(0); }
+  }; 
+  auto readVarint = [&pos, &checkBytes](){
+    unsigned long value = 0; 
+    for (int shift = 0; ; shift += 7){
+      checkBytes(1); 
+      const unsigned char byte = *pos++; 
+      value |= (unsigned long) (byte & 0x7f) << shift; 
+      if (!(byte & 0x80))
+	return value; 
+    }
+  }; 
+  auto readFloat = [&pos, &checkBytes](){
+    checkBytes(sizeof(float)); 
+    float val; 
+    memcpy(&val, pos, sizeof(float)); 
+    pos += sizeof(float); 
+    return val; 
+  }; 
+  const int code_bytes = (precision_code == PRECISION_INT16) ? 2 : 1; 
+  const double max_code = (precision_code == PRECISION_INT16) ? 65535.0 : 255.0; 
+  int64_t p = 0; 
+  for (int i = 0; i < rows; i++){
+    outer[i] = p; 
+    const int size = readVarint(); 
+    if (p + size > nnz){ cerr << "Similarity matrix at location " << matLoc << " is truncated or corrupt" << endl; exit(0); }
+    int col = 0; 
+    for (int k = 0; k < size; k++){
+      col = (k == 0) ? readVarint() : col + readVarint(); 
+      inner[p + k] = col; 
+    }
+    if (precision_code == PRECISION_FLOAT){
+      for (int k = 0; k < size; k++)
+	values[p + k] = readFloat(); 
+    }
+    else {
+      const double step = readFloat() / max_code; 
+      for (int k = 0; k < size; k++){
+	checkBytes(code_bytes); 
+	unsigned int code = *pos++; 
+	if (precision_code == PRECISION_INT16)
+	  code |= (unsigned int) (*pos++) << 8; 
+	values[p + k] = code * step; 
+      }
+    }
+    p += size; 
+  }
+  outer[rows] = p; 
+  if (p != nnz){ cerr << "Similarity matrix at location " << matLoc << " is truncated or corrupt" << endl; exit(0); }
+  return true; 
+}
+
+void readMarket(const string matLoc, SparseMatrix<double,RowMajor>& mat){
+  LineReader file(matLoc); 
+  if (!file.is_open()){ cerr << "Could not read matrix at location " << matLoc << endl; exit(0); }
+  vector<Triplet<double> > triplets = vector<Triplet<double> >(); 
+  long rows = -1, cols = 0; 
+  string line; 
+  while (file.getline(line)){
+    if (line.empty() || line[0] == '%') //header and comments
+      continue; 
+    char* next; 
+    const long row = strtol(line.c_str(), &next, 10); 
+    const long col = strtol(next, &next, 10); 
+    if (rows < 0){ //first non-comment line: rows cols nnz
+      rows = row, cols = col; 
+      triplets.reserve(strtol(next, NULL, 10)); 
+      continue; 
+    }
+    if (row < 1 || row > rows || col < 1 || col > cols){ cerr << "Matrix at location " << matLoc << " has an entry outside its dimensions: " << line << endl; exit(0); }
+    triplets.push_back(Triplet<double>(row - 1, col - 1, strtod(next, NULL))); //MatrixMarket indices are 1-based
+  }
+  if (rows < 0){ cerr << "Matrix at location " << matLoc << " has no MatrixMarket dimensions line" << endl; exit(0); }
+  mat = SparseMatrix<double,RowMajor>(rows, cols); 
+  mat.setFromTriplets(triplets.begin(), triplets.end()); 
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+#include <Eigen/Sparse>
+
+using namespace std; 
+using namespace Eigen; 
+
+//compact binary format for similarity matrices. after a fixed header (magic, precision, rows, cols, NNZs), each row
+//holds its number of entries and its column indices, delta-encoded, as varints, then its values: float32, or 16-bit
+//or 8-bit codes relative to the row's largest value (stored once per row as a float32). values must be non-negative,
+//as similarities are
+class CompactMatrixWriter {
+ public:
+  CompactMatrixWriter(const string matLoc, const int rows, const int cols, const string precision); 
+  ~CompactMatrixWriter(); 
+  void writeRow(const int* cols, const double* vals, const int size); //rows in order, with ascending column indices
+  void close(); 
+  static bool isCompactPrecision(const string precision){ return precision == "float" || precision == "int16" || precision == "int8"; }
+  static void write(const SparseMatrix<double,RowMajor>& mat, const string matLoc, const string precision); 
+  static bool read(const string matLoc, SparseMatrix<double,RowMajor>& mat); //false if the file is not in this format
+
+ private:
+  void writeVarint(unsigned long value); 
+  ofstream file; 
+  int precision_code; 
+  int num_rows; 
+  int rows_written; 
+  int64_t nnz; 
+  vector<unsigned char> buf; 
+}; 
+
+//MatrixMarket coordinate files (general, real), as saveMarket writes them, read through LineReader; duplicate entries
+//are summed, as in loadMarket
+void readMarket(const string matLoc, SparseMatrix<double,RowMajor>& mat); 
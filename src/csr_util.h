@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <Eigen/Sparse>
+
+using namespace std; 
+using namespace Eigen; 
+
+//in-place updates of CSR matrices (the kNN and similarity matrices, and the feature matrix) and the nearest neighbor
+//order shared by the graph builders
+
+//appends rows, given as (column, value) pairs sorted by column, to a CSR matrix that then has num_cols columns. the
+//index and value arrays grow geometrically, so that appending a few rows at a time is amortized
+inline void appendRows(SparseMatrix<double,RowMajor>& mat, const vector<vector<pair<int,double> > >& rows, const int num_cols){
+  mat.makeCompressed(); 
+  const int num_rows = mat.rows(); 
+  long nnz = mat.nonZeros(), num_added = 0; 
+  for (unsigned int r = 0; r < rows.size(); r++)
+    num_added += rows[r].size(); 
+  mat.conservativeResize(num_rows + rows.size(), num_cols); 
+  mat.data().resize(nnz + num_added, 0.5); 
+  int* outer = mat.outerIndexPtr(); 
+  int* inner = mat.innerIndexPtr(); 
+  double* values = mat.valuePtr(); 
+  for (unsigned int r = 0; r < rows.size(); r++){
+    for (unsigned int p = 0; p < rows[r].size(); p++, nnz++){
+      inner[nnz] = rows[r][p].first; 
+      values[nnz] = rows[r][p].second; 
+    }
+    outer[num_rows + r + 1] = nnz; 
+  }
+}
+
+//replaces the given rows (sorted by column) of a CSR matrix, which then has num_rows rows and num_cols columns; 
+//rows past the current ones are added. the other rows are shifted in place, in one pass over the index and value 
+//arrays: those that move towards the front from the front, and those that move towards the back from the back
+inline void replaceRows(SparseMatrix<double,RowMajor>& mat, const map<int, vector<pair<int,double> > >& rows, const int num_rows, const int num_cols){
+  mat.makeCompressed(); 
+  mat.conservativeResize(num_rows, num_cols); 
+  const vector<int> old_outer(mat.outerIndexPtr(), mat.outerIndexPtr() + num_rows + 1); 
+  vector<int> new_outer(num_rows + 1, 0); 
+  vector<bool> replaced(num_rows, false); 
+  for (map<int, vector<pair<int,double> > >::const_iterator it = rows.begin(); it != rows.end(); it++)
+    replaced[it->first] = true; 
+  map<int, vector<pair<int,double> > >::const_iterator it = rows.begin(); 
+  for (int i = 0; i < num_rows; i++)
+    new_outer[i+1] = new_outer[i] + (replaced[i] ? (it++)->second.size() : old_outer[i+1] - old_outer[i]); 
+  if (new_outer[num_rows] > old_outer[num_rows])
+    mat.data().resize(new_outer[num_rows], 0.5); 
+  int* inner = mat.innerIndexPtr(); 
+  double* values = mat.valuePtr(); 
+  for (int i = 0; i < num_rows; i++){
+    if (!replaced[i] && new_outer[i] < old_outer[i]){
+      copy(inner + old_outer[i], inner + old_outer[i+1], inner + new_outer[i]); 
+      copy(values + old_outer[i], values + old_outer[i+1], values + new_outer[i]); 
+    }
+  }
+  for (int i = num_rows - 1; i >= 0; i--){
+    if (!replaced[i] && new_outer[i] > old_outer[i]){
+      copy_backward(inner + old_outer[i], inner + old_outer[i+1], inner + new_outer[i+1]); 
+      copy_backward(values + old_outer[i], values + old_outer[i+1], values + new_outer[i+1]); 
+    }
+  }
+  for (it = rows.begin(); it != rows.end(); it++){
+    for (unsigned int p = 0; p < it->second.size(); p++){
+      inner[new_outer[it->first] + p] = it->second[p].first; 
+      values[new_outer[it->first] + p] = it->second[p].second; 
+    }
+  }
+  mat.data().resize(new_outer[num_rows]); 
+  copy(new_outer.begin(), new_outer.end(), mat.outerIndexPtr()); 
+}
+
+//the order of nearest neighbors: most similar first, and the lower ID first among equally similar ones, so that the
+//k nearest neighbors are the same however the candidates are ordered
+inline bool moreSimilar(const pair<unsigned int, double>& lhs, const pair<unsigned int, double>& rhs){
+  return lhs.second > rhs.second || (lhs.second == rhs.second && lhs.first < rhs.first); 
+}
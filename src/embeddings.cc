@@ -0,0 +1,121 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/algorithm/string.hpp>
+#include "embeddings.h"
+#include "line_reader.h"
+#include "metrics.h"
+
+using namespace std; 
+
+const char EMBEDDING_MAGIC[8] = {'G', 'P', 'E', 'M', 'B', 'E', 'D', 'S'}; 
+const long EMBEDDING_HEADER_BYTES = 32; 
+const int EMBEDDING_BLOCK = 8; //floats per SIMD block
+
+EmbeddingSimilarity::EmbeddingSimilarity(const string embLoc){
+  const int fd = open(embLoc.c_str(), O_RDONLY); 
+  struct stat st; 
+  if (fd < 0 || fstat(fd, &st) != 0){ cerr << "Could not read target embeddings at location " << embLoc << ": " << strerror(errno) << endl; exit(0); }
+  mapped_bytes = st.st_size; 
+  mapped = (mapped_bytes >= EMBEDDING_HEADER_BYTES) ? mmap(NULL, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED; 
+  close(fd); //the mapping stays valid
+  if (mapped == MAP_FAILED || memcmp(mapped, EMBEDDING_MAGIC, sizeof(EMBEDDING_MAGIC)) != 0){ cerr << "Target embeddings at location " << embLoc << " are not in the binary embedding format" << endl; exit(0); }
+  const int* header = reinterpret_cast<const int*>(static_cast<const char*>(mapped) + sizeof(EMBEDDING_MAGIC)); 
+  num_rows = header[0], dim = header[1], stride = header[2]; 
+  if (num_rows < 0 || dim < 1 || stride < dim || stride % EMBEDDING_BLOCK != 0 || mapped_bytes != EMBEDDING_HEADER_BYTES + (long) num_rows * stride * (long) sizeof(float)){ cerr << "Target embeddings at location " << embLoc << " are truncated or corrupt" << endl; exit(0); }
+  vecs = reinterpret_cast<const float*>(static_cast<const char*>(mapped) + EMBEDDING_HEADER_BYTES); 
+  lookups = 0; 
+  cout << "Mapped " << num_rows << " target phrase embeddings of dimension " << dim << " from " << embLoc << endl; 
+}
+
+EmbeddingSimilarity::~EmbeddingSimilarity(){
+  munmap(mapped, mapped_bytes); 
+}
+
+double EmbeddingSimilarity::getSimilarity(const int i, const int j){
+  lookups++; 
+  if (i < 0 || j < 0 || i >= num_rows || j >= num_rows) //target phrases added after the embeddings were converted
+    return 0; 
+  const float sim = denseDot(getRow(i), getRow(j), stride); 
+  return (sim < 0) ? 0 : sim; 
+}
+
+//the mapped pages are in the page cache rather than on the heap, but are resident once they have been read
+map<string, long> EmbeddingSimilarity::memoryUsage(const string prefix){
+  map<string, long> bytes = map<string, long>(); 
+  bytes[prefix + "embeddings"] = mapped_bytes; 
+  return bytes; 
+}
+
+void EmbeddingSimilarity::recordMetrics(){
+  Metrics::addCount("target_embedding_lookups", lookups); 
+}
+
+//the rows are written as zeros first and then overwritten in place, so that the text file is read once and only one
+//row is held in memory
+void EmbeddingSimilarity::convert(const string textLoc, const string embLoc, Phrases* tgt_phrases){
+  LineReader text(textLoc); 
+  if (!text.is_open()){ cerr << "Could not read target embeddings at location " << textLoc << endl; exit(0); }
+  const int num_rows = tgt_phrases->getNumLabeledPhrases() + tgt_phrases->getNumUnlabeledPhrases(); 
+  int dim = 0, stride = 0; 
+  unsigned int num_lines = 0, num_skipped = 0, num_zero = 0; 
+  ofstream file; 
+  vector<float> row = vector<float>(); 
+  string line; 
+  while (text.getline(line)){
+    boost::trim(line); 
+    if (line.empty())
+      continue; 
+    num_lines++; 
+    const size_t sep = line.find(" ||| "); 
+    if (sep == string::npos){ cerr << "Line " << num_lines << " of target embeddings at location " << textLoc << " is not of the form 'phrase ||| v1 v2 ... vd'" << endl; exit(0); }
+    vector<string> values; 
+    const string vec_str = line.substr(sep + 5); 
+    boost::split(values, vec_str, boost::is_any_of(" "), boost::token_compress_on); 
+    if (dim == 0){ //the first line sets the dimension
+      dim = values.size(); 
+      stride = (dim + EMBEDDING_BLOCK - 1) / EMBEDDING_BLOCK * EMBEDDING_BLOCK; 
+      file.open(embLoc.c_str(), ios_base::out | ios_base::binary); 
+      if (!file.is_open()){ cerr << "Could not write target embeddings to location " << embLoc << endl; exit(0); }
+      char header[EMBEDDING_HEADER_BYTES]; 
+      memset(header, 0, sizeof(header)); 
+      memcpy(header, EMBEDDING_MAGIC, sizeof(EMBEDDING_MAGIC)); 
+      const int fields[3] = {num_rows, dim, stride}; 
+      memcpy(header + sizeof(EMBEDDING_MAGIC), fields, sizeof(fields)); 
+      file.write(header, sizeof(header)); 
+      const vector<float> zeros(stride, 0); 
+      for (int i = 0; i < num_rows; i++)
+	file.write(reinterpret_cast<const char*>(&zeros[0]), stride * sizeof(float)); 
+      row.assign(stride, 0); 
+    }
+    if ((int) values.size() != dim){ cerr << "Line " << num_lines << " of target embeddings at location " << textLoc << " has " << values.size() << " values rather than " << dim << endl; exit(0); }
+    const int phrID = tgt_phrases->getPhraseID(line.substr(0, sep)); 
+    if (phrID < 0 || phrID >= num_rows){
+      num_skipped++; 
+      continue; 
+    }
+    double squared = 0; 
+    for (int k = 0; k < dim; k++){
+      row[k] = atof(values[k].c_str()); 
+      squared += (double) row[k] * row[k]; 
+    }
+    const double norm = sqrt(squared); 
+    if (norm == 0)
+      num_zero++; 
+    for (int k = 0; k < dim; k++)
+      row[k] = (norm > 0) ? row[k] / norm : 0; 
+    file.seekp(EMBEDDING_HEADER_BYTES + (long) phrID * stride * sizeof(float)); 
+    file.write(reinterpret_cast<const char*>(&row[0]), stride * sizeof(float)); 
+  }
+  if (dim == 0){ cerr << "No target embeddings at location " << textLoc << endl; exit(0); }
+  file.close(); 
+  if (file.fail()){ cerr << "Could not write target embeddings to location " << embLoc << endl; exit(0); }
+  cout << "Converted " << num_lines - num_skipped << " target phrase embeddings of dimension " << dim << " for " << num_rows << " target phrases (" << num_skipped << " lines for other phrases skipped, " << num_zero << " all-zero vectors)" << endl; 
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include "graph.h"
+#include "phrases.h"
+#ifdef __AVX__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std; 
+
+//dense target phrase embeddings as target similarities for StructLabelProp, instead of a target graph. the binary file
+//has a fixed header (magic, rows, dimension, row stride; 32 bytes), then one float32 row per target phrase ID, scaled to
+//unit length and padded with zeros to a multiple of 8 floats, so that rows are 32-byte aligned in the mapped file and
+//a cosine is a dot product over whole SIMD blocks. phrases without an embedding have all-zero rows (similarity 0).
+//the file is memory-mapped read-only, so processes on one machine share its pages
+class EmbeddingSimilarity : public TargetSimilarity {
+ public:
+  explicit EmbeddingSimilarity(const string embLoc); 
+  ~EmbeddingSimilarity(); 
+  double getSimilarity(const int i, const int j); //negative cosines are 0, as in DynamicGraph
+  map<string, long> memoryUsage(const string prefix); 
+  void recordMetrics(); 
+  int getNumRows(){ return num_rows; }
+  int getDimension(){ return dim; }
+  const float* getRow(const int i){ return vecs + (long) i * stride; }
+  //text embeddings, one 'phrase ||| v1 v2 ... vd' per line, to the binary format, with rows by the phrases' IDs; 
+  //lines for phrases that are not in tgt_phrases are skipped
+  static void convert(const string textLoc, const string embLoc, Phrases* tgt_phrases); 
+
+ private:
+  void* mapped; 
+  long mapped_bytes; 
+  const float* vecs; 
+  int num_rows; 
+  int dim; 
+  int stride; //floats per row
+  long lookups; 
+}; 
+
+//dot product of two 32-byte aligned float rows whose length is a multiple of 8. lane k of the 8 partial sums adds the
+//products of entries k, k + 8, ..., and the lanes are added in the same order on every path, so the AVX, SSE2 and
+//plain loops give the same result
+inline float denseDot(const float* a, const float* b, const int len){
+#if defined(__AVX__)
+  __m256 acc = _mm256_setzero_ps(); 
+  for (int k = 0; k < len; k += 8)
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_load_ps(a + k), _mm256_load_ps(b + k))); 
+  const __m128 sums = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)); 
+#elif defined(__SSE2__)
+  __m128 lo = _mm_setzero_ps(), hi = _mm_setzero_ps(); 
+  for (int k = 0; k < len; k += 8){
+    lo = _mm_add_ps(lo, _mm_mul_ps(_mm_load_ps(a + k), _mm_load_ps(b + k))); 
+    hi = _mm_add_ps(hi, _mm_mul_ps(_mm_load_ps(a + k + 4), _mm_load_ps(b + k + 4))); 
+  }
+  const __m128 sums = _mm_add_ps(lo, hi); 
+#endif
+#if defined(__AVX__) || defined(__SSE2__)
+  float lanes[4]; 
+  _mm_storeu_ps(lanes, sums); 
+  return (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]); 
+#else
+  float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0}; 
+  for (int k = 0; k < len; k += 8){
+    for (int l = 0; l < 8; l++)
+      acc[l] += a[k + l] * b[k + l]; 
+  }
+  return ((acc[0] + acc[4]) + (acc[2] + acc[6])) + ((acc[1] + acc[5]) + (acc[3] + acc[7])); 
+#endif
+}
@@ -5,24 +5,32 @@
 #include <set>
 #include <algorithm>
 #include <functional>
+#include <memory>
 #include <iostream>
 #include <fstream>
 #include <omp.h>
 #include <math.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/set.hpp>
+#include <boost/serialization/vector.hpp>
 #include "featext.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "line_reader.h"
+#include "csr_util.h"
+#include "compact_matrix.h"
 
 using namespace std;
 using namespace Eigen; 
 namespace fs = boost::filesystem;
-namespace io = boost::iostreams;
+const string MARGINALS_EXT = ".marginals"; 
+const string STOP_FEATURES_EXT = ".stopfeatures"; 
 
 FeatureExtractor::FeatureExtractor(){
   stop_words = set<unsigned int>(); 
@@ -31,6 +39,10 @@ FeatureExtractor::FeatureExtractor(){
   inverted_idx = map<unsigned int, set<unsigned int> >();  
   featMat_triplets = vector<triplet>(); 
   feature_matrix = SparseMatrix<double,RowMajor>();
+  fixed_features = false; 
+  min_count = 0; 
+  feature_counts = vector<double>(); 
+  total_count = 0; 
 }
 
 //will it use default deconstructor if I don't write?
@@ -43,6 +55,7 @@ void FeatureExtractor::writeToFile(const string featMatLoc, const string invIdxL
   boost::archive::text_oarchive oa(outFileInvIdx); //if this works, update phrases.cc too
   oa << inverted_idx; 
   outFileInvIdx.close();  
+  writeStopFeatures(invIdxLoc); 
   //if need be, we can write out featStr2ID as well
   /*ofstream featureIDs; 
   string filename = "/usr0/home/avneesh/graphMT/data/hi-en/extract-features/featIDs"; 
@@ -56,8 +69,85 @@ void FeatureExtractor::writeToFile(const string featMatLoc, const string invIdxL
   saveMarket(feature_matrix, featMatLoc); 
 }
 
+//also writes the per-phrase marginal counts as a small binary sidecar, so that
+//graph propagation does not need to re-read the full co-occurrence matrix
 void FeatureExtractor::writeCoocToFile(const string cooc_loc){
   saveMarket(feature_matrix, cooc_loc); 
+  vector<double> rowSums = getCoocRowSums(); 
+  const string marginals_loc = cooc_loc + MARGINALS_EXT; 
+  ofstream outFileMarginals(marginals_loc.c_str(), ios_base::out | ios_base::binary); 
+  if (!outFileMarginals.is_open()){ cerr << "Could not write phrase marginals to location " << marginals_loc << endl; exit(0); }
+  boost::archive::binary_oarchive oa(outFileMarginals); 
+  oa << rowSums; 
+  outFileMarginals.close(); 
+}
+
+//sum over features for each phrase; only meaningful before rescaleCoocToPMI
+vector<double> FeatureExtractor::getCoocRowSums(){
+  VectorXd indFeatSumRow = feature_matrix*VectorXd::Ones(feature_matrix.cols()); 
+  return vector<double>(indFeatSumRow.data(), indFeatSumRow.data() + indFeatSumRow.size()); 
+}
+
+//reads the binary sidecar written by writeCoocToFile; returns false if it is not there
+bool FeatureExtractor::readCoocRowSums(const string cooc_loc, vector<double>& rowSums){
+  const string marginals_loc = cooc_loc + MARGINALS_EXT; 
+  ifstream inFileMarginals(marginals_loc.c_str(), ios_base::in | ios_base::binary); 
+  if (!inFileMarginals.good())
+    return false; 
+  boost::archive::binary_iarchive ia(inFileMarginals); 
+  ia >> rowSums; 
+  inFileMarginals.close(); 
+  return true; 
+}
+
+//fallback for co-occurrence files without a sidecar: one streaming pass over the 
+//MatrixMarket file that accumulates row sums without building the sparse matrix
+vector<double> FeatureExtractor::computeCoocRowSums(const string cooc_loc){
+  LineReader coocFile(cooc_loc); //read ahead on a background thread, as the monolingual corpora
+  if (!coocFile.is_open()){ cerr << "Could not read co-occurrence matrix at location " << cooc_loc << endl; exit(0); }
+  vector<double> rowSums = vector<double>(); 
+  bool readDims = false; 
+  string line; 
+  while (coocFile.getline(line)){
+    if (line.empty() || line[0] == '%') //header and comments
+      continue; 
+    const char* pos = line.c_str(); 
+    char* next; 
+    const long row = strtol(pos, &next, 10); 
+    if (!readDims){ //first non-comment line: rows cols nnz
+      rowSums.resize(row, 0); 
+      readDims = true; 
+      continue; 
+    }
+    strtol(next, &next, 10); //column index is not needed
+    const double val = strtod(next, NULL); 
+    assert(row > 0 && row <= (long) rowSums.size()); 
+    rowSums[row-1] += val; //MatrixMarket indices are 1-based
+  }
+  return rowSums; 
+}
+
+//the features that were kept out of the inverted index, as a small binary sidecar; lets graph construction
+//recover the posting lists from the feature matrix alone
+void FeatureExtractor::writeStopFeatures(const string invIdxLoc){
+  const string stopfeats_loc = invIdxLoc + STOP_FEATURES_EXT; 
+  ofstream outFileStopFeats(stopfeats_loc.c_str(), ios_base::out | ios_base::binary); 
+  if (!outFileStopFeats.is_open()){ cerr << "Could not write stop features to location " << stopfeats_loc << endl; exit(0); }
+  boost::archive::binary_oarchive oa(outFileStopFeats); 
+  oa << stop_words; 
+  outFileStopFeats.close(); 
+}
+
+//reads the sidecar written by writeStopFeatures; returns false if it is not there
+bool FeatureExtractor::readStopFeatures(const string invIdxLoc, set<unsigned int>& stopFeatures){
+  const string stopfeats_loc = invIdxLoc + STOP_FEATURES_EXT; 
+  ifstream inFileStopFeats(stopfeats_loc.c_str(), ios_base::in | ios_base::binary); 
+  if (!inFileStopFeats.good())
+    return false; 
+  boost::archive::binary_iarchive ia(inFileStopFeats); 
+  ia >> stopFeatures; 
+  inFileStopFeats.close(); 
+  return true; 
 }
 
 void FeatureExtractor::readFromFile(const string featMatLoc, const string invIdxLoc){
@@ -66,7 +156,7 @@ void FeatureExtractor::readFromFile(const string featMatLoc, const string invIdx
   boost::archive::text_iarchive ia(inFileInvIdx); 
   ia >> inverted_idx; 
   inFileInvIdx.close(); 
-  loadMarket(feature_matrix, featMatLoc); 
+  readMarket(featMatLoc, feature_matrix); 
 }
 
 vector<string> FeatureExtractor::filterSentences(const string mono_dir_loc, Phrases* phrases, const unsigned int minPL, const unsigned int maxPL, const unsigned int maxPhrCount, const string monolingual_out){  
@@ -96,46 +186,51 @@ vector<string> FeatureExtractor::filterSentences(const string mono_dir_loc, Phra
 	exit(0); 
       }	
     }
+    long total_bytes = 0; 
+    for (unsigned int i = 0; i < filenames.size(); i++)
+      total_bytes += fs::file_size(filenames[i]); 
+    ProgressReporter progress("filterSentences", total_bytes, "compressed bytes"); 
     unsigned int numSentences = 0;
     omp_lock_t lock;
     omp_init_lock(&lock); //initializes the lock
     #pragma omp parallel for
     for (unsigned int i = 0; i < filenames.size(); i++){
-      ifstream mono_file;
-      mono_file.exceptions(ios::failbit | ios::badbit);
-      mono_file.open(filenames[i].c_str(), ios_base::in | ios_base::binary);
-      io::filtering_stream<io::input> decompressor; 
-      decompressor.push(io::gzip_decompressor());
-      decompressor.push(mono_file); 
-      for (string line; getline(decompressor, line);){
-	boost::trim(line); 
-	vector<string> ngrams = vector<string>();
-	for (unsigned int j = minPL; j < maxPL + 1; j++){ //extract ngrams of all orders
-	  vector<ngram_triple> order_ngrams = extractNGrams(j, line); 
-	  string ngram; 	  
-	  if (order_ngrams.size() > 0){
-	    for (unsigned int k = 0; k < order_ngrams.size(); k++){ //strip unnecessary info and push back
-	      tie(ngram, ignore, ignore) = order_ngrams[k]; 
-	      ngrams.push_back(ngram); 
+      LineReader mono_file(filenames[i]); //decompressed on a background thread
+      if (!mono_file.is_open()){ cerr << "Could not open monolingual corpus at location " << filenames[i] << endl; exit(0); }
+      long lines_read = 0, bytes_reported = 0; 
+      for (const LineBatch* batch = mono_file.next(); batch != NULL; batch = mono_file.next()){
+	for (unsigned int l = 0; l < batch->lines.size(); l++){
+	  string line = batch->lines[l].to_string(); 
+	  boost::trim(line); 
+	  lines_read++; 
+	  vector<string> ngrams = vector<string>();
+	  for (unsigned int j = minPL; j < maxPL + 1; j++){ //extract ngrams of all orders
+	    vector<ngram_triple> order_ngrams = extractNGrams(j, line); 
+	    string ngram; 	  
+	    if (order_ngrams.size() > 0){
+	      for (unsigned int k = 0; k < order_ngrams.size(); k++){ //strip unnecessary info and push back
+		tie(ngram, ignore, ignore) = order_ngrams[k]; 
+		ngrams.push_back(ngram); 
+	      }
+	    }
+	  } //have all the ngrams in the line
+	  sort(ngrams.begin(), ngrams.end());
+	  vector<string> unlabeled_in_line; 
+	  set_intersection(keys_to_search.begin(), keys_to_search.end(), ngrams.begin(), ngrams.end(), back_inserter(unlabeled_in_line)); 
+	  if (unlabeled_in_line.size() > 0){ //i.e., at least one hit on this line
+	    #pragma omp critical(writeLineUpdateCount)
+	    {
+	      filtered_sentences << line << endl; 
+	      numSentences++; 
+	      for (unsigned int j = 0; j < unlabeled_in_line.size(); j++)
+		unlabeled_count[unlabeled_in_line[j]]++;
 	    }
-	  }
-	} //have all the ngrams in the line
-	sort(ngrams.begin(), ngrams.end());
-	vector<string> unlabeled_in_line; 
-	set_intersection(keys_to_search.begin(), keys_to_search.end(), ngrams.begin(), ngrams.end(), back_inserter(unlabeled_in_line)); 
-	if (unlabeled_in_line.size() > 0){ //i.e., at least one hit on this line
-          #pragma omp critical(writeLineUpdateCount)
-	  {
-	    filtered_sentences << line << endl; 
-	    numSentences++; 
-	    for (unsigned int j = 0; j < unlabeled_in_line.size(); j++)
-	      unlabeled_count[unlabeled_in_line[j]]++;
 	  }
 	}
+	progress.add(batch->input_bytes - bytes_reported); //compressed bytes read
+	bytes_reported = batch->input_bytes; 
       }
-      decompressor.pop();
-      mono_file.close();
-      decompressor.pop();
+      Metrics::addCount("monolingual_lines_read", lines_read); 
       omp_set_lock(&lock); 
       keys_to_search.clear();      
       unsigned int numUncovered = 0; 
@@ -154,6 +249,7 @@ vector<string> FeatureExtractor::filterSentences(const string mono_dir_loc, Phra
       }
     }
     omp_destroy_lock(&lock); 
+    Metrics::addCount("monolingual_lines_selected", numSentences); 
     vector<string> unlabeled_hits = vector<string>();
     for (const_it it = unlabeled_count.begin(); it != unlabeled_count.end(); it++){
       if (it->second > 0)
@@ -210,54 +306,126 @@ set<int> FeatureExtractor::readStopWordsAsPhrases(const string filename, const u
   else { cerr << "Could not read stop words (as phrases) from location " << filename << endl; exit(0); }
 }
 
-void FeatureExtractor::extractFeatures(Phrases* phrases, const string mono_filename, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL){
+void FeatureExtractor::extractFeatures(Phrases* phrases, const string mono_filename, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL, StageCache* checkpoint, const long checkpoint_lines){
   const unsigned int numTotalPhrases = phrases->getNumUnlabeledPhrases() + phrases->getNumLabeledPhrases();
-  ifstream monoFile(mono_filename.c_str()); 
+  long lines_read = 0, phrase_occurrences = 0; 
+  long offset = 0; 
+  unsigned long max_triplets = featMat_triplets.max_size() / 2; //to be conservative
+  if (Metrics::getMemoryBudget() > 0) //with a budget, the buffer (up to twice its size, as it grows) may take a quarter of it
+    max_triplets = min(max_triplets, (unsigned long) Metrics::getMemoryBudget() / 8 / sizeof(triplet)); 
+  CheckpointWriter writer(checkpoint); 
+  if (CheckpointWriter::canResume(checkpoint) && readCheckpoint(checkpoint->getOutput(), offset, lines_read, phrase_occurrences))
+    cout << "Resuming feature extraction from checkpoint after " << lines_read << " lines" << endl; 
+  LineReader monoFile(mono_filename, offset); //the next batch is read while this one is parsed
   if (monoFile.is_open()){
-    string line;
-    while (getline(monoFile, line)){
-      boost::trim(line); 
-      vector<string> sentence;
-      boost::split(sentence, line, boost::is_any_of(" ")); 
-      for (unsigned int ngram_order = minPL; ngram_order < maxPL + 1; ngram_order++){
-	vector<ngram_triple> order_ngrams = extractNGrams(ngram_order, line); 	
-	string ngram;
-	unsigned int left_idx;
-	unsigned int right_idx; 
-	for (unsigned int i = 0; i < order_ngrams.size(); i++){
-	  tie(ngram, left_idx, right_idx) = order_ngrams[i]; 
-	  int phrID = phrases->getPhraseID(ngram); 
-	  if (phrID > -1){ //i.e., phrase exists in our list of phrases
-	    //phrases->getNthPhrase(phrID)->count++; //is this a good idea? to modify directly? 
-	    int startIdx = 0; 
-	    int endIdx = left_idx; 
-	    if (left_idx > winsize)
-	      startIdx = left_idx-winsize; 
-	    if (left_idx > 0){
-	      vector<string> subsent(sentence.begin()+startIdx, sentence.begin()+endIdx); 	      
-	      addContext(phrID, subsent, Left); 
-	    }
-	    startIdx = right_idx+1;
-	    endIdx = sentence.size()-1;
-	    if (sentence.size()-1-right_idx > winsize)
-	      endIdx = winsize+startIdx; 
-	    if (sentence.size()-1-right_idx > 0){
-	      vector<string> subsent(sentence.begin()+startIdx, sentence.begin()+endIdx); 
-	      addContext(phrID, subsent, Right); 
-	    }
-	  }	  
+    ProgressReporter progress("extractFeatures", fs::file_size(mono_filename), "bytes"); 
+    long bytes_reported = 0; 
+    for (const LineBatch* batch = monoFile.next(); batch != NULL; batch = monoFile.next()){
+      for (unsigned int l = 0; l < batch->lines.size(); l++){
+	string line = batch->lines[l].to_string(); 
+	boost::trim(line); 
+	lines_read++; 
+	phrase_occurrences += addLineContexts(phrases, line, winsize, minPL, maxPL, 0); 
+	if (featMat_triplets.size() > max_triplets)
+	  augmentFeatureMatrix(numTotalPhrases); 
+	if (checkpoint != NULL && checkpoint_lines > 0 && lines_read % checkpoint_lines == 0 && batch->endOffset(l) >= 0){ //not after an unterminated last line
+	  augmentFeatureMatrix(numTotalPhrases); 
+	  writeCheckpoint(writer, batch->endOffset(l), lines_read, phrase_occurrences); 
 	}
       }
-      if (featMat_triplets.size() > (featMat_triplets.max_size() / 2)) //to be conservative
-	augmentFeatureMatrix(numTotalPhrases); 
+      progress.add(batch->input_bytes - bytes_reported); 
+      bytes_reported = batch->input_bytes; 
     }
-    monoFile.close(); 
+    if (checkpoint != NULL)
+      writer.remove(); 
   }
   else { cerr << "Could not open monolingual corpus at location " << mono_filename << endl; exit(0); }
+  Metrics::addCount("feature_extraction_lines", lines_read); 
+  Metrics::addCount("feature_extraction_ngrams", phrase_occurrences); 
   augmentFeatureMatrix(numTotalPhrases); 
+  vector<triplet>().swap(featMat_triplets); //clear() keeps the buffer, which is only reused while extracting
   cout << "Co-occurrence counts assembled into feature matrix, with dimensions " << numTotalPhrases << " x " << featStr2ID.size() << endl; 
 }
 
+//the counts so far and the position in the corpus after them. the inverted index is not written, since it follows from
+//the feature matrix; the snapshot is a copy of the (compressed) matrix arrays and the feature strings
+void FeatureExtractor::writeCheckpoint(CheckpointWriter& writer, const long offset, const long lines_read, const long phrase_occurrences){
+  feature_matrix.makeCompressed(); 
+  const int rows = feature_matrix.rows(), cols = feature_matrix.cols(); 
+  shared_ptr<vector<int> > outer = make_shared<vector<int> >(feature_matrix.outerIndexPtr(), feature_matrix.outerIndexPtr() + rows + 1); 
+  shared_ptr<vector<int> > inner = make_shared<vector<int> >(feature_matrix.innerIndexPtr(), feature_matrix.innerIndexPtr() + feature_matrix.nonZeros()); 
+  shared_ptr<vector<double> > values = make_shared<vector<double> >(feature_matrix.valuePtr(), feature_matrix.valuePtr() + feature_matrix.nonZeros()); 
+  shared_ptr<map<string, unsigned int> > features = make_shared<map<string, unsigned int> >(featStr2ID); 
+  writer.write([=](ostream& out){
+      boost::archive::binary_oarchive oa(out); 
+      oa << offset << lines_read << phrase_occurrences << *features << rows << cols << *outer << *inner << *values; 
+    }); 
+}
+
+bool FeatureExtractor::readCheckpoint(const string checkpointLoc, long& offset, long& lines_read, long& phrase_occurrences){
+  ifstream inFile(checkpointLoc.c_str(), ios_base::in | ios_base::binary); 
+  if (!inFile.is_open())
+    return false; 
+  boost::archive::binary_iarchive ia(inFile); 
+  int rows, cols; 
+  vector<int> outer, inner; 
+  vector<double> values; 
+  ia >> offset >> lines_read >> phrase_occurrences >> featStr2ID >> rows >> cols >> outer >> inner >> values; 
+  inFile.close(); 
+  feature_matrix = SparseMatrix<double,RowMajor>(rows, cols); 
+  feature_matrix.resizeNonZeros(values.size()); 
+  copy(outer.begin(), outer.end(), feature_matrix.outerIndexPtr()); 
+  copy(inner.begin(), inner.end(), feature_matrix.innerIndexPtr()); 
+  copy(values.begin(), values.end(), feature_matrix.valuePtr()); 
+  inverted_idx.clear(); 
+  for (int i = 0; i < rows; i++){ //as addContext: phrases with a (non stop word) context feature
+    for (SparseMatrix<double,RowMajor>::InnerIterator it(feature_matrix, i); it; ++it){
+      if (stop_words.find(it.col()) == stop_words.end())
+	inverted_idx[it.col()].insert(i); 
+    }
+  }
+  return true; 
+}
+
+//adds the left and right contexts of every occurrence of a phrase (with an ID of at least min_phrase_id) in a
+//trimmed line; returns the number of occurrences
+long FeatureExtractor::addLineContexts(Phrases* phrases, const string& line, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL, const int min_phrase_id){
+  long phrase_occurrences = 0; 
+  vector<string> sentence;
+  boost::split(sentence, line, boost::is_any_of(" ")); 
+  for (unsigned int ngram_order = minPL; ngram_order < maxPL + 1; ngram_order++){
+    vector<ngram_triple> order_ngrams = extractNGrams(ngram_order, line); 	
+    string ngram;
+    unsigned int left_idx;
+    unsigned int right_idx; 
+    for (unsigned int i = 0; i < order_ngrams.size(); i++){
+      tie(ngram, left_idx, right_idx) = order_ngrams[i]; 
+      int phrID = phrases->getPhraseID(ngram); 
+      if (phrID > -1 && phrID >= min_phrase_id){ //i.e., phrase exists in our list of phrases
+	phrase_occurrences++; 
+	//phrases->getNthPhrase(phrID)->count++; //is this a good idea? to modify directly? 
+	int startIdx = 0; 
+	int endIdx = left_idx; 
+	if (left_idx > winsize)
+	  startIdx = left_idx-winsize; 
+	if (left_idx > 0){
+	  vector<string> subsent(sentence.begin()+startIdx, sentence.begin()+endIdx); 	      
+	  addContext(phrID, subsent, Left); 
+	}
+	startIdx = right_idx+1;
+	endIdx = sentence.size()-1;
+	if (sentence.size()-1-right_idx > winsize)
+	  endIdx = winsize+startIdx; 
+	if (sentence.size()-1-right_idx > 0){
+	  vector<string> subsent(sentence.begin()+startIdx, sentence.begin()+endIdx); 
+	  addContext(phrID, subsent, Right); 
+	}
+      }	  
+    }
+  }
+  return phrase_occurrences; 
+}
+
 void FeatureExtractor::augmentFeatureMatrix(const unsigned int numTotalPhrases){
   cout << "Converting feature values seen thus far to sparse matrix" << endl; 
   if (feature_matrix.size() == 0){
@@ -270,7 +438,7 @@ void FeatureExtractor::augmentFeatureMatrix(const unsigned int numTotalPhrases){
     new_featMat.resize(numTotalPhrases, featStr2ID.size()); 
     new_featMat.reserve(featMat_triplets.size()); 
     new_featMat.setFromTriplets(featMat_triplets.begin(), featMat_triplets.end()); 
-    feature_matrix.resize(numTotalPhrases, featStr2ID.size()); //adding two feature matrices - need to resize current feature matrix? 
+    feature_matrix.conservativeResize(numTotalPhrases, featStr2ID.size()); //new features may have been seen since; resize() would drop the counts so far
     feature_matrix += new_featMat; 
   }
   featMat_triplets.clear(); 
@@ -278,6 +446,14 @@ void FeatureExtractor::augmentFeatureMatrix(const unsigned int numTotalPhrases){
 }
 
 void FeatureExtractor::addContext(const unsigned int phraseID, vector<string> subsent, const ContextSide side){
+  if (fixed_features){ //contexts without a feature column are dropped; the inverted index is updated by the caller
+    for (unsigned int i = 0; i < subsent.size(); i++){
+      const int contextID = getFeatureID(subsent[i], side); 
+      if (contextID > -1)
+	featMat_triplets.push_back(triplet(phraseID, contextID, 1.0)); 
+    }
+    return; 
+  }
   vector<unsigned int> contextFeatureIDs; 
   for (unsigned int i = 0; i < subsent.size(); i++)
     contextFeatureIDs.push_back(getSetFeatureID(subsent[i], side)); 
@@ -320,7 +496,10 @@ void FeatureExtractor::rescaleCoocToPMI(){
       allFeatureSum += it.value(); 
     }
   }
-  RowVectorXd indFeatSumColInv = ((RowVectorXd::Ones(feature_matrix.rows())*feature_matrix).array()*(1.0/allFeatureSum)).cwiseInverse();
+  RowVectorXd indFeatSumCol = RowVectorXd::Ones(feature_matrix.rows())*feature_matrix; 
+  feature_counts = vector<double>(indFeatSumCol.data(), indFeatSumCol.data() + indFeatSumCol.size()); //kept for addPhraseRows
+  total_count = allFeatureSum; 
+  RowVectorXd indFeatSumColInv = (indFeatSumCol.array()*(1.0/allFeatureSum)).cwiseInverse();
   SparseMatrix<double> right_mult(feature_matrix.cols(), feature_matrix.cols()); 
   vector<triplet> right_mult_diagonal = vector<triplet>();
   for (int i = 0; i < indFeatSumColInv.size(); i++)
@@ -340,6 +519,7 @@ void FeatureExtractor::rescaleCoocToPMI(){
 
 //doesn't seem to be fully working? try compress maybe? 
 void FeatureExtractor::pruneFeaturesByCount(const unsigned int minCount){
+  min_count = minCount; 
   int nnzs = feature_matrix.nonZeros();
   cout << "Initially: " << nnzs << " non-zero elements in feature matrix" << endl; 
   for (int i = 0; i < feature_matrix.outerSize(); i++){
@@ -353,6 +533,52 @@ void FeatureExtractor::pruneFeaturesByCount(const unsigned int minCount){
   cout << "After pruning features with count less than " << minCount << ", there are " << nnzs_after_prune << " non-zero elements in feature matrix" << endl; 
 }
 
+//appends PMI feature rows for the phrases with IDs first_new and up, from their contexts in the given lines. counts are
+//pruned and rescaled as the rest of the matrix was, with the feature counts of the corpus it was extracted from; 
+//contexts that were never seen there are dropped, and the existing rows and feature columns are left unchanged
+vector<double> FeatureExtractor::addPhraseRows(Phrases* phrases, const vector<string>& lines, const unsigned int first_new, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL){
+  const unsigned int num_new = phrases->getNumUnlabeledPhrases() + phrases->getNumLabeledPhrases() - first_new; 
+  fixed_features = true; 
+  for (unsigned int l = 0; l < lines.size(); l++){
+    string line = lines[l]; 
+    boost::trim(line); 
+    addLineContexts(phrases, line, winsize, minPL, maxPL, first_new); 
+  }
+  fixed_features = false; 
+  for (unsigned int t = 0; t < featMat_triplets.size(); t++)
+    featMat_triplets[t] = triplet(featMat_triplets[t].row() - first_new, featMat_triplets[t].col(), featMat_triplets[t].value()); 
+  SparseMatrix<double,RowMajor> counts(num_new, feature_matrix.cols()); 
+  counts.setFromTriplets(featMat_triplets.begin(), featMat_triplets.end()); 
+  featMat_triplets.clear(); 
+  vector<double> rowSums(num_new, 0.0); 
+  vector<vector<pair<int,double> > > rows(num_new); 
+  for (unsigned int i = 0; i < num_new; i++){
+    for (SparseMatrix<double,RowMajor>::InnerIterator it(counts, i); it; ++it){
+      if (it.value() >= min_count)
+	rowSums[i] += it.value(); 
+    }
+    for (SparseMatrix<double,RowMajor>::InnerIterator it(counts, i); it; ++it){
+      if (it.value() >= min_count && feature_counts[it.col()] > 0) //log( P(feature | phrase) / P(feature) )
+	rows[i].push_back(make_pair(it.col(), log((it.value() / rowSums[i]) / (feature_counts[it.col()] / total_count)))); 
+    }
+  }
+  addFeatureRows(rows, feature_matrix.cols()); 
+  return rowSums; 
+}
+
+//appends rows, given as (feature, value) pairs sorted by feature, to the feature matrix, which then has num_features
+//columns, and adds them to the posting lists of their non stop-word features
+void FeatureExtractor::addFeatureRows(const vector<vector<pair<int,double> > >& rows, const int num_features){
+  const unsigned int first_new = feature_matrix.rows(); 
+  for (unsigned int i = 0; i < rows.size(); i++){
+    for (unsigned int p = 0; p < rows[i].size(); p++){
+      if (stop_words.find(rows[i][p].first) == stop_words.end())
+	inverted_idx[rows[i][p].first].insert(first_new + i); 
+    }
+  }
+  appendRows(feature_matrix, rows, num_features); 
+}
+
 void FeatureExtractor::analyzeFeatureMatrix(const vector<Phrases::Phrase*> unlabeled_phrases){
   set<int> unlabeled_ids = set<int>();
   for (unsigned int i = 0; i < unlabeled_phrases.size(); i++)
@@ -384,6 +610,21 @@ void FeatureExtractor::analyzeFeatureMatrix(const vector<Phrases::Phrase*> unlab
   cout << "Number of featureless unlabeled phrases after stop-word filtering: " << zr_fil_unl << endl; 
 }
 
+map<string, long> FeatureExtractor::memoryUsage(){
+  map<string, long> bytes = map<string, long>(); 
+  bytes["feature_triplets"] = featMat_triplets.capacity() * sizeof(triplet); 
+  bytes["feature_matrix"] = sparseMatrixBytes(feature_matrix) + feature_counts.capacity() * sizeof(double); 
+  long inv_idx_bytes = 0; 
+  for (invIdxIter it = inverted_idx.begin(); it != inverted_idx.end(); it++)
+    inv_idx_bytes += treeNodeBytes(sizeof(pair<const unsigned int, set<unsigned int> >)) + it->second.size() * treeNodeBytes(sizeof(unsigned int)); 
+  bytes["inverted_index"] = inv_idx_bytes; 
+  long feat_str_bytes = 0; 
+  for (map<string, unsigned int>::const_iterator it = featStr2ID.begin(); it != featStr2ID.end(); it++)
+    feat_str_bytes += treeNodeBytes(sizeof(pair<const string, unsigned int>)) + stringHeapBytes(it->first); 
+  bytes["feature_strings"] = feat_str_bytes; 
+  return bytes; 
+}
+
 unsigned int FeatureExtractor::getSetFeatureID(string featStr, const ContextSide side){
   featStr += (side == Left) ? "_L" : "_R"; 
   if (featStr2ID.find(featStr) == featStr2ID.end()){
@@ -395,6 +636,12 @@ unsigned int FeatureExtractor::getSetFeatureID(string featStr, const ContextSide
     return featStr2ID[featStr];
 }
 
+int FeatureExtractor::getFeatureID(string featStr, const ContextSide side){
+  featStr += (side == Left) ? "_L" : "_R"; 
+  map<string, unsigned int>::const_iterator it = featStr2ID.find(featStr); 
+  return (it == featStr2ID.end()) ? -1 : it->second; 
+}
+
 vector<ngram_triple> FeatureExtractor::extractNGrams(const unsigned int n, const string str){
   vector<ngram_triple> ngrams = vector<ngram_triple>();
   vector<string> words; 
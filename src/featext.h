@@ -10,6 +10,7 @@
 #include <Eigen/Sparse>
 #include <unsupported/Eigen/SparseExtra>
 #include "phrases.h"
+#include "cache.h"
 
 using namespace std;
 using namespace Eigen; 
@@ -17,6 +18,7 @@ typedef tuple<string,unsigned int,unsigned int> ngram_triple;
 //typedef unordered_map<unsigned int, set<unsigned int> >::iterator invIdxIter;
 typedef map<unsigned int, set<unsigned int> >::iterator invIdxIter;
 typedef Triplet<double> triplet; 
+class CheckpointWriter; 
 
 class FeatureExtractor {
  public:
@@ -26,31 +28,48 @@ class FeatureExtractor {
   vector<string> filterSentences(const string mono_dir_loc, Phrases* phrases, const unsigned int minPL, const unsigned int maxPL, const unsigned int maxPhrCount, const string monolingual_out); 
   void readStopWords(const string filename, const unsigned int num_sw); 
   static set<int> readStopWordsAsPhrases(const string filename, const unsigned int num_sw, Phrases* phrases); 
-  void extractFeatures(Phrases* phrases, const string mono_filename, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL); 
+  void extractFeatures(Phrases* phrases, const string mono_filename, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL, StageCache* checkpoint=NULL, const long checkpoint_lines=0); //resumes from a valid checkpoint, and writes one every checkpoint_lines lines
   void pruneFeaturesByCount(const unsigned int minCount); 
+  vector<double> addPhraseRows(Phrases* phrases, const vector<string>& lines, const unsigned int first_new, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL); //returns the new rows' co-occurrence counts
+  void addFeatureRows(const vector<vector<pair<int,double> > >& rows, const int num_features); //with their posting lists
   void analyzeFeatureMatrix(const vector<Phrases::Phrase*> unlabeled_phrases); 
   void rescaleCoocToPMI();
   void writeCoocToFile(const string cooc_loc); 
+  vector<double> getCoocRowSums(); 
+  static bool readCoocRowSums(const string cooc_loc, vector<double>& rowSums); 
+  static vector<double> computeCoocRowSums(const string cooc_loc); 
   void writeToFile(const string featMatLoc, const string invIdxLoc); 
   void readFromFile(const string featMatLoc, const string invIdxLoc); 
+  static bool readStopFeatures(const string invIdxLoc, set<unsigned int>& stopFeatures); 
   double computeCosineSim(const int idx_i, const int idx_j); 
   unsigned int getNumPoints() { return feature_matrix.rows(); }
   int getNumFeatures(){ return feature_matrix.cols(); }
+  double getTotalCount(){ return total_count; } //of the co-occurrence matrix, as of rescaleCoocToPMI
   SparseVector<double> getFeatureRow(const unsigned int rowIdx){ return feature_matrix.row(rowIdx); }
   set<unsigned int> getNeighbors(const unsigned int featID){ return (inverted_idx.find(featID) == inverted_idx.end()) ? set<unsigned int>() : inverted_idx[featID]; }
-  SparseMatrix<double,RowMajor> getFeatureMatrix() { return feature_matrix; }
+  const SparseMatrix<double,RowMajor>& getFeatureMatrix() { return feature_matrix; }
+  map<string, long> memoryUsage(); //estimated bytes of each data structure
 
   
  private:
   enum ContextSide { Left, Right };  
   static string concat(vector<string> words, const unsigned int start, const unsigned int end); 
+  long addLineContexts(Phrases* phrases, const string& line, const unsigned int winsize, const unsigned int minPL, const unsigned int maxPL, const int min_phrase_id); 
   void addContext(const unsigned int phraseID, vector<string> subsent, const ContextSide side); 
   void augmentFeatureMatrix(const unsigned int numTotalPhrases); 
+  void writeStopFeatures(const string invIdxLoc); 
+  void writeCheckpoint(CheckpointWriter& writer, const long offset, const long lines_read, const long phrase_occurrences); 
+  bool readCheckpoint(const string checkpointLoc, long& offset, long& lines_read, long& phrase_occurrences); 
   unsigned int getSetFeatureID(string featStr, const ContextSide side);
+  int getFeatureID(string featStr, const ContextSide side); //-1 if unseen
   set<unsigned int> stop_words; 
   map<string, unsigned int> featStr2ID; 
   //unordered_map<unsigned int, set<unsigned int> > inverted_idx; //right now a map between feature IDs and sets of phrase IDs, but can also make it a map to vector of Phrase* pointers? 
   map<unsigned int, set<unsigned int> > inverted_idx; 
   vector<triplet> featMat_triplets; 
   SparseMatrix<double,RowMajor> feature_matrix; 
+  bool fixed_features; //contexts are only looked up, e.g., when adding rows to a rescaled matrix
+  unsigned int min_count; 
+  vector<double> feature_counts; //column sums of the co-occurrence matrix, as of rescaleCoocToPMI
+  double total_count; 
 };
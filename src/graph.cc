@@ -1,19 +1,39 @@
 #include "graph.h"
 #include "lexical.h"
+#include "sparse_cosine.h"
+#include "csr_util.h"
+#include "compact_matrix.h"
+#include "metrics.h"
 #include <omp.h>
 #include <set>
+#include <queue>
+#include <functional>
+#include <math.h>
 
 using namespace std;
 using namespace Eigen;
 
+const long CACHE_ENTRY_BYTES = treeNodeBytes(sizeof(pair<const string, double>)); //keys fit in the short string buffer
+
+//with a memory budget, the similarity cache may take a quarter of it
+static unsigned long cacheEntryLimit(){
+  return (Metrics::getMemoryBudget() > 0) ? max(2L, Metrics::getMemoryBudget() / 4 / CACHE_ENTRY_BYTES) : 0; 
+}
+
 DynamicGraph::DynamicGraph(FeatureExtractor* features){
   feat_mat = SparseMatrix<double,RowMajor>(features->getFeatureMatrix()); 
+  norms = rowNorms(feat_mat); 
+  cache_hits = 0, cache_misses = 0, cache_evictions = 0; 
   cache = map<string, double>(); 
+  max_cache_entries = cacheEntryLimit(); 
 }
 
 DynamicGraph::DynamicGraph(const string dgLoc){
-  loadMarket(feat_mat, dgLoc); 
+  readMarket(dgLoc, feat_mat); 
+  norms = rowNorms(feat_mat); 
+  cache_hits = 0, cache_misses = 0, cache_evictions = 0; 
   cache = map<string, double>(); 
+  max_cache_entries = cacheEntryLimit(); 
 }
 
 DynamicGraph::~DynamicGraph(){
@@ -23,107 +43,438 @@ void DynamicGraph::writeToFile(const string dgLoc){
   saveMarket(feat_mat, dgLoc); 
 }
 
+//computes the given (label, label) similarities up front, in parallel, into a sorted pair table; 
+//pairs must be sorted and unique. pairs not in the table are still computed lazily
+void DynamicGraph::precomputeSimilarities(const vector<pair<int,int> >& pairs){
+  vector<double> sims(pairs.size(), 0.0); 
+  unsigned int negative_similarities = 0; 
+  #pragma omp parallel for schedule(dynamic, 1024) reduction(+:negative_similarities)
+  for (unsigned int p = 0; p < pairs.size(); p++){
+    double sim = cosineSimilarity(sparseRow(feat_mat, pairs[p].first), sparseRow(feat_mat, pairs[p].second), norms[pairs[p].first], norms[pairs[p].second]); 
+    if (sim < 0)
+      negative_similarities++; 
+    sims[p] = (sim < 0) ? 0 : sim; 
+  }
+  cout << "Number of target phrase pairs with negative similarity: " << negative_similarities << endl; 
+  pair_sims = SparseMatrix<double,RowMajor>(feat_mat.rows(), feat_mat.rows()); 
+  pair_sims.reserve(pairs.size()); 
+  unsigned int p = 0; 
+  for (int i = 0; i < pair_sims.rows(); i++){
+    pair_sims.startVec(i); 
+    for (; p < pairs.size() && pairs[p].first == i; p++)
+      pair_sims.insertBack(i, pairs[p].second) = sims[p]; //explicit zeros are kept so that they are found on lookup
+  }
+  pair_sims.finalize(); 
+}
+
 double DynamicGraph::getSimilarity(const int i, const int j){
+  if (pair_sims.nonZeros() > 0){ //look up the pair table first
+    const int* row_begin = pair_sims.innerIndexPtr() + pair_sims.outerIndexPtr()[i]; 
+    const int* row_end = pair_sims.innerIndexPtr() + pair_sims.outerIndexPtr()[i+1]; 
+    const int* pos = lower_bound(row_begin, row_end, j); 
+    if (pos != row_end && *pos == j){
+      cache_hits++; 
+      return pair_sims.valuePtr()[pos - pair_sims.innerIndexPtr()]; 
+    }
+  }
   char ix[100]; 
   char iy[100]; 
   double sim; 
   sprintf(ix, "%d,%d", i, j); 
   if (cache.find(ix) == cache.end()){ //not found in cache; compute, add to cache
-    SparseVector<double> vec1 = feat_mat.row(i); 
-    SparseVector<double> vec2 = feat_mat.row(j); 
-    sim = vec1.dot(vec2) / (vec1.norm() * vec2.norm());     
+    cache_misses++; 
+    sim = cosineSimilarity(sparseRow(feat_mat, i), sparseRow(feat_mat, j), norms[i], norms[j]); 
     if (sim < 0)
       cout << "Phrase ID pair (" << i << "," << j << ") has negative similarity: " << sim << endl; 
     sim = (sim < 0) ? 0 : sim; 
+    if (max_cache_entries > 0 && cache.size() + 2 > max_cache_entries){ //over budget: start over rather than track recency
+      cache.clear(); 
+      cache_evictions++; 
+    }
     cache[ix] = sim; 
     sprintf(iy, "%d,%d", j, i); 
     cache[iy] = sim; 
   }
-  else
+  else {
+    cache_hits++; 
     sim = cache[ix]; 
+  }
   return sim; 
 }
 
-Graph::Graph(FeatureExtractor* features, const unsigned int k){
+map<string, long> DynamicGraph::memoryUsage(const string prefix){
+  map<string, long> bytes = map<string, long>(); 
+  bytes[prefix + "feature_matrix"] = sparseMatrixBytes(feat_mat) + norms.capacity() * sizeof(double); 
+  bytes[prefix + "similarity_cache"] = cache.size() * CACHE_ENTRY_BYTES; 
+  bytes[prefix + "pair_table"] = sparseMatrixBytes(pair_sims); 
+  return bytes; 
+}
+
+void DynamicGraph::recordMetrics(){
+  Metrics::addCount("target_similarity_cache_hits", cache_hits); 
+  Metrics::addCount("target_similarity_cache_misses", cache_misses); 
+  Metrics::addCount("target_similarity_cache_evictions", cache_evictions); 
+}
+
+Graph::Graph(FeatureExtractor* features, const unsigned int k, const vector<Phrases::Phrase*>& restrict_to, const bool keep_neighbors){
   sim_mat = SparseMatrix<double,RowMajor>();
   sim_mat_triplets = vector<triplet>(); 
+  num_neighbors = k; 
   unsigned int featureless_phrases = 0; 
   unsigned int negative_similarities = 0; 
-  #pragma omp parallel for
-  for (unsigned int i = 0; i < features->getNumPoints(); i++){
-    SparseVector<double> featureVec = features->getFeatureRow(i);     
-    set<unsigned int> neighbors = set<unsigned int>();
-    for (SparseVector<double>::InnerIterator it(featureVec); it; ++it){ //use the inverted idx structure to generate neighbors
-      set<unsigned int> neighbors_by_feature = features->getNeighbors(it.index()); 
-      neighbors.insert(neighbors_by_feature.begin(), neighbors_by_feature.end()); //or use set_union instead? which is faster? 
-    }
-    if (neighbors.size() > 0){
-      vector<pair<unsigned int, double> > idxsAndDotProds = vector<pair<unsigned int, double> >(); 
-      idxsAndDotProds.reserve(neighbors.size()); 
-      set<unsigned int>::iterator iter; 
-      for (iter = neighbors.begin(); iter != neighbors.end(); iter++){ //loop through all neighbors and compute sim
-	if ((*iter) != i){ //filtering for self similarity	  
-	  double dp = featureVec.dot(features->getFeatureRow(*iter)) / (featureVec.norm() * features->getFeatureRow(*iter).norm()); 
-	  if (dp > 0)
-	    idxsAndDotProds.push_back(make_pair(*iter, dp)); 
-	}
-      }
-      if (idxsAndDotProds.size() > 0){ //if at least one of the similarities is positive
-	sort(idxsAndDotProds.begin(), idxsAndDotProds.end(), [](const pair<unsigned int, double>& lhs, const pair<unsigned int, double>& rhs){ return lhs.second > rhs.second; }); //in descending order
-	unsigned int topN = (k < idxsAndDotProds.size()) ? k : idxsAndDotProds.size(); 
-	vector<pair<unsigned int, double> > topK_idxsDPs(idxsAndDotProds.begin(), idxsAndDotProds.begin()+topN);     
-        #pragma omp critical(addSparseTriplet)
-	{
-	  for (unsigned int j = 0; j < topK_idxsDPs.size(); j++)
-	    sim_mat_triplets.push_back(triplet(i, topK_idxsDPs[j].first, topK_idxsDPs[j].second)); 
-	  sim_mat_triplets.push_back(triplet(i, i, 1.0)); 
-	}
-      }
-      else { //all similarities are negative
-	negative_similarities++; 
-        #pragma omp critical(addSparseTripletSelfSim)
-	{
-	  sim_mat_triplets.push_back(triplet(i, i, 1.0)); 
-	}
+  vector<bool> in_subgraph(features->getNumPoints(), restrict_to.empty()); 
+  vector<unsigned int> rows = vector<unsigned int>(); 
+  if (restrict_to.empty()){
+    for (unsigned int i = 0; i < features->getNumPoints(); i++)
+      rows.push_back(i); 
+  }
+  else {
+    for (unsigned int i = 0; i < restrict_to.size(); i++){
+      rows.push_back(restrict_to[i]->id); 
+      in_subgraph[restrict_to[i]->id] = true; 
+    }
+  }
+  const vector<double> norms = rowNorms(features->getFeatureMatrix()); 
+  addNearestNeighbors(features, k, norms, rows, featureless_phrases, negative_similarities); 
+  if (!restrict_to.empty()){ //rows of one-hop neighbors outside the subgraph are only needed for their edges back into it, which symmetrizing adds to the subgraph rows
+    vector<bool> computed(features->getNumPoints(), false); 
+    for (unsigned int i = 0; i < rows.size(); i++)
+      computed[rows[i]] = true; 
+    vector<unsigned int> neighbor_rows = vector<unsigned int>(); 
+    for (unsigned int i = 0; i < sim_mat_triplets.size(); i++){
+      if (!computed[sim_mat_triplets[i].col()]){
+	computed[sim_mat_triplets[i].col()] = true; 
+	neighbor_rows.push_back(sim_mat_triplets[i].col()); 
       }
     }
-    else { //no neighbors
-      featureless_phrases++; 
-      #pragma omp critical(addSparseTripletSelfSimFeatureless)
-	{
-	  sim_mat_triplets.push_back(triplet(i, i, 1.0)); 
-	}
-    }    
+    const unsigned int num_subgraph_triplets = sim_mat_triplets.size(); 
+    addNearestNeighbors(features, k, norms, neighbor_rows, featureless_phrases, negative_similarities); 
+    sim_mat_triplets.erase(remove_if(sim_mat_triplets.begin() + num_subgraph_triplets, sim_mat_triplets.end(), [&in_subgraph](const triplet& t){ return !in_subgraph[t.col()]; }), sim_mat_triplets.end()); 
+    cout << "Restricted graph to " << rows.size() << " phrases; also computed neighbors for " << neighbor_rows.size() << " adjacent phrases" << endl; 
   }
   cout << "Number of phrases without neighbors (i.e., other phrases sharing one common non stop-word feature): " << featureless_phrases << endl; 
   cout << "Number of phrases that have negative similarities with all neighbors: " << negative_similarities << endl; 
-  sim_mat.resize(features->getNumPoints(), features->getNumPoints()); 
-  sim_mat.reserve(sim_mat_triplets.size()); 
-  sim_mat.setFromTriplets(sim_mat_triplets.begin(), sim_mat_triplets.end()); 
-  sim_mat_triplets.clear(); //memory efficiency purposes
-  cout << "Before symmetrizing, total NNZs in similarity matrix: " << sim_mat.nonZeros() << endl; 
-  sim_mat = 0.5*(SparseMatrix<double,RowMajor>(sim_mat.transpose()) + sim_mat); 
-  VectorXd indSimSumRowInv = (sim_mat*VectorXd::Ones(sim_mat.cols())).cwiseInverse(); 
-  SparseMatrix<double,RowMajor> left_mult(sim_mat.rows(), sim_mat.rows());
-  vector<triplet> left_mult_diagonal = vector<triplet>();
-  for (unsigned int i = 0; i < indSimSumRowInv.size(); i++)
-    left_mult_diagonal.push_back(triplet(i, i, indSimSumRowInv[i])); 
-  left_mult.reserve(left_mult_diagonal.size());
-  left_mult.setFromTriplets(left_mult_diagonal.begin(), left_mult_diagonal.end()); 
-  sim_mat = left_mult * sim_mat; 
+  cout << "Before symmetrizing, total NNZs in similarity matrix: " << sim_mat_triplets.size() << endl; 
+  if (keep_neighbors){ //for insertNodes
+    knn_mat.resize(features->getNumPoints(), features->getNumPoints()); 
+    knn_mat.setFromTriplets(sim_mat_triplets.begin(), sim_mat_triplets.end()); 
+  }
+  symmetrizeAndNormalize(sim_mat_triplets, features->getNumPoints(), sim_mat); 
+  if (!restrict_to.empty()) //rows outside the subgraph are never read during propagation
+    sim_mat.prune([&in_subgraph](const int& row, const int& col, const double& value){ return in_subgraph[row]; }); 
   cout << "After symmetrizing (and normalizing), total NNZs in random walk matrix: " << sim_mat.nonZeros() << endl; 
 }
 
+//builds the random walk matrix D^-1 * 0.5*(K + K^T) from the kNN triplets K (consumed) directly in the CSR arrays 
+//of sim_mat: each triplet is scattered into both its row and its column's row, and then each row is sorted, merged, 
+//and scaled in parallel and compacted in place. no transposed copy or diagonal matrix is built, so the peak is the 
+//triplets plus the unmerged matrix (twice the triplets)
+void Graph::symmetrizeAndNormalize(vector<triplet>& triplets, const int num_points, SparseMatrix<double,RowMajor>& sim_mat){
+  sim_mat.resize(num_points, num_points); 
+  sim_mat.resizeNonZeros(2 * triplets.size()); 
+  int* outer = sim_mat.outerIndexPtr(); 
+  int* inner = sim_mat.innerIndexPtr(); 
+  double* values = sim_mat.valuePtr(); 
+  vector<int> row_fill(num_points, 0); 
+  #pragma omp parallel for
+  for (unsigned int t = 0; t < triplets.size(); t++){
+    #pragma omp atomic
+    row_fill[triplets[t].row()]++; 
+    #pragma omp atomic
+    row_fill[triplets[t].col()]++; 
+  }
+  outer[0] = 0; 
+  for (int i = 0; i < num_points; i++){
+    outer[i+1] = outer[i] + row_fill[i]; 
+    row_fill[i] = outer[i]; //from here on, next free position in row i
+  }
+  #pragma omp parallel for
+  for (unsigned int t = 0; t < triplets.size(); t++){
+    int pos; 
+    #pragma omp atomic capture
+    pos = row_fill[triplets[t].row()]++; 
+    inner[pos] = triplets[t].col(); 
+    values[pos] = 0.5*triplets[t].value(); 
+    #pragma omp atomic capture
+    pos = row_fill[triplets[t].col()]++; 
+    inner[pos] = triplets[t].row(); 
+    values[pos] = 0.5*triplets[t].value(); 
+  }
+  vector<triplet>().swap(triplets); //memory efficiency purposes
+  #pragma omp parallel for schedule(dynamic, 1024)
+  for (int i = 0; i < num_points; i++){
+    const int begin = outer[i]; 
+    vector<pair<int,double> > row = vector<pair<int,double> >(); 
+    row.reserve(outer[i+1] - begin); 
+    for (int p = begin; p < outer[i+1]; p++)
+      row.push_back(make_pair(inner[p], values[p])); 
+    mergeAndNormalize(row); 
+    for (unsigned int p = 0; p < row.size(); p++){
+      inner[begin + p] = row[p].first; 
+      values[begin + p] = row[p].second; 
+    }
+    row_fill[i] = row.size(); 
+  }
+  int nnz = 0; 
+  for (int i = 0; i < num_points; i++){ //compact; rows only move towards the front
+    const int begin = outer[i]; 
+    outer[i] = nnz; 
+    copy(inner + begin, inner + begin + row_fill[i], inner + nnz); 
+    copy(values + begin, values + begin + row_fill[i], values + nnz); 
+    nnz += row_fill[i]; 
+  }
+  outer[num_points] = nnz; 
+  sim_mat.resizeNonZeros(nnz); 
+  if (nnz < 3 * (sim_mat.data().allocatedSize() / 4)) //only worth a reallocation if many edges were mutual
+    sim_mat.data().squeeze(); 
+}
+
+//sorts a row of halved kNN edges and transposed kNN edges by column, merges an edge present in both K and K^T (which 
+//appears twice), and scales the row to sum to 1
+void Graph::mergeAndNormalize(vector<pair<int,double> >& row){
+  sort(row.begin(), row.end(), [](const pair<int,double>& lhs, const pair<int,double>& rhs){ return lhs.first < rhs.first; }); 
+  unsigned int len = 0; 
+  for (unsigned int p = 0; p < row.size(); p++){
+    if (len > 0 && row[len-1].first == row[p].first)
+      row[len-1].second += row[p].second; 
+    else
+      row[len++] = row[p]; 
+  }
+  row.resize(len); 
+  double row_sum = 0.0; 
+  for (unsigned int p = 0; p < len; p++)
+    row_sum += row[p].second; 
+  const double row_sum_inv = 1.0 / row_sum; 
+  for (unsigned int p = 0; p < len; p++)
+    row[p].second *= row_sum_inv; 
+}
+
+//the phrases that share a non stop-word feature with phrase i and have a positive similarity with it, nearest first
+vector<pair<unsigned int, double> > Graph::rankNeighbors(FeatureExtractor* features, const vector<double>& norms, const unsigned int i, bool& has_candidates){
+  const SparseMatrix<double,RowMajor>& feat_mat = features->getFeatureMatrix(); 
+  const SparseRow featureRow = sparseRow(feat_mat, i); 
+  set<unsigned int> neighbors = set<unsigned int>();
+  for (int f = 0; f < featureRow.size; f++){ //use the inverted idx structure to generate neighbors
+    set<unsigned int> neighbors_by_feature = features->getNeighbors(featureRow.idx[f]); 
+    neighbors.insert(neighbors_by_feature.begin(), neighbors_by_feature.end()); //or use set_union instead? which is faster? 
+  }
+  has_candidates = neighbors.size() > 0; 
+  vector<pair<unsigned int, double> > idxsAndDotProds = vector<pair<unsigned int, double> >(); 
+  idxsAndDotProds.reserve(neighbors.size()); 
+  for (set<unsigned int>::iterator iter = neighbors.begin(); iter != neighbors.end(); iter++){ //loop through all neighbors and compute sim
+    if ((*iter) != i){ //filtering for self similarity	  
+      double dp = cosineSimilarity(featureRow, sparseRow(feat_mat, *iter), norms[i], norms[*iter]); 
+      if (dp > 0)
+	idxsAndDotProds.push_back(make_pair(*iter, dp)); 
+    }
+  }
+  sort(idxsAndDotProds.begin(), idxsAndDotProds.end(), moreSimilar); //in descending order
+  return idxsAndDotProds; 
+}
+
+//computes the k nearest neighbors of each phrase in rows and adds them, along with the self similarity, to sim_mat_triplets
+void Graph::addNearestNeighbors(FeatureExtractor* features, const unsigned int k, const vector<double>& norms, const vector<unsigned int>& rows, unsigned int& featureless_phrases, unsigned int& negative_similarities){
+  ProgressReporter progress("constructGraph", rows.size(), "phrases"); 
+  #pragma omp parallel for
+  for (unsigned int r = 0; r < rows.size(); r++){
+    const unsigned int i = rows[r]; 
+    progress.add(1); 
+    bool has_candidates = false; 
+    vector<pair<unsigned int, double> > topK_idxsDPs = rankNeighbors(features, norms, i, has_candidates); 
+    if (topK_idxsDPs.size() > k)
+      topK_idxsDPs.resize(k); 
+    if (topK_idxsDPs.empty() && has_candidates){ //all similarities are negative
+      #pragma omp atomic
+      negative_similarities++; 
+    }
+    else if (topK_idxsDPs.empty()){ //no neighbors
+      #pragma omp atomic
+      featureless_phrases++; 
+    }
+    #pragma omp critical(addSparseTriplet) //all triplet insertions must share one lock
+    {
+      for (unsigned int j = 0; j < topK_idxsDPs.size(); j++)
+	sim_mat_triplets.push_back(triplet(i, topK_idxsDPs[j].first, topK_idxsDPs[j].second)); 
+      sim_mat_triplets.push_back(triplet(i, i, 1.0)); 
+    }
+  }
+}
+
+//inserts the phrases with IDs first_new and up, whose feature rows (and norms, in norms) and posting lists have been
+//appended to the features since the graph was built. each new phrase gets its k nearest neighbors, and enters the kNN
+//lists of the phrases it is nearer to than their k-th nearest neighbor (which then drops out). only the rows of the 
+//random walk matrix at either end of a changed kNN edge are rebuilt, from the kNN lists, and normalized as in 
+//symmetrizeAndNormalize, so the graph is the one that Graph(features, k) would build from scratch
+void Graph::insertNodes(FeatureExtractor* features, const vector<double>& norms, const unsigned int first_new){
+  if (knn_mat.rows() != sim_mat.rows() || first_new != sim_mat.rows()){ cerr << "Inserting phrases into a graph needs the kNN lists of all of its phrases (keep_neighbors)" << endl; exit(0); }
+  const unsigned int num_points = features->getNumPoints(); 
+  vector<vector<pair<unsigned int, double> > > ranked(num_points - first_new); 
+  #pragma omp parallel for schedule(dynamic)
+  for (unsigned int r = 0; r < ranked.size(); r++){
+    bool has_candidates = false; 
+    ranked[r] = rankNeighbors(features, norms, first_new + r, has_candidates); 
+  }
+  map<int, vector<pair<int,double> > > knn_rows = map<int, vector<pair<int,double> > >(); //changed kNN lists, in column order
+  map<unsigned int, vector<pair<unsigned int, double> > > entering = map<unsigned int, vector<pair<unsigned int, double> > >(); //new phrases that may enter each existing phrase's list
+  for (unsigned int r = 0; r < ranked.size(); r++){
+    const unsigned int i = first_new + r; 
+    vector<pair<int,double> >& row = knn_rows[i]; 
+    for (unsigned int p = 0; p < ranked[r].size(); p++){
+      if (p < num_neighbors)
+	row.push_back(make_pair(ranked[r][p].first, ranked[r][p].second)); 
+      if (ranked[r][p].first < first_new) //similarities are symmetric
+	entering[ranked[r][p].first].push_back(make_pair(i, ranked[r][p].second)); 
+    }
+    row.push_back(make_pair(i, 1.0)); 
+    sort(row.begin(), row.end()); 
+  }
+  set<int> touched = set<int>(); //rows at either end of an added or removed kNN edge
+  for (map<unsigned int, vector<pair<unsigned int, double> > >::iterator it = entering.begin(); it != entering.end(); it++){
+    const int i = it->first; 
+    vector<pair<unsigned int, double> >& candidates = it->second; 
+    for (SparseMatrix<double,RowMajor>::InnerIterator e(knn_mat, i); e; ++e){
+      if (e.col() != i)
+	candidates.push_back(make_pair(e.col(), e.value())); 
+    }
+    sort(candidates.begin(), candidates.end(), moreSimilar); 
+    if (candidates.size() > num_neighbors)
+      candidates.resize(num_neighbors); 
+    bool entered = false; 
+    for (unsigned int p = 0; p < candidates.size() && !entered; p++)
+      entered = candidates[p].first >= first_new; 
+    if (!entered)
+      continue; 
+    vector<pair<int,double> >& row = knn_rows[i]; 
+    for (unsigned int p = 0; p < candidates.size(); p++)
+      row.push_back(make_pair(candidates[p].first, candidates[p].second)); 
+    row.push_back(make_pair(i, 1.0)); 
+    sort(row.begin(), row.end()); 
+    touched.insert(i); 
+    for (SparseMatrix<double,RowMajor>::InnerIterator e(knn_mat, i); e; ++e){ //the neighbors that dropped out
+      if (!binary_search(row.begin(), row.end(), make_pair((int) e.col(), e.value())))
+	touched.insert(e.col()); 
+    }
+  }
+  map<int, vector<int> > incoming = map<int, vector<int> >(); //phrases whose changed kNN lists include each phrase
+  for (map<int, vector<pair<int,double> > >::const_iterator it = knn_rows.begin(); it != knn_rows.end(); it++){
+    for (unsigned int p = 0; p < it->second.size(); p++){
+      if (it->first >= (int) first_new) //the ends of the new phrases' edges
+	touched.insert(it->second[p].first); 
+      incoming[it->second[p].first].push_back(it->first); 
+    }
+  }
+  replaceRows(knn_mat, knn_rows, num_points, num_points); 
+  const vector<int> rows(touched.begin(), touched.end()); 
+  vector<vector<pair<int,double> > > rebuilt(rows.size()); 
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (unsigned int r = 0; r < rows.size(); r++){ //0.5*(K + K^T), where K^T comes from the phrases that were, or now are, linked to this one
+    const int i = rows[r]; 
+    vector<int> sources = vector<int>(); 
+    map<int, vector<int> >::const_iterator in = incoming.find(i); 
+    if (in != incoming.end())
+      sources = in->second; 
+    if (i < (int) first_new){
+      for (SparseMatrix<double,RowMajor>::InnerIterator e(sim_mat, i); e; ++e)
+	sources.push_back(e.col()); 
+    }
+    sort(sources.begin(), sources.end()); 
+    sources.erase(unique(sources.begin(), sources.end()), sources.end()); 
+    vector<pair<int,double> >& row = rebuilt[r]; 
+    for (SparseMatrix<double,RowMajor>::InnerIterator e(knn_mat, i); e; ++e)
+      row.push_back(make_pair(e.col(), 0.5*e.value())); 
+    for (unsigned int s = 0; s < sources.size(); s++){
+      const int* begin = knn_mat.innerIndexPtr() + knn_mat.outerIndexPtr()[sources[s]]; 
+      const int* end = knn_mat.innerIndexPtr() + knn_mat.outerIndexPtr()[sources[s]+1]; 
+      const int* pos = lower_bound(begin, end, i); 
+      if (pos != end && *pos == i)
+	row.push_back(make_pair(sources[s], 0.5*knn_mat.valuePtr()[pos - knn_mat.innerIndexPtr()])); 
+    }
+    mergeAndNormalize(row); 
+  }
+  map<int, vector<pair<int,double> > > sim_rows = map<int, vector<pair<int,double> > >(); 
+  changed_rows.resize(num_points, false); 
+  for (unsigned int r = 0; r < rows.size(); r++){
+    sim_rows[rows[r]].swap(rebuilt[r]); 
+    changed_rows[rows[r]] = true; 
+  }
+  replaceRows(sim_mat, sim_rows, num_points, num_points); 
+  cout << "Inserted " << num_points - first_new << " phrases into the graph; " << knn_rows.size() - (num_points - first_new) << " existing phrases' kNN lists changed, and " << rows.size() << " rows were rebuilt" << endl; 
+}
+
+map<string, long> Graph::memoryUsage(const string prefix){
+  map<string, long> bytes = map<string, long>(); 
+  bytes[prefix + "similarity_matrix"] = sparseMatrixBytes(sim_mat); 
+  if (knn_mat.nonZeros() > 0)
+    bytes[prefix + "neighbor_lists"] = sparseMatrixBytes(knn_mat); 
+  if (sim_mat_triplets.capacity() > 0)
+    bytes[prefix + "similarity_triplets"] = sim_mat_triplets.capacity() * sizeof(triplet); 
+  if (label_mat.rows() > 0)
+    bytes[prefix + "label_matrices"] = sparseMatrixBytes(label_mat) + sparseMatrixBytes(label_next); 
+  return bytes; 
+}
+
+//the feature matrix and inverted index, the kNN triplets, and the symmetrized matrix (up to twice the triplets)
+long Graph::estimateConstructionBytes(const long num_points, const long feature_nnz, const unsigned int k){
+  const long features = feature_nnz * (sizeof(double) + sizeof(int) + treeNodeBytes(sizeof(unsigned int))); 
+  const long knn_triplets = num_points * (k + 1); 
+  return features + knn_triplets * sizeof(triplet) + 2 * knn_triplets * (sizeof(double) + sizeof(int)); 
+}
+
 Graph::Graph(const string simMatLoc){
-  loadMarket(sim_mat, simMatLoc); 
+  num_neighbors = 0; 
+  if (!CompactMatrixWriter::read(simMatLoc, sim_mat)) //MatrixMarket otherwise
+    readMarket(simMatLoc, sim_mat); 
 }
 
 
 Graph::~Graph(){
 }
 
-void Graph::writeToFile(const string simMatLoc){
-  saveMarket(sim_mat, simMatLoc); 
+//double precision is written as MatrixMarket, anything else in the compact format
+void Graph::writeToFile(const string simMatLoc, const string precision){
+  if (CompactMatrixWriter::isCompactPrecision(precision))
+    CompactMatrixWriter::write(sim_mat, simMatLoc, precision); 
+  else
+    saveMarket(sim_mat, simMatLoc); 
+}
+
+//the rows that insertNodes or applyDelta changed, in a matrix of the graph's dimensions that is empty otherwise
+void Graph::writeDelta(const string deltaLoc, const string precision){
+  SparseMatrix<double,RowMajor> delta(sim_mat.rows(), sim_mat.cols()); 
+  long nnz = 0; 
+  for (unsigned int i = 0; i < changed_rows.size(); i++)
+    nnz += (changed_rows[i]) ? sim_mat.outerIndexPtr()[i+1] - sim_mat.outerIndexPtr()[i] : 0; 
+  delta.reserve(nnz); 
+  for (int i = 0; i < sim_mat.rows(); i++){
+    delta.startVec(i); 
+    if (i < (int) changed_rows.size() && changed_rows[i]){
+      for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, i); it; ++it)
+	delta.insertBack(i, it.col()) = it.value(); 
+    }
+  }
+  delta.finalize(); 
+  if (CompactMatrixWriter::isCompactPrecision(precision))
+    CompactMatrixWriter::write(delta, deltaLoc, precision); 
+  else
+    saveMarket(delta, deltaLoc); 
+}
+
+//replaces the rows of the graph with the non-empty rows of a delta written by writeDelta (every row of a graph has a
+//self similarity), and grows the graph to the delta's dimensions
+void Graph::applyDelta(const string deltaLoc){
+  SparseMatrix<double,RowMajor> delta; 
+  if (!CompactMatrixWriter::read(deltaLoc, delta))
+    readMarket(deltaLoc, delta); 
+  map<int, vector<pair<int,double> > > rows = map<int, vector<pair<int,double> > >(); 
+  changed_rows.resize(delta.rows(), false); 
+  for (int i = 0; i < delta.rows(); i++){
+    for (SparseMatrix<double,RowMajor>::InnerIterator it(delta, i); it; ++it)
+      rows[i].push_back(make_pair(it.col(), it.value())); 
+    if (rows.count(i) > 0)
+      changed_rows[i] = true; 
+  }
+  replaceRows(sim_mat, rows, delta.rows(), delta.cols()); 
+  knn_mat = SparseMatrix<double,RowMajor>(); //no longer the lists of this graph
 }
 
 
@@ -155,82 +506,131 @@ void Graph::analyzeSimilarityMatrix(const vector<Phrases::Phrase*> unlabeled_phr
 void Graph::initLabelsWithLexScore(Phrases* src_phrases, const string mbest_processed_loc, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, set<int> stopWords){
   if (filter_sw)
     assert(stopWords.size() > 0); 
-  unsigned int numCandidates = 0; 
   vector<Phrases::Phrase*> unlabeled_phrases = src_phrases->getUnlabeledPhrases(); 
   map<const string, vector<string> > mbest_by_src = src_phrases->readFormattedMBestListFromFile(mbest_processed_loc); //static method, can be read by either src_phrases or tgt_phrases
+  unsigned int numCandidates = addCandidates(src_phrases, unlabeled_phrases, mbest_by_src, lex, maxCand_size, filter_sw, stopWords); 
+  src_phrases->normalizeLabelDistributions(); 
+  Metrics::addCount("translation_candidates", numCandidates); 
+  //print candidate translations? if enabled, put here
+  cout << "Finished initializing candidate lists for unlabeled phrases. Average label set size: " << ((double)numCandidates)/((double)unlabeled_phrases.size()) << endl;
+}
+
+//candidates for unlabeled phrases added after initLabelsWithLexScore, e.g., while serving; only their distributions are
+//normalized
+void Graph::initLabels(Phrases* src_phrases, const vector<Phrases::Phrase*>& phrases, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, const set<int>& stopWords){
+  addCandidates(src_phrases, phrases, map<const string, vector<string> >(), lex, maxCand_size, filter_sw, stopWords); 
+  for (unsigned int i = 0; i < phrases.size(); i++)
+    phrases[i]->normalizeDistribution(); 
+}
+
+//adds the candidate translations of each phrase to its label distribution; returns the total number of candidates
+unsigned int Graph::addCandidates(Phrases* src_phrases, const vector<Phrases::Phrase*>& phrases, const map<const string, vector<string> >& mbest_by_src, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, const set<int>& stopWords){
+  unsigned int numCandidates = 0; 
+  const vector<string> no_mbest_candidates = vector<string>(); 
   #pragma omp parallel for
-  for (unsigned int i = 0; i < unlabeled_phrases.size(); i++){ //initialize candidates for each unlabeled phrase
-    const string srcphr = unlabeled_phrases[i]->phrase_str; 
-     vector<string> mbest_candidates = vector<string>();
-    if (mbest_by_src.find(srcphr) != mbest_by_src.end())
-      mbest_candidates = mbest_by_src[srcphr]; //associate unlabeled phrase with generated candidates
-    map<int,double> candidate_list = generateCandidateTranslations(srcphr, src_phrases->getPhraseID(srcphr), src_phrases, mbest_candidates, lex, maxCand_size, filter_sw, stopWords); //initialize candidate distribution
+  for (unsigned int i = 0; i < phrases.size(); i++){ //initialize candidates for each unlabeled phrase
+    const string srcphr = phrases[i]->phrase_str; 
+    map<const string, vector<string> >::const_iterator mbest_it = mbest_by_src.find(srcphr); 
+    const vector<string>& mbest_candidates = (mbest_it != mbest_by_src.end()) ? mbest_it->second : no_mbest_candidates; //associate unlabeled phrase with generated candidates
+    map<int,double> candidate_list = generateCandidateTranslations(srcphr, phrases[i]->id, src_phrases, mbest_candidates, lex, maxCand_size, filter_sw, stopWords); //initialize candidate distribution
 #pragma omp critical(updateDistribution)
     {
-      unlabeled_phrases[i]->label_distribution.insert(candidate_list.begin(), candidate_list.end()); 
-      numCandidates += unlabeled_phrases[i]->label_distribution.size(); 
+      phrases[i]->label_distribution.insert(candidate_list.begin(), candidate_list.end()); 
+      numCandidates += phrases[i]->label_distribution.size(); 
     }
   }
-  src_phrases->normalizeLabelDistributions(); 
-  //print candidate translations? if enabled, put here
-  cout << "Finished initializing candidate lists for unlabeled phrases. Average label set size: " << ((double)numCandidates)/((double)unlabeled_phrases.size()) << endl;
+  return numCandidates; 
 }
 
-map<int, double> Graph::generateCandidateTranslations(const string phrStr, const int phrID, Phrases* const src_phrases, const vector<string> mbest_candidates, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, set<int> stopWords){
+map<int, double> Graph::generateCandidateTranslations(const string phrStr, const int phrID, Phrases* const src_phrases, const vector<string>& mbest_candidates, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, const set<int>& stopWords){
   if (filter_sw)
     assert(stopWords.size() > 0); 
-  set<int> labels = set<int>(); //candidate translations
+  if (maxCand_size <= 0) //no room for candidates
+    return map<int,double>(); 
+  typedef map<int,double>::const_iterator labelIter; 
+  vector<pair<labelIter, labelIter> > label_ranges = vector<pair<labelIter, labelIter> >(); //sorted label ID ranges, one per labeled neighbor
   if (sim_mat.row(phrID).nonZeros() > 1){ //make sure phrase has neighbors; > 1 because we always have self sim
     for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, phrID); it; ++it){
-      int neighborIdx = it.col();
-      if (src_phrases->getNthPhrase(neighborIdx)->isLabeled()){ //if the neighbor is labeled
-	set<int> labels_from_neighbor = src_phrases->getNthPhrase(neighborIdx)->getLabels(); 
-	assert(labels_from_neighbor.size() > 0); 
-	labels.insert(labels_from_neighbor.begin(), labels_from_neighbor.end());
+      Phrases::Phrase* neighbor = src_phrases->getNthPhrase(it.col()); 
+      if (neighbor->isLabeled()){ //if the neighbor is labeled
+	assert(neighbor->label_distribution.size() > 0); 
+	label_ranges.push_back(make_pair(neighbor->label_distribution.begin(), neighbor->label_distribution.end())); 
       }
-    } //at this stage, we have the union of the labeled neighbors' labels
+    }
   }
+  vector<int> labels = mergeLabelRanges(label_ranges); //at this stage, we have the union of the labeled neighbors' labels, sorted by ID
+  vector<int> generated_labels = vector<int>(); 
   for (unsigned int i = 0; i < mbest_candidates.size(); i++){ //add generated labels
     int labelPhrID = src_phrases->getLabelPhraseID(mbest_candidates[i]); 
     if (labelPhrID > -1) //check if this is the best idea
-      labels.insert(labelPhrID); 
+      generated_labels.push_back(labelPhrID); 
+  }
+  if (generated_labels.size() > 0){
+    sort(generated_labels.begin(), generated_labels.end()); 
+    generated_labels.erase(unique(generated_labels.begin(), generated_labels.end()), generated_labels.end()); //m-best lists can repeat a hypothesis
+    vector<int> merged_labels = vector<int>(); 
+    merged_labels.reserve(labels.size() + generated_labels.size()); 
+    set_union(labels.begin(), labels.end(), generated_labels.begin(), generated_labels.end(), back_inserter(merged_labels)); 
+    labels.swap(merged_labels); 
   }
   if (filter_sw)
     filterCandidatesForStopWords(labels, stopWords); 
-  vector<string> srcPhrases = vector<string>();
+  if (labels.size() == 0)
+    return map<int,double>();
+  vector<string> srcPhrases(labels.size(), phrStr);
   vector<string> tgtPhrases = vector<string>();
-  for (set<int>::iterator it = labels.begin(); it != labels.end(); it++){ //convert to phrase pairs
-    srcPhrases.push_back(phrStr); 
-    tgtPhrases.push_back(src_phrases->getLabelPhraseStr(*it)); 
-  }
+  tgtPhrases.reserve(labels.size()); 
+  for (unsigned int i = 0; i < labels.size(); i++) //strings only needed by the lexical model
+    tgtPhrases.push_back(src_phrases->getLabelPhraseStr(labels[i])); 
   vector<pair<double, double> > lex_scores = lex->scorePhrasePairs(srcPhrases, tgtPhrases); 
   vector<pair<int, double> > label_lexscore = vector<pair<int, double> >(); 
-  for (unsigned int i = 0; i < lex_scores.size(); i++ ) //pair each candidate with score
-    label_lexscore.push_back(make_pair(src_phrases->getLabelPhraseID(tgtPhrases[i]), lex_scores[i].first)); 
-  if (label_lexscore.size() > 0){
-    sort(label_lexscore.begin(), label_lexscore.end(), [](const pair<int, double>& lhs, const pair<int, double>& rhs){ return lhs.second > rhs.second; }); //ascending
-    int topK = (maxCand_size > label_lexscore.size()) ? label_lexscore.size() : maxCand_size; 
-    map<int, double> top_labels(label_lexscore.begin(), label_lexscore.begin() + topK); 
-    //for (map<int, double>::iterator it = top_labels.begin(); it != top_labels.end(); it++)
-    //  cout << "Label phrase ID: " << it->first << "; phrase: " << src_phrases->getLabelPhraseStr(it->first) << " has prob: " << it->second << endl;     
-    return top_labels; 
-  }
-  else 
-    return map<int,double>();
+  label_lexscore.reserve(labels.size()); 
+  for (unsigned int i = 0; i < lex_scores.size(); i++ ) //pair each candidate ID with score
+    label_lexscore.push_back(make_pair(labels[i], lex_scores[i].first)); 
+  const unsigned int topK = ((unsigned int) maxCand_size < label_lexscore.size()) ? maxCand_size : label_lexscore.size(); 
+  if (topK < label_lexscore.size()) //only need the top K, not a full ordering; equal scores go to the lower label ID
+    nth_element(label_lexscore.begin(), label_lexscore.begin() + topK, label_lexscore.end(), [](const pair<int, double>& lhs, const pair<int, double>& rhs){ return lhs.second > rhs.second || (lhs.second == rhs.second && lhs.first < rhs.first); }); 
+  return map<int, double>(label_lexscore.begin(), label_lexscore.begin() + topK); 
+}
+
+//k-way merge of sorted label ID ranges into a sorted, duplicate-free vector
+vector<int> Graph::mergeLabelRanges(vector<pair<map<int,double>::const_iterator, map<int,double>::const_iterator> >& label_ranges){
+  typedef pair<int, unsigned int> headEntry; //(label ID, index of range)
+  priority_queue<headEntry, vector<headEntry>, greater<headEntry> > heads; 
+  for (unsigned int i = 0; i < label_ranges.size(); i++){
+    if (label_ranges[i].first != label_ranges[i].second)
+      heads.push(make_pair(label_ranges[i].first->first, i)); 
+  }
+  vector<int> labels = vector<int>(); 
+  while (!heads.empty()){
+    headEntry top = heads.top(); 
+    heads.pop(); 
+    if (labels.empty() || labels.back() != top.first)
+      labels.push_back(top.first); 
+    if (++label_ranges[top.second].first != label_ranges[top.second].second)
+      heads.push(make_pair(label_ranges[top.second].first->first, top.second)); 
+  }
+  return labels; 
 }
 
-void Graph::filterCandidatesForStopWords(set<int>& labels, const set<int> stopWords){
-  set<int> result;   
-  set_difference(labels.begin(), labels.end(), stopWords.begin(), stopWords.end(), inserter(result, result.end())); 
+void Graph::filterCandidatesForStopWords(vector<int>& labels, const set<int>& stopWords){
+  vector<int> result;   
+  set_difference(labels.begin(), labels.end(), stopWords.begin(), stopWords.end(), back_inserter(result)); 
   //if (result.size() != labels.size())
   //  cout << "Filtered stop words" << endl; 
-  labels = result; 
+  labels.swap(result); 
 }
 
-void Graph::labelProp(Phrases* src_phrases){
-  vector<Phrases::Phrase*> unlabeled_phrases = src_phrases->getUnlabeledPhrases(); 
-  for (unsigned int i = 0; i < unlabeled_phrases.size(); i++){ 
-    Phrases::Phrase* phrase = unlabeled_phrases[i]; 
+//one sweep over the phrases in active_set; returns the total L1 change in their label distributions
+//and replaces active_set with the worklist for the next iteration. with a region, only phrases in it are activated
+double Graph::labelProp(Phrases* src_phrases, vector<unsigned int>& active_set, const double tolerance, const unordered_set<unsigned int>* region){
+  double residual = 0.0; 
+  worklist.start(active_set, sim_mat.rows()); 
+  ProgressReporter progress("labelProp", active_set.size(), "phrases"); 
+  unsigned int phrID; 
+  while (worklist.next(phrID)){ //in ascending ID order
+    progress.add(1); 
+    Phrases::Phrase* phrase = src_phrases->getNthPhrase(phrID); 
     if (sim_mat.row(phrase->id).nonZeros() > 1){ //check if phrase has neighbors
       set<int> phraseLabelsIdx = phrase->getLabels(); 
       map<int,double> newLabelDistr = map<int,double>(); 
@@ -253,24 +653,212 @@ void Graph::labelProp(Phrases* src_phrases){
 	}
       } //looped through all neighbors; need to normalize new labels now and transfer to label_distribution
       if (newLabelDistr.size() > 0){
-	phrase->label_distribution.clear(); 
+	map<int,double> oldLabelDistr = map<int,double>(); 
+	oldLabelDistr.swap(phrase->label_distribution); 
 	phrase->label_distribution.insert(newLabelDistr.begin(), newLabelDistr.end()); 
 	phrase->normalizeDistribution(); 
+	const double row_residual = l1Distance(oldLabelDistr, phrase->label_distribution); 
+	residual += row_residual; 
+	if (!(row_residual <= tolerance)) //NaN distributions (from all-zero candidate scores) also count as changed
+	  progress.addTotal(activateNeighbors(src_phrases, phrase->id, true, region)); 
       }
     }
   }
+  worklist.finish(active_set); 
+  return residual; 
 }
 
-void Graph::structLabelProp(Phrases* src_phrases, void* tgt_graph, bool dynamic){  
-  DynamicGraph* dyn_graph = NULL; 
-  Graph* graph = NULL; 
-  if (dynamic)
-    dyn_graph = static_cast<DynamicGraph*>(tgt_graph); 
-  else
-    graph = static_cast<Graph*>(tgt_graph); 
+//LabelProp over the phrases x labels matrix Y (see loadLabelMatrix): one iteration is Y' = rownorm(mask(W*Y)), where
+//W is sim_mat without its diagonal and the mask keeps each row's own candidate labels. every row reads the previous
+//iteration's Y (Jacobi), so the masked product is computed row-parallel; labelProp updates in place in ID order, so
+//the two differ already within the first iteration. same contract as labelProp
+double Graph::labelPropSpMM(Phrases* src_phrases, vector<unsigned int>& active_set, const double tolerance, const unordered_set<unsigned int>* region){
+  assert(label_mat.rows() == sim_mat.rows()); //loaded by loadLabelMatrix
+  vector<char> written(active_set.size(), 0); 
+  vector<char> changed(active_set.size(), 0); 
+  double residual = 0.0; 
+  ProgressReporter progress("labelPropSpMM", active_set.size(), "phrases"); 
+  #pragma omp parallel for schedule(dynamic) reduction(+:residual)
+  for (unsigned int i = 0; i < active_set.size(); i++){
+    const int phrID = active_set[i]; 
+    progress.add(1); 
+    if (sim_mat.row(phrID).nonZeros() <= 1) //no neighbors
+      continue; 
+    const int slot = label_mat.outerIndexPtr()[phrID]; 
+    const int numOwnLabels = label_mat.innerNonZeroPtr()[phrID]; 
+    const int* ownLabels = label_mat.innerIndexPtr() + slot; 
+    const double* ownProbs = label_mat.valuePtr() + slot; 
+    vector<double> labelMass(numOwnLabels, 0.0); 
+    vector<bool> reached(numOwnLabels, false); //labels shared with at least one neighbor, even with zero mass
+    for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, phrID); it; ++it){
+      if (it.col() == phrID) //filtering for self-similarity
+	continue; 
+      SparseMatrix<double,RowMajor>::InnerIterator it_n(label_mat, it.col()); 
+      int k = 0; 
+      while (it_n && k < numOwnLabels){ //both label lists are sorted; only the masked entries of W*Y are computed
+	if (it_n.col() < ownLabels[k])
+	  ++it_n; 
+	else if (ownLabels[k] < it_n.col())
+	  k++; 
+	else {
+	  labelMass[k] += it_n.value()*it.value(); 
+	  reached[k] = true; 
+	  ++it_n; 
+	  k++; 
+	}
+      }
+    }
+    int* newLabels = label_next.innerIndexPtr() + slot; //same slot in both buffers; label sets only shrink
+    double* newProbs = label_next.valuePtr() + slot; 
+    int newLen = 0; 
+    double normalizer = 0.0; 
+    for (int k = 0; k < numOwnLabels; k++){
+      if (reached[k]){
+	newLabels[newLen] = ownLabels[k]; 
+	newProbs[newLen++] = labelMass[k]; 
+	normalizer += labelMass[k]; 
+      }
+    }
+    if (newLen == 0) //keep the current distribution
+      continue; 
+    for (int q = 0; q < newLen; q++)
+      newProbs[q] /= normalizer; 
+    label_next.innerNonZeroPtr()[phrID] = newLen; 
+    written[i] = 1; 
+    double row_residual = 0.0; //L1 distance, as l1Distance
+    int l = 0, r = 0; 
+    while (l < numOwnLabels || r < newLen){
+      if (r == newLen || (l < numOwnLabels && ownLabels[l] < newLabels[r]))
+	row_residual += fabs(ownProbs[l++]); 
+      else if (l == numOwnLabels || newLabels[r] < ownLabels[l])
+	row_residual += fabs(newProbs[r++]); 
+      else
+	row_residual += fabs(ownProbs[l++] - newProbs[r++]); 
+    }
+    residual += row_residual; 
+    changed[i] = !(row_residual <= tolerance); 
+  }
+  worklist.start(vector<unsigned int>(), sim_mat.rows()); 
+  for (unsigned int i = 0; i < active_set.size(); i++){
+    if (written[i]){ //the new rows become current; all other rows are the same in both buffers
+      const int phrID = active_set[i]; 
+      const int slot = label_mat.outerIndexPtr()[phrID], len = label_next.innerNonZeroPtr()[phrID]; 
+      copy(label_next.innerIndexPtr() + slot, label_next.innerIndexPtr() + slot + len, label_mat.innerIndexPtr() + slot); 
+      copy(label_next.valuePtr() + slot, label_next.valuePtr() + slot + len, label_mat.valuePtr() + slot); 
+      label_mat.innerNonZeroPtr()[phrID] = len; 
+    }
+    if (changed[i]) //no in-place updates, so all revisits happen in the next iteration
+      activateNeighbors(src_phrases, active_set[i], false, region); 
+  }
+  worklist.finish(active_set); 
+  return residual; 
+}
+
+//moves the label distributions into Y for labelPropSpMM, once before the first iteration: two row-major buffers, the
+//current distributions and the rows written by an iteration, in which every phrase keeps the slot of its initial
+//candidates (uncompressed storage, so rows can shrink in place). the unlabeled phrases' maps are emptied until
+//copyDistributions, as in PartitionedLabelProp
+void Graph::loadLabelMatrix(Phrases* src_phrases){
+  label_mat = labelMatrix(src_phrases); 
+  label_next = labelMatrix(src_phrases); 
+  label_mat.reserve(VectorXi::Zero(label_mat.rows())); //uncompressed, with the same layout
+  label_next.reserve(VectorXi::Zero(label_next.rows())); 
+  for (int i = 0; i < sim_mat.rows(); i++){
+    Phrases::Phrase* phrase = src_phrases->getNthPhrase(i); 
+    if (!phrase->isLabeled())
+      map<int,double>().swap(phrase->label_distribution); 
+  }
+}
+
+//writes the current distributions in Y back to the unlabeled phrases (e.g., for a checkpoint, or after propagation)
+void Graph::copyDistributions(Phrases* src_phrases){
+  for (int i = 0; i < label_mat.rows(); i++){
+    Phrases::Phrase* phrase = src_phrases->getNthPhrase(i); 
+    if (phrase->isLabeled())
+      continue; 
+    phrase->label_distribution.clear(); 
+    for (SparseMatrix<double,RowMajor>::InnerIterator it(label_mat, i); it; ++it)
+      phrase->label_distribution.insert(phrase->label_distribution.end(), make_pair((int) it.col(), it.value())); 
+  }
+}
+
+void Graph::releaseLabelMatrix(){
+  label_mat = SparseMatrix<double,RowMajor>(); 
+  label_next = SparseMatrix<double,RowMajor>(); 
+}
+
+//the (own label, neighbor label) pairs structLabelProp looks up in the target graph: label sets only shrink during 
+//propagation, so these are the current candidates of each unlabeled phrase against the labels of its neighbors
+vector<pair<int,int> > Graph::getCoCandidatePairs(Phrases* src_phrases){
   vector<Phrases::Phrase*> unlabeled_phrases = src_phrases->getUnlabeledPhrases(); 
-  for (unsigned int i = 0; i < unlabeled_phrases.size(); i++){ //loop through unlabeled phrases and update
-    Phrases::Phrase* phrase = unlabeled_phrases[i]; 
+  vector<pair<int,int> > pairs = vector<pair<int,int> >(); 
+  #pragma omp parallel
+  {
+    vector<pair<int,int> > thread_pairs = vector<pair<int,int> >(); 
+    unsigned int dedup_size = 1 << 22; 
+    #pragma omp for schedule(dynamic) nowait
+    for (unsigned int i = 0; i < unlabeled_phrases.size(); i++){
+      const map<int,double>& own_labels = unlabeled_phrases[i]->label_distribution; 
+      for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, unlabeled_phrases[i]->id); it; ++it){
+	if (it.col() == unlabeled_phrases[i]->id) //filtering for self-similarity
+	  continue; 
+	const map<int,double>& neighbor_labels = src_phrases->getNthPhrase(it.col())->label_distribution; 
+	for (map<int,double>::const_iterator it_j = own_labels.begin(); it_j != own_labels.end(); it_j++){
+	  for (map<int,double>::const_iterator it_i = neighbor_labels.begin(); it_i != neighbor_labels.end(); it_i++)
+	    thread_pairs.push_back(make_pair(it_j->first, it_i->first)); 
+	}
+      }
+      if (thread_pairs.size() > dedup_size){ //keep per-thread buffers bounded
+	sort(thread_pairs.begin(), thread_pairs.end()); 
+	thread_pairs.erase(unique(thread_pairs.begin(), thread_pairs.end()), thread_pairs.end()); 
+	dedup_size = max(dedup_size, 2 * (unsigned int) thread_pairs.size()); 
+      }
+    }
+    sort(thread_pairs.begin(), thread_pairs.end()); 
+    thread_pairs.erase(unique(thread_pairs.begin(), thread_pairs.end()), thread_pairs.end()); 
+    #pragma omp critical(mergeCoCandidatePairs)
+    {
+      const unsigned int mid = pairs.size(); 
+      pairs.insert(pairs.end(), thread_pairs.begin(), thread_pairs.end()); 
+      inplace_merge(pairs.begin(), pairs.begin() + mid, pairs.end()); 
+      pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end()); 
+    }
+  }
+  return pairs; 
+}
+
+//current label distributions as a row-major phrases x labels matrix; explicit zeros are kept since they
+//still mark a label as a candidate
+SparseMatrix<double,RowMajor> Graph::labelMatrix(Phrases* src_phrases){
+  unsigned int nnz = 0; 
+  int numLabels = 0; 
+  for (int i = 0; i < sim_mat.rows(); i++){
+    const map<int,double>& distr = src_phrases->getNthPhrase(i)->label_distribution; 
+    nnz += distr.size(); 
+    if (distr.size() > 0)
+      numLabels = max(numLabels, distr.rbegin()->first + 1); 
+  }
+  SparseMatrix<double,RowMajor> label_mat(sim_mat.rows(), numLabels); 
+  label_mat.reserve(nnz); 
+  for (int i = 0; i < sim_mat.rows(); i++){
+    label_mat.startVec(i); 
+    const map<int,double>& distr = src_phrases->getNthPhrase(i)->label_distribution; 
+    for (map<int,double>::const_iterator it = distr.begin(); it != distr.end(); it++)
+      label_mat.insertBack(i, it->first) = it->second; 
+  }
+  label_mat.finalize(); 
+  return label_mat; 
+}
+
+//same contract as labelProp
+double Graph::structLabelProp(Phrases* src_phrases, TargetSimilarity* tgt_sim, vector<unsigned int>& active_set, const double tolerance, const unordered_set<unsigned int>* region){  
+  double residual = 0.0; 
+  worklist.start(active_set, sim_mat.rows()); 
+  ProgressReporter progress("structLabelProp", active_set.size(), "phrases"); 
+  unsigned int phrID; 
+  while (worklist.next(phrID)){ //loop through active unlabeled phrases, in ascending ID order, and update
+    progress.add(1); 
+    Phrases::Phrase* phrase = src_phrases->getNthPhrase(phrID); 
     if (sim_mat.row(phrase->id).nonZeros() > 1){ //check if phrase has neighbors
       set<int> phraseLabelsIdx = phrase->getLabels(); 
       map<int,double> newLabelDistr = map<int,double>(); 
@@ -280,7 +868,7 @@ void Graph::structLabelProp(Phrases* src_phrases, void* tgt_graph, bool dynamic)
 	  set<int> neighborLabelsIdx = neighbor->getLabels(); 	  
 	  for (set<int>::iterator it_i = neighborLabelsIdx.begin(); it_i != neighborLabelsIdx.end(); it_i++){ //instead of computing set intersection, we loop through all neighbor labels
 	    for (set<int>::iterator it_j = phraseLabelsIdx.begin(); it_j != phraseLabelsIdx.end(); it_j++){ //loop through own labels
-	      double label_prob = (dynamic) ? neighbor->label_distribution[*it_i]*sim_mat.coeff(phrase->id, neighbor->id)*dyn_graph->getSimilarity(*it_j, *it_i) : neighbor->label_distribution[*it_i]*sim_mat.coeff(phrase->id, neighbor->id)*graph->getSimilarity(*it_j, *it_i); 
+	      double label_prob = neighbor->label_distribution[*it_i]*sim_mat.coeff(phrase->id, neighbor->id)*tgt_sim->getSimilarity(*it_j, *it_i); 
 	      /*if (label_prob == 0){
 		cout << "Zero prob. during label propagation; source phrase is '" << phrase->phrase_str << "'" << endl; 
 		cout << "Candidate target phrases are '" << src_phrases->getLabelPhraseStr(*it_j) << "' (ID: " << *it_j << ") and '" << src_phrases->getLabelPhraseStr(*it_i) << "' (ID: " << *it_i << ")" << endl; 
@@ -294,12 +882,157 @@ void Graph::structLabelProp(Phrases* src_phrases, void* tgt_graph, bool dynamic)
 	} //for a given neighbor, updated all label probabilities in own label set over all labels of neighbor
       } //went through all neighbors
       if (newLabelDistr.size() > 0){
-	phrase->label_distribution.clear(); 
+	map<int,double> oldLabelDistr = map<int,double>(); 
+	oldLabelDistr.swap(phrase->label_distribution); 
 	phrase->label_distribution.insert(newLabelDistr.begin(), newLabelDistr.end()); 
 	//can we put an if condition on the insert above? 
 	//or, we loop through newLabelDistr and check if val is > 0 and if so, we add it
 	phrase->normalizeDistribution(); 
+	const double row_residual = l1Distance(oldLabelDistr, phrase->label_distribution); 
+	residual += row_residual; 
+	if (!(row_residual <= tolerance)) //NaN distributions (from all-zero candidate scores) also count as changed
+	  progress.addTotal(activateNeighbors(src_phrases, phrase->id, true, region)); 
       }
     }
   }      
+  worklist.finish(active_set); 
+  return residual; 
+}
+
+//a phrase whose distribution changed must be revisited, as must its unlabeled neighbors (sim_mat is symmetric, 
+//so these are exactly the phrases that read its distribution). with in-place updates in phrase ID order, neighbors
+//later in the current sweep are revisited in this sweep, and everything else in the next one
+unsigned int Graph::activateNeighbors(Phrases* src_phrases, const unsigned int phrID, const bool in_place, const unordered_set<unsigned int>* region){
+  unsigned int num_added = 0; 
+  worklist.addNext(phrID); 
+  for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, phrID); it; ++it){
+    const unsigned int neighborID = it.col(); 
+    if (neighborID != phrID && !src_phrases->getNthPhrase(neighborID)->isLabeled() && (region == NULL || region->count(neighborID) > 0)){
+      if (in_place && neighborID > phrID)
+	num_added += worklist.addNow(neighborID); 
+      else
+	worklist.addNext(neighborID); 
+    }
+  }
+  return num_added; 
+}
+
+//the unlabeled phrases at most hops edges away from the seeds; paths only go through unlabeled phrases, since the
+//distributions of labeled ones do not change
+unordered_set<unsigned int> Graph::neighborhood(Phrases* src_phrases, const vector<unsigned int>& seeds, const unsigned int hops){
+  unordered_set<unsigned int> region = unordered_set<unsigned int>(); 
+  vector<unsigned int> frontier = vector<unsigned int>(); 
+  for (unsigned int i = 0; i < seeds.size(); i++){
+    if (!src_phrases->getNthPhrase(seeds[i])->isLabeled() && region.insert(seeds[i]).second)
+      frontier.push_back(seeds[i]); 
+  }
+  for (unsigned int h = 0; h < hops && frontier.size() > 0; h++){
+    vector<unsigned int> next_frontier = vector<unsigned int>(); 
+    for (unsigned int i = 0; i < frontier.size(); i++){
+      for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, frontier[i]); it; ++it){
+	if (!src_phrases->getNthPhrase(it.col())->isLabeled() && region.insert(it.col()).second)
+	  next_frontier.push_back(it.col()); 
+      }
+    }
+    frontier.swap(next_frontier); 
+  }
+  return region; 
+}
+
+//propagation from a seed set, e.g., phrases that were just inserted into the graph or whose candidates changed: sweeps
+//start at the seeds, and only the unlabeled phrases up to hops edges away from them are activated when a neighbor
+//changes, so the other distributions are left as they are and the cost depends on the neighborhood rather than on the
+//graph. runs StructLabelProp if target similarities are given, and LabelProp otherwise; returns the last sweep's residual
+double Graph::propagateLocally(Phrases* src_phrases, const vector<unsigned int>& seeds, const unsigned int hops, const int iterations, const double tolerance, TargetSimilarity* tgt_sim){
+  const unordered_set<unsigned int> region = neighborhood(src_phrases, seeds, hops); 
+  vector<unsigned int> active_set = vector<unsigned int>(); 
+  for (unsigned int i = 0; i < seeds.size(); i++){
+    if (region.count(seeds[i]) > 0)
+      active_set.push_back(seeds[i]); 
+  }
+  double residual = 0.0; 
+  long updates = 0; 
+  int sweeps = 0; 
+  while (sweeps < iterations && active_set.size() > 0){
+    updates += active_set.size(); 
+    sweeps++; 
+    if (tgt_sim != NULL)
+      residual = structLabelProp(src_phrases, tgt_sim, active_set, tolerance, &region); 
+    else
+      residual = labelProp(src_phrases, active_set, tolerance, &region); 
+    if (residual < tolerance)
+      break; 
+  }
+  Metrics::addCount("local_phrase_updates", updates); 
+  cout << "Propagated from " << seeds.size() << " phrases over " << region.size() << " unlabeled phrases within " << hops << " hops; " << sweeps << " sweeps, L1 residual: " << residual << endl; 
+  return residual; 
+}
+
+//sweeps visit the lowest ID left in the heap, so phrases activated during a sweep with higher IDs than the current
+//one are visited in it. the membership flags are sized to the graph once and cleared through the phrases that were
+//set, so that a sweep takes time in the number of phrases it visits
+void Worklist::start(const vector<unsigned int>& active_set, const unsigned int num_points){
+  if (in_now.size() < num_points){
+    in_now.resize(num_points, false); 
+    in_next.resize(num_points, false); 
+  }
+  for (unsigned int i = 0; i < active_set.size(); i++)
+    addNow(active_set[i]); 
+}
+
+bool Worklist::next(unsigned int& phrID){
+  if (now.empty())
+    return false; 
+  phrID = now.top(); 
+  now.pop(); 
+  return true; 
+}
+
+bool Worklist::addNow(const unsigned int phrID){
+  if (in_now[phrID])
+    return false; 
+  in_now[phrID] = true; 
+  now.push(phrID); 
+  visited.push_back(phrID); 
+  return true; 
+}
+
+void Worklist::addNext(const unsigned int phrID){
+  if (!in_next[phrID]){
+    in_next[phrID] = true; 
+    next_ids.push_back(phrID); 
+  }
+}
+
+void Worklist::finish(vector<unsigned int>& active_set){
+  for (unsigned int i = 0; i < visited.size(); i++)
+    in_now[visited[i]] = false; 
+  for (unsigned int i = 0; i < next_ids.size(); i++)
+    in_next[next_ids[i]] = false; 
+  visited.clear(); 
+  sort(next_ids.begin(), next_ids.end()); 
+  active_set.swap(next_ids); 
+  next_ids.clear(); 
+}
+
+//L1 distance between two sparse label distributions
+double Graph::l1Distance(const map<int,double>& lhs, const map<int,double>& rhs){
+  double distance = 0.0; 
+  map<int,double>::const_iterator it_l = lhs.begin(), it_r = rhs.begin(); 
+  while (it_l != lhs.end() || it_r != rhs.end()){
+    if (it_r == rhs.end() || (it_l != lhs.end() && it_l->first < it_r->first)){
+      distance += fabs(it_l->second); 
+      it_l++; 
+    }
+    else if (it_l == lhs.end() || it_r->first < it_l->first){
+      distance += fabs(it_r->second); 
+      it_r++; 
+    }
+    else {
+      distance += fabs(it_l->second - it_r->second); 
+      it_l++; 
+      it_r++; 
+    }
+  }
+  return distance; 
 }
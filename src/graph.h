@@ -2,6 +2,10 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <queue>
+#include <functional>
+#include <unordered_set>
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 #include <unsupported/Eigen/SparseExtra>
@@ -12,34 +16,100 @@ using namespace std;
 using namespace Eigen;
 typedef Triplet<double> triplet;
 
-class Graph{
+//the phrases of one propagation sweep and of the next one (see Graph::activateNeighbors)
+class Worklist {
  public:
-  Graph(FeatureExtractor* features, const unsigned int k);
+  void start(const vector<unsigned int>& active_set, const unsigned int num_points); 
+  bool next(unsigned int& phrID); //the lowest ID left in this sweep; false at the end of it
+  bool addNow(const unsigned int phrID); //false if the phrase was already in this sweep
+  void addNext(const unsigned int phrID); 
+  void finish(vector<unsigned int>& active_set); //the next sweep's phrases, in ascending ID order
+ private:
+  priority_queue<unsigned int, vector<unsigned int>, greater<unsigned int> > now; 
+  vector<unsigned int> visited; //added to this sweep
+  vector<unsigned int> next_ids; 
+  vector<bool> in_now, in_next; 
+}; 
+
+//similarities between target phrases (i.e., labels) for StructLabelProp: a target graph, a DynamicGraph over the
+//target feature matrix, or dense target phrase embeddings (see embeddings.h)
+class TargetSimilarity {
+ public:
+  virtual ~TargetSimilarity(){}
+  virtual double getSimilarity(const int i, const int j) = 0; 
+  virtual map<string, long> memoryUsage(const string prefix) = 0; //estimated bytes, keyed by prefix + data structure
+  virtual void recordMetrics(){} //counters of the lookups so far
+}; 
+
+class Graph : public TargetSimilarity {
+ public:
+  Graph(FeatureExtractor* features, const unsigned int k, const vector<Phrases::Phrase*>& restrict_to=vector<Phrases::Phrase*>(), const bool keep_neighbors=false); //restrict_to: only store rows for these phrases; keep_neighbors: keep the kNN lists, for insertNodes
   explicit Graph(const string simMatLoc); 
   ~Graph();
-  void writeToFile(const string simMatLoc);
+  void writeToFile(const string simMatLoc, const string precision="double");
+  void writeDelta(const string deltaLoc, const string precision="double"); //the rows changed since the graph was built or read
+  void applyDelta(const string deltaLoc); 
   void analyzeSimilarityMatrix(const vector<Phrases::Phrase*> unlabeled_phrases); 
   void initLabelsWithLexScore(Phrases* src_phrases, const string mbest_processed_loc, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, set<int> stopWords=set<int>()); 
-  void labelProp(Phrases* src_phrases); 
-  void structLabelProp(Phrases* src_phrases, void* tgt_graph, bool dynamic_graph); //data is constant for tgt_graph, so we should put that
+  void initLabels(Phrases* src_phrases, const vector<Phrases::Phrase*>& phrases, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, const set<int>& stopWords); //only these phrases, without m-best candidates
+  void insertNodes(FeatureExtractor* features, const vector<double>& norms, const unsigned int first_new); //phrases appended to the features; needs the kNN lists
+  double labelProp(Phrases* src_phrases, vector<unsigned int>& active_set, const double tolerance, const unordered_set<unsigned int>* region=NULL); 
+  double labelPropSpMM(Phrases* src_phrases, vector<unsigned int>& active_set, const double tolerance, const unordered_set<unsigned int>* region=NULL); 
+  void loadLabelMatrix(Phrases* src_phrases); //before the first labelPropSpMM iteration
+  void copyDistributions(Phrases* src_phrases); //writes labelPropSpMM's current distributions back to the unlabeled phrases
+  void releaseLabelMatrix(); 
+  double structLabelProp(Phrases* src_phrases, TargetSimilarity* tgt_sim, vector<unsigned int>& active_set, const double tolerance, const unordered_set<unsigned int>* region=NULL); 
+  double propagateLocally(Phrases* src_phrases, const vector<unsigned int>& seeds, const unsigned int hops, const int iterations, const double tolerance, TargetSimilarity* tgt_sim=NULL); //only the unlabeled phrases within hops of the seeds
+  unordered_set<unsigned int> neighborhood(Phrases* src_phrases, const vector<unsigned int>& seeds, const unsigned int hops); 
   double getSimilarity(const int i, const int j){ return sim_mat.coeff(i, j); }
+  const SparseMatrix<double,RowMajor>& getSimilarityMatrix(){ return sim_mat; }
+  static void symmetrizeAndNormalize(vector<triplet>& triplets, const int num_points, SparseMatrix<double,RowMajor>& sim_mat); 
+  vector<pair<int,int> > getCoCandidatePairs(Phrases* src_phrases); 
+  map<string, long> memoryUsage(const string prefix); //estimated bytes, keyed by prefix + data structure
+  static long estimateConstructionBytes(const long num_points, const long feature_nnz, const unsigned int k); //peak of Graph(features, k), including the features
 
  private:
   SparseMatrix<double,RowMajor> sim_mat; 
   vector<triplet> sim_mat_triplets; 
-  map<int, double> generateCandidateTranslations(const string phrStr, const int phrID, Phrases* const src_phrases, const vector<string> mbest_candidates, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, set<int> stopWords=set<int>()); 
-  void filterCandidatesForStopWords(set<int>& labels, const set<int> stopWords); 
+  SparseMatrix<double,RowMajor> knn_mat; //directed kNN lists, with the self similarities, if kept
+  unsigned int num_neighbors; //k
+  vector<bool> changed_rows; //by insertNodes or applyDelta
+  static void mergeAndNormalize(vector<pair<int,double> >& row); 
+  vector<pair<unsigned int, double> > rankNeighbors(FeatureExtractor* features, const vector<double>& norms, const unsigned int i, bool& has_candidates); 
+  void addNearestNeighbors(FeatureExtractor* features, const unsigned int k, const vector<double>& norms, const vector<unsigned int>& rows, unsigned int& featureless_phrases, unsigned int& negative_similarities); 
+  unsigned int addCandidates(Phrases* src_phrases, const vector<Phrases::Phrase*>& phrases, const map<const string, vector<string> >& mbest_by_src, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, const set<int>& stopWords); 
+  map<int, double> generateCandidateTranslations(const string phrStr, const int phrID, Phrases* const src_phrases, const vector<string>& mbest_candidates, LexicalScorer* const lex, const int maxCand_size, const bool filter_sw, const set<int>& stopWords); 
+  vector<int> mergeLabelRanges(vector<pair<map<int,double>::const_iterator, map<int,double>::const_iterator> >& label_ranges); 
+  void filterCandidatesForStopWords(vector<int>& labels, const set<int>& stopWords); 
+  SparseMatrix<double,RowMajor> labelMatrix(Phrases* src_phrases); 
+  SparseMatrix<double,RowMajor> label_mat; //Y for labelPropSpMM, and the rows written by its current iteration
+  SparseMatrix<double,RowMajor> label_next; 
+  Worklist worklist; 
+  unsigned int activateNeighbors(Phrases* src_phrases, const unsigned int phrID, const bool in_place, const unordered_set<unsigned int>* region); //returns the number of phrases newly added to the current sweep
+  static double l1Distance(const map<int,double>& lhs, const map<int,double>& rhs); 
 };
 
-class DynamicGraph{
+class DynamicGraph : public TargetSimilarity {
  public:
   DynamicGraph(FeatureExtractor* features); 
   explicit DynamicGraph(const string dgLoc); 
   ~DynamicGraph();
   void writeToFile(const string dgLoc); 
+  void precomputeSimilarities(const vector<pair<int,int> >& pairs); 
   double getSimilarity(const int i, const int j); 
   int getCacheSize(){return cache.size(); } //for debugging
+  long getCacheHits(){ return cache_hits; } //lookups answered from the pair table or the cache
+  long getCacheMisses(){ return cache_misses; }
+  long getCacheEvictions(){ return cache_evictions; }
+  map<string, long> memoryUsage(const string prefix); 
+  void recordMetrics(); 
  private:
   map<string,double> cache; 
+  unsigned long max_cache_entries; //the cache is cleared when it would grow beyond this; 0 for no limit
+  long cache_hits; 
+  long cache_misses; 
+  long cache_evictions; 
   SparseMatrix<double,RowMajor> feat_mat; 
+  vector<double> norms; //feature row norms
+  SparseMatrix<double,RowMajor> pair_sims; //precomputed similarities, one row per label
 };
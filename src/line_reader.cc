@@ -0,0 +1,243 @@
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "line_reader.h"
+
+using namespace std; 
+const size_t READ_BUFFER_BYTES = 1 << 22; //per batch; grown for longer lines
+const size_t READ_BUFFER_ALIGNMENT = 4096; //page-aligned, for the kernel's copies
+const size_t GZIP_INPUT_BYTES = 1 << 20; 
+const unsigned int NUM_BATCHES = 3; //one being parsed, one queued, and one being filled
+
+static char* alignedAlloc(const size_t bytes){
+  void* ptr = NULL; 
+  if (posix_memalign(&ptr, READ_BUFFER_ALIGNMENT, bytes) != 0){ cerr << "Could not allocate read buffer of " << bytes << " bytes" << endl; exit(0); }
+  return (char*) ptr; 
+}
+
+LineBatch::LineBatch(){
+  lines = vector<boost::string_ref>(); 
+  offset = 0, input_bytes = 0; 
+  data = NULL; 
+  capacity = 0, size = 0; 
+}
+
+LineBatch::~LineBatch(){
+  free(data); 
+}
+
+long LineBatch::endOffset(const unsigned int i) const {
+  const size_t end = lines[i].data() + lines[i].size() - data; 
+  return (end < size && data[end] == '\n') ? offset + end + 1 : -1; 
+}
+
+LineReader::LineReader(const string filename, const long offset) :
+  filename(filename) {
+  gzipped = filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0; 
+  compressed = NULL; 
+  inflater_done = false; 
+  input_bytes = 0; 
+  start_offset = offset; 
+  current = NULL; 
+  line_idx = 0; 
+  finished = false, stopped = false; 
+  fd = open(filename.c_str(), O_RDONLY); 
+  if (fd < 0)
+    return; 
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); //more read-ahead
+#endif
+  if (gzipped){
+    memset(&inflater, 0, sizeof(inflater)); 
+    if (inflateInit2(&inflater, 16 + MAX_WBITS) != Z_OK){ cerr << "Could not initialize gzip decompression for " << filename << endl; exit(0); }
+    compressed = alignedAlloc(GZIP_INPUT_BYTES); 
+  }
+  else if (offset > 0){
+    lseek(fd, offset, SEEK_SET); 
+    input_bytes = offset; 
+  }
+  for (unsigned int i = 0; i < NUM_BATCHES; i++){
+    LineBatch* batch = new LineBatch(); 
+    batch->data = alignedAlloc(READ_BUFFER_BYTES); 
+    batch->capacity = READ_BUFFER_BYTES; 
+    batches.push_back(batch); 
+    free_batches.push_back(batch); 
+  }
+  reader = thread(&LineReader::run, this); 
+}
+
+LineReader::~LineReader(){
+  {
+    lock_guard<mutex> guard(lock); 
+    stopped = true; 
+  }
+  free_cv.notify_one(); 
+  if (reader.joinable())
+    reader.join(); 
+  for (unsigned int i = 0; i < batches.size(); i++)
+    delete batches[i]; 
+  if (gzipped && fd >= 0)
+    inflateEnd(&inflater); 
+  free(compressed); 
+  if (fd >= 0)
+    close(fd); 
+}
+
+//hands the previous batch back to the background thread and waits for the next one
+const LineBatch* LineReader::next(){
+  unique_lock<mutex> guard(lock); 
+  if (current != NULL){
+    free_batches.push_back(current); 
+    current = NULL; 
+    free_cv.notify_one(); 
+  }
+  filled_cv.wait(guard, [this]{ return !filled_batches.empty() || finished; }); 
+  if (filled_batches.empty())
+    return NULL; 
+  current = filled_batches.front(); 
+  filled_batches.pop(); 
+  line_idx = 0; 
+  return current; 
+}
+
+bool LineReader::getline(string& line){
+  while (current == NULL || line_idx >= current->lines.size()){
+    if (next() == NULL)
+      return false; 
+  }
+  line.assign(current->lines[line_idx].data(), current->lines[line_idx].size()); 
+  line_idx++; 
+  return true; 
+}
+
+void LineReader::run(){
+  if (gzipped && start_offset > 0)
+    skip(start_offset); 
+  string carry = ""; //the start of a line cut off at the end of the previous batch
+  long offset = start_offset; 
+  bool more = true; 
+  while (more){
+    LineBatch* batch = NULL; 
+    {
+      unique_lock<mutex> guard(lock); 
+      free_cv.wait(guard, [this]{ return !free_batches.empty() || stopped; }); 
+      if (stopped)
+	return; 
+      batch = free_batches.back(); 
+      free_batches.pop_back(); 
+    }
+    fill(batch, carry, offset); 
+    more = (batch->size > 0); 
+    {
+      lock_guard<mutex> guard(lock); 
+      if (more)
+	filled_batches.push(batch); 
+      else {
+	free_batches.push_back(batch); 
+	finished = true; 
+      }
+    }
+    filled_cv.notify_one(); 
+  }
+}
+
+//reads until the buffer is full (growing it if it does not contain a whole line) or the file ends, and cuts the
+//buffer after its last newline. the rest is carried over to the next batch; a batch of size 0 marks the end
+void LineReader::fill(LineBatch* batch, string& carry, long& offset){
+  batch->lines.clear(); 
+  batch->offset = offset; 
+  if (carry.size() >= batch->capacity){ //the rest of a line that outgrew the previous batch, with room to read more
+    size_t capacity = batch->capacity; 
+    while (capacity <= carry.size())
+      capacity *= 2; 
+    free(batch->data); 
+    batch->data = alignedAlloc(capacity); 
+    batch->capacity = capacity; 
+  }
+  memcpy(batch->data, carry.data(), carry.size()); 
+  size_t filled = carry.size(); 
+  bool eof = false; 
+  size_t end = 0; 
+  while (true){
+    while (filled < batch->capacity && !eof){
+      const size_t num_read = read(batch->data + filled, batch->capacity - filled); 
+      eof = (num_read == 0); 
+      filled += num_read; 
+    }
+    for (end = filled; end > 0 && batch->data[end - 1] != '\n'; end--); 
+    if (end > 0 || eof)
+      break; 
+    char* grown = alignedAlloc(2 * batch->capacity); //a line longer than the buffer
+    memcpy(grown, batch->data, filled); 
+    free(batch->data); 
+    batch->data = grown; 
+    batch->capacity *= 2; 
+  }
+  if (eof) //including an unterminated last line
+    end = filled; 
+  carry.assign(batch->data + end, filled - end); 
+  batch->size = end; 
+  for (size_t start = 0; start < end;){
+    const char* newline = (const char*) memchr(batch->data + start, '\n', end - start); 
+    const size_t line_end = (newline != NULL) ? newline - batch->data : end; 
+    batch->lines.push_back(boost::string_ref(batch->data + start, line_end - start)); 
+    start = line_end + 1; 
+  }
+  offset += end; 
+  batch->input_bytes = input_bytes; 
+}
+
+//decompresses gzipped files, including files of several concatenated gzip members (e.g., from pigz or bgzip)
+size_t LineReader::read(char* buf, const size_t len){
+  if (!gzipped)
+    return readRaw(buf, len); 
+  inflater.next_out = (Bytef*) buf; 
+  inflater.avail_out = len; 
+  while (inflater.avail_out == len){
+    if (inflater.avail_in == 0){
+      const size_t num_read = readRaw(compressed, GZIP_INPUT_BYTES); 
+      if (num_read == 0){
+	if (!inflater_done && input_bytes > 0){ cerr << "Gzipped file " << filename << " ends unexpectedly" << endl; exit(0); }
+	return 0; 
+      }
+      inflater.next_in = (Bytef*) compressed; 
+      inflater.avail_in = num_read; 
+    }
+    if (inflater_done){
+      if (inflater.next_in[0] != 0x1f) //not another gzip member: trailing padding, which is ignored
+	return 0; 
+      inflateReset(&inflater); 
+      inflater_done = false; 
+    }
+    const int ret = inflate(&inflater, Z_NO_FLUSH); 
+    if (ret == Z_STREAM_END)
+      inflater_done = true; 
+    else if (ret != Z_OK){ cerr << "Could not decompress " << filename << ": " << ((inflater.msg != NULL) ? inflater.msg : "invalid data") << endl; exit(0); }
+  }
+  return len - inflater.avail_out; 
+}
+
+size_t LineReader::readRaw(char* buf, const size_t len){
+  ssize_t num_read = 0; 
+  do {
+    num_read = ::read(fd, buf, len); 
+  } while (num_read < 0 && errno == EINTR); 
+  if (num_read < 0){ cerr << "Could not read from " << filename << endl; exit(0); }
+  input_bytes += num_read; 
+  return num_read; 
+}
+
+//to start a gzipped file at an offset into its decompressed text
+void LineReader::skip(long bytes){
+  vector<char> buf(1 << 16); 
+  while (bytes > 0){
+    const size_t num_read = read(buf.data(), min((long) buf.size(), bytes)); 
+    if (num_read == 0)
+      break; 
+    bytes -= num_read; 
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <boost/utility/string_ref.hpp>
+#include <zlib.h>
+
+using namespace std; 
+
+//a batch of lines cut from a text file, as views into the batch's buffer (without the newlines). the views are valid
+//until the next call to LineReader::next()
+struct LineBatch {
+  vector<boost::string_ref> lines; 
+  long offset; //of the buffer's first byte in the (decompressed) text
+  long input_bytes; //of the file read when the batch was cut (compressed bytes for .gz files)
+  long endOffset(const unsigned int i) const; //just past line i's newline; -1 for a last line without one
+  LineBatch(); 
+  ~LineBatch(); 
+
+ private:
+  friend class LineReader; 
+  char* data; 
+  size_t capacity; 
+  size_t size; 
+}; 
+
+//reads a text file (gzipped if its name ends in .gz) on a background thread, which fills large page-aligned buffers,
+//cuts them at line boundaries, and queues them as batches while the caller parses the previous one. the file can be
+//started at an offset into its (decompressed) text, e.g., one taken from LineBatch::endOffset
+class LineReader {
+ public:
+  explicit LineReader(const string filename, const long offset=0); 
+  ~LineReader(); //stops the background thread, also if the file was not read to the end
+  bool is_open(){ return fd >= 0; }
+  const LineBatch* next(); //NULL at the end of the file
+  bool getline(string& line); //a line at a time, from the same batches; not to be mixed with next()
+
+ private:
+  void run(); 
+  void fill(LineBatch* batch, string& carry, long& offset); 
+  size_t read(char* buf, const size_t len); //0 at the end of the file
+  size_t readRaw(char* buf, const size_t len); 
+  void skip(long bytes); 
+  string filename; 
+  int fd; 
+  bool gzipped; 
+  z_stream inflater; 
+  char* compressed; 
+  bool inflater_done; //at the end of a gzip member
+  long input_bytes; 
+  long start_offset; 
+  vector<LineBatch*> batches; //all of them, for deletion
+  vector<LineBatch*> free_batches; 
+  queue<LineBatch*> filled_batches; 
+  LineBatch* current; //handed out to the caller
+  unsigned int line_idx; //next line of the current batch for getline
+  bool finished; //the background thread has queued the last batch
+  bool stopped; //the caller is done
+  mutex lock; 
+  condition_variable free_cv; 
+  condition_variable filled_cv; 
+  thread reader; 
+}; 
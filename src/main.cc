@@ -1,50 +1,404 @@
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <boost/program_options.hpp>
 #include <boost/program_options/variables_map.hpp>
-#include <time.h>
+#include <stdio.h>
 #include <omp.h>
 #include "options.h"
 #include "phrases.h"
 #include "featext.h"
 #include "graph.h"
 #include "lexical.h"
+#include "cache.h"
+#include "ooc_graph.h"
+#include "partitioned_prop.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "server.h"
+#include "embeddings.h"
 
 using namespace std;
 namespace po = boost::program_options;
-inline double duration(clock_t start, clock_t end) { return ((double)(end-start)) / ((double) CLOCKS_PER_SEC); }
+const string PHRASES_SNAPSHOT_EXT = ".phrases"; 
+
+map<string, long> mergeUsage(map<string, long> lhs, const map<string, long>& rhs){
+  lhs.insert(rhs.begin(), rhs.end()); 
+  return lhs; 
+}
+
+//fingerprint for feature extraction checkpoints on one side; NULL if checkpointing is disabled
+StageCache* extractionCheckpoint(po::variables_map& conf, const string side, const unsigned int minPL, const unsigned int maxPL){
+  if (conf["checkpoint_prefix"].as<string>() == "")
+    return NULL; 
+  StageCache* checkpoint = new StageCache(conf["checkpoint_prefix"].as<string>() + "." + side + ".extraction"); 
+  checkpoint->addFile(side + "_monolingual", conf[side + "_monolingual"].as<string>()); 
+  checkpoint->addFile(side + "_stopwords", conf[side + "_stopwords"].as<string>()); 
+  checkpoint->addFile("phrase_table", conf["phrase_table"].as<string>()); 
+  checkpoint->addFile("evaluation_corpus", conf["evaluation_corpus"].as<string>()); 
+  if (side == "target")
+    checkpoint->addFile("target_phraseIDs", conf["target_phraseIDs"].as<string>()); 
+  checkpoint->addValue("window_size", to_string(conf["window_size"].as<int>())); 
+  checkpoint->addValue("stop_list_size", to_string(conf["stop_list_size"].as<int>())); 
+  checkpoint->addValue("phrase_lengths", to_string(minPL) + "-" + to_string(maxPL)); 
+  return checkpoint; 
+}
+
+//feature extraction for one side ("source" or "target"); config keys are looked up with the side as prefix.
+//co-occurrence and feature matrices are only written out if their locations are defined.
+//phrase marginals are taken from the co-occurrence counts before they are rescaled to PMI.
+FeatureExtractor* extractFeatures(po::variables_map& conf, Phrases* phrases, const string side, const unsigned int minPL, const unsigned int maxPL){
+  cout << "Beginning " << side << "-side feature extraction" << endl; 
+  ScopedTimer extract_timer(side + ".extractFeatures"); 
+  FeatureExtractor* extractor = new FeatureExtractor(); 
+  extractor->readStopWords(conf[side + "_stopwords"].as<string>(), conf["stop_list_size"].as<int>()); 
+  StageCache* checkpoint = extractionCheckpoint(conf, side, minPL, maxPL); 
+  extractor->extractFeatures(phrases, conf[side + "_monolingual"].as<string>(), conf["window_size"].as<int>(), minPL, maxPL, checkpoint, conf["checkpoint_interval_lines"].as<int>()); 
+  delete checkpoint; 
+  if (conf["minimum_feature_count"].as<int>() > 1)
+    extractor->pruneFeaturesByCount(conf["minimum_feature_count"].as<int>()); 
+  if (conf.count("analyze_feature_matrix"))
+    extractor->analyzeFeatureMatrix(phrases->getUnlabeledPhrases()); 
+  phrases->setMarginals(extractor->getCoocRowSums()); 
+  cout << "Time taken: " << extract_timer.stop() << " seconds" << endl; 
+  const string cooc_loc = conf[side + "_cooc_matrix"].as<string>(); 
+  if (cooc_loc != ""){
+    ScopedTimer timer(side + ".writeCoocToFile"); 
+    extractor->writeCoocToFile(cooc_loc); 
+    cout << "Time taken to write out co-oc file: " << timer.stop() << " seconds" << endl; 
+  }
+  ScopedTimer pmi_timer(side + ".rescaleCoocToPMI"); 
+  extractor->rescaleCoocToPMI(); 
+  Metrics::addCount("feature_matrix_nonzeros", extractor->getFeatureMatrix().nonZeros()); 
+  cout << "Time taken: " << pmi_timer.stop() << " seconds" << endl; 
+  Metrics::recordMemory(side + " feature extraction", extractor->memoryUsage()); 
+  const string featMat_loc = conf[side + "_feature_matrix"].as<string>(); 
+  const string invIdx_loc = conf[side + "_feature_extractor"].as<string>(); 
+  if (featMat_loc != "" && invIdx_loc != ""){
+    ScopedTimer timer(side + ".writeFeatureMatrix"); 
+    extractor->writeToFile(featMat_loc, invIdx_loc); 
+    cout << "Time taken to write out feature matrix: " << timer.stop() << " seconds" << endl; 
+  }
+  return extractor; 
+}
+
+//kNN graph construction for one side; the similarity matrix is only written out if its location is defined
+Graph* constructGraph(po::variables_map& conf, FeatureExtractor* features, Phrases* phrases, const string side){
+  cout << "Starting graph construction on " << side << " side" << endl; 
+  ScopedTimer construct_timer(side + ".constructGraph"); 
+  vector<Phrases::Phrase*> restrict_to = vector<Phrases::Phrase*>(); 
+  if (side == "source" && conf.count("restrict_graph_to_unlabeled"))
+    restrict_to = phrases->getUnlabeledPhrases(); 
+  string stage = conf["stage"].as<string>(); 
+  transform(stage.begin(), stage.end(), stage.begin(), ::tolower); 
+  const bool keep_neighbors = (side == "source" && stage == "serve"); //new phrases are inserted into the source graph
+  Graph* graph = new Graph(features, conf["k_nearest_neighbors"].as<int>(), restrict_to, keep_neighbors); 
+  if (conf.count("analyze_similarity_matrix"))
+    graph->analyzeSimilarityMatrix(phrases->getUnlabeledPhrases()); 
+  Metrics::addCount("similarity_matrix_nonzeros", graph->getSimilarityMatrix().nonZeros()); 
+  cout << "Time taken: " << construct_timer.stop() << " seconds" << endl; 
+  Metrics::recordMemory(side + " graph construction", mergeUsage(features->memoryUsage(), graph->memoryUsage(side + "_"))); 
+  const string simMat_loc = conf[side + "_similarity_matrix"].as<string>(); 
+  if (simMat_loc != ""){
+    ScopedTimer timer(side + ".writeSimilarityMatrix"); 
+    graph->writeToFile(simMat_loc, conf["similarity_matrix_precision"].as<string>()); 
+    cout << "Time taken for writing out matrix: " << timer.stop() << " seconds" << endl; 
+  }
+  return graph; 
+}
+
+//the same graph as constructGraph, but built block by block from the files on disk, with bounded memory
+void constructGraphOutOfCore(po::variables_map& conf, const string side){
+  cout << "Starting out-of-core graph construction on " << side << " side" << endl; 
+  ScopedTimer read_timer(side + ".readFeaturesOutOfCore"); 
+  const string simMat_loc = conf[side + "_similarity_matrix"].as<string>(); 
+  int shard = 0, num_shards = 1; 
+  if (conf.count("shard"))
+    sscanf(conf["shard"].as<string>().c_str(), "%d/%d", &shard, &num_shards); 
+  const string tmp_prefix = conf.count("shard") ? OutOfCoreGraph::shardLocation(simMat_loc, shard, num_shards) : simMat_loc; //shards may run side by side
+  OutOfCoreGraph* graph = new OutOfCoreGraph(tmp_prefix, conf["out_of_core_block_rows"].as<int>(), conf["out_of_core_buffer_entries"].as<int>(), conf["similarity_matrix_precision"].as<string>()); 
+  graph->readFeatures(conf[side + "_feature_matrix"].as<string>(), conf[side + "_feature_extractor"].as<string>()); 
+  cout << "Time taken to write out row and posting list files: " << read_timer.stop() << " seconds" << endl; 
+  ScopedTimer construct_timer(side + ".constructGraphOutOfCore"); 
+  if (conf.count("shard"))
+    graph->constructShard(conf["k_nearest_neighbors"].as<int>(), shard, num_shards, simMat_loc); 
+  else
+    graph->construct(conf["k_nearest_neighbors"].as<int>(), simMat_loc); 
+  cout << "Time taken: " << construct_timer.stop() << " seconds" << endl; 
+  delete graph; 
+}
+
+//final step of sharded graph construction: the partial graphs written by the --shard runs become the similarity matrix
+void mergeGraphShards(po::variables_map& conf, const string side){
+  const int num_shards = conf["merge_shards"].as<int>(); 
+  cout << "Merging " << num_shards << " graph shards on " << side << " side" << endl; 
+  ScopedTimer timer(side + ".mergeGraphShards"); 
+  const string simMat_loc = conf[side + "_similarity_matrix"].as<string>(); 
+  OutOfCoreGraph* graph = new OutOfCoreGraph(simMat_loc, conf["out_of_core_block_rows"].as<int>(), conf["out_of_core_buffer_entries"].as<int>(), conf["similarity_matrix_precision"].as<string>()); 
+  graph->mergeShards(num_shards, simMat_loc); 
+  cout << "Time taken: " << timer.stop() << " seconds" << endl; 
+  delete graph; 
+}
+
+//with a memory budget, whether Graph(features, k) would fit in it; otherwise the graph is built out-of-core (which 
+//cannot restrict or analyze the graph, so graphs with those options are always built in memory)
+bool fitsInMemoryBudget(po::variables_map& conf, const string side){
+  long rows = 0, cols = 0, nnz = 0; 
+  if (Metrics::getMemoryBudget() == 0 || conf.count("analyze_similarity_matrix") || (side == "source" && conf.count("restrict_graph_to_unlabeled")))
+    return true; 
+  if (!OutOfCoreGraph::readDimensions(conf[side + "_feature_matrix"].as<string>(), rows, cols, nnz))
+    return true; 
+  const long estimate = Graph::estimateConstructionBytes(rows, nnz, conf["k_nearest_neighbors"].as<int>()); 
+  if (estimate <= Metrics::getMemoryBudget())
+    return true; 
+  cout << "In-memory graph construction on " << side << " side needs an estimated " << estimate / (1024.0 * 1024.0) << " MB, over the memory budget; building the graph out-of-core" << endl; 
+  return false; 
+}
+
+DynamicGraph* constructDynamicGraph(po::variables_map& conf, FeatureExtractor* features){
+  cout << "Starting dynamic graph construction on target side" << endl; 
+  ScopedTimer construct_timer("target.constructDynamicGraph"); 
+  DynamicGraph* graph = new DynamicGraph(features); 
+  cout << "Time taken: " << construct_timer.stop() << " seconds" << endl; 
+  const string simMat_loc = conf["target_similarity_matrix"].as<string>(); 
+  if (simMat_loc != ""){
+    ScopedTimer timer("target.writeDynamicGraph"); 
+    graph->writeToFile(simMat_loc); 
+    cout << "Time taken for writing out matrix: " << timer.stop() << " seconds" << endl; 
+  }
+  return graph; 
+}
+
+//with 'target_embeddings_text', the text embeddings are converted to the binary format at 'target_embeddings' first
+EmbeddingSimilarity* readTargetEmbeddings(po::variables_map& conf, Phrases* tgt_phrases){
+  const string emb_loc = conf["target_embeddings"].as<string>(); 
+  if (conf["target_embeddings_text"].as<string>() != ""){
+    ScopedTimer timer("target.convertEmbeddings"); 
+    EmbeddingSimilarity::convert(conf["target_embeddings_text"].as<string>(), emb_loc, tgt_phrases); 
+    cout << "Time taken to convert target embeddings: " << timer.stop() << " seconds" << endl; 
+  }
+  return new EmbeddingSimilarity(emb_loc); 
+}
+
+map<string, long> propagationMemoryUsage(Phrases* src_phrases, Graph* src_graph, TargetSimilarity* tgt_sim){
+  map<string, long> bytes = mergeUsage(src_phrases->memoryUsage("source_"), src_graph->memoryUsage("source_")); 
+  if (tgt_sim != NULL)
+    bytes = mergeUsage(bytes, tgt_sim->memoryUsage("target_")); 
+  return bytes; 
+}
+
+//fingerprint for graph propagation checkpoints; NULL if checkpointing is disabled. the graphs are fingerprinted through 
+//their files, or, in the Pipeline and Serve stages, through the inputs they are built from
+StageCache* propagationCheckpoint(po::variables_map& conf){
+  if (conf["checkpoint_prefix"].as<string>() == "")
+    return NULL; 
+  StageCache* checkpoint = new StageCache(conf["checkpoint_prefix"].as<string>() + ".propagation"); 
+  const char* files[] = {"phrase_table", "evaluation_corpus", "target_phraseIDs", "mbest_processed_location", "lexical_model_location", "target_stopwords", "source_similarity_matrix", "target_similarity_matrix", "target_embeddings"}; 
+  for (unsigned int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    checkpoint->addFile(files[i], conf[files[i]].as<string>()); 
+  string stage = conf["stage"].as<string>(); 
+  transform(stage.begin(), stage.end(), stage.begin(), ::tolower); 
+  if (stage == "pipeline" || stage == "serve"){
+    checkpoint->addFile("source_monolingual", conf["source_monolingual"].as<string>()); 
+    checkpoint->addFile("target_monolingual", conf["target_monolingual"].as<string>()); 
+    checkpoint->addFile("source_stopwords", conf["source_stopwords"].as<string>()); 
+    checkpoint->addValue("window_size", to_string(conf["window_size"].as<int>())); 
+    checkpoint->addValue("k_nearest_neighbors", to_string(conf["k_nearest_neighbors"].as<int>())); 
+    checkpoint->addValue("restrict_graph_to_unlabeled", conf.count("restrict_graph_to_unlabeled") ? "true" : "false"); 
+  }
+  checkpoint->addValue("stage", stage); 
+  checkpoint->addValue("graph_propagation_algorithm", conf["graph_propagation_algorithm"].as<string>()); 
+  checkpoint->addValue("dynamic_similarity_matrix", conf.count("dynamic_similarity_matrix") ? "true" : "false"); 
+  checkpoint->addValue("maximum_candidate_size", to_string(conf["maximum_candidate_size"].as<int>())); 
+  checkpoint->addValue("filter_stop_words", conf.count("filter_stop_words") ? "true" : "false"); 
+  checkpoint->addValue("stop_list_size", to_string(conf["stop_list_size"].as<int>())); 
+  checkpoint->addValue("propagation_tolerance", to_string(conf["propagation_tolerance"].as<double>())); 
+  return checkpoint; 
+}
+
+//candidate initialization, propagation, and phrase table output; marginals must already be set on both sides. 
+//with checkpointing, the label distributions are written after every iteration, and a valid checkpoint is resumed 
+//from instead of initializing the candidates
+void propagateGraph(po::variables_map& conf, Phrases* src_phrases, Phrases* tgt_phrases, Graph* src_graph, TargetSimilarity* tgt_sim, LexicalScorer* const lex){
+  StageCache* checkpoint = propagationCheckpoint(conf); 
+  CheckpointWriter writer(checkpoint); 
+  PropagationState state = PropagationState(); 
+  const bool resumed = CheckpointWriter::canResume(checkpoint) && state.read(checkpoint->getOutput()); 
+  if (resumed){
+    state.restore(src_phrases); 
+    cout << "Resuming graph propagation from checkpoint after iteration " << state.iterations - 1 << endl; 
+  }
+  else {
+    set<int> labelStopPhrases; 
+    if (conf.count("filter_stop_words"))
+      labelStopPhrases = FeatureExtractor::readStopWordsAsPhrases(conf["target_stopwords"].as<string>(), conf["stop_list_size"].as<int>(), tgt_phrases); 
+    ScopedTimer init_timer("initLabelsWithLexScore"); 
+    src_graph->initLabelsWithLexScore(src_phrases, conf["mbest_processed_location"].as<string>(), lex, conf["maximum_candidate_size"].as<int>(), conf.count("filter_stop_words"), labelStopPhrases); 
+    cout << "Time taken to initialize unlabeled phrases' candidates: " << init_timer.stop() << " seconds" << endl; 
+  }
+  Metrics::recordMemory("initLabelsWithLexScore", propagationMemoryUsage(src_phrases, src_graph, tgt_sim)); 
+  DynamicGraph* dyn_graph = dynamic_cast<DynamicGraph*>(tgt_sim); 
+  if (dyn_graph != NULL && conf.count("precompute_target_similarities")){
+    ScopedTimer timer("precomputeSimilarities"); 
+    vector<pair<int,int> > pairs = src_graph->getCoCandidatePairs(src_phrases); 
+    dyn_graph->precomputeSimilarities(pairs); 
+    cout << "Precomputed " << pairs.size() << " target phrase pair similarities; Time taken: " << timer.stop() << " seconds" << endl; 
+  }
+  cout << "Beginning graph propagation" << endl; 
+  ScopedTimer gp_timer("propagateGraph"); 
+  string algo = conf["graph_propagation_algorithm"].as<string>(); 
+  transform(algo.begin(), algo.end(), algo.begin(), ::tolower); 
+  if (algo == "structlabelprop" || algo == "labelprop" || algo == "labelpropspmm"){
+    const double tolerance = conf["propagation_tolerance"].as<double>(); 
+    vector<Phrases::Phrase*> unlabeled_phrases = src_phrases->getUnlabeledPhrases(); 
+    vector<unsigned int> active_set = vector<unsigned int>(); //phrases whose distributions may still change
+    for (unsigned int i = 0; i < unlabeled_phrases.size() && !resumed; i++)
+      active_set.push_back(unlabeled_phrases[i]->id); 
+    vector<double> residuals = vector<double>(); 
+    if (resumed){
+      active_set.swap(state.active_set); 
+      residuals.swap(state.residuals); 
+    }
+    const int num_processes = conf["propagation_processes"].as<int>(); 
+    PartitionedLabelProp* partitioned = (algo == "labelpropspmm" && num_processes > 1) ? new PartitionedLabelProp(src_graph, src_phrases, num_processes) : NULL; 
+    const bool spmm = (algo == "labelpropspmm" && partitioned == NULL); 
+    if (spmm)
+      src_graph->loadLabelMatrix(src_phrases); 
+    for (int i = (resumed) ? state.iterations : 0; i < conf["graph_propagation_iterations"].as<int>() && active_set.size() > 0 && !(resumed && state.converged); i++){
+      const unsigned int num_active = active_set.size(); 
+      ScopedTimer iteration_timer("propagateGraph.iteration" + to_string(i)); 
+      Metrics::addCount("phrase_updates", num_active); 
+      double residual = 0; 
+      if (algo == "structlabelprop")
+	residual = src_graph->structLabelProp(src_phrases, tgt_sim, active_set, tolerance); 
+      else if (partitioned != NULL)
+	residual = partitioned->labelProp(active_set, tolerance); 
+      else if (algo == "labelpropspmm")
+	residual = src_graph->labelPropSpMM(src_phrases, active_set, tolerance); 
+      else
+	residual = src_graph->labelProp(src_phrases, active_set, tolerance); 
+      residuals.push_back(residual); 
+      cout << "Graph Propagation iteration " << i << " complete; updated " << num_active << " phrases; L1 residual: " << residual << "; Time taken: " << iteration_timer.stop() << " seconds" << endl; 
+      if (checkpoint != NULL){ //the copy is taken now; it is written while the next iteration runs
+	if (partitioned != NULL)
+	  partitioned->copyDistributions(src_phrases); 
+	else if (spmm)
+	  src_graph->copyDistributions(src_phrases); 
+	shared_ptr<PropagationState> snapshot = make_shared<PropagationState>(PropagationState::capture(src_phrases, i + 1, residual < tolerance, active_set, residuals)); 
+	writer.write([snapshot](ostream& out){ snapshot->write(out); }); 
+      }
+      if (residual < tolerance){
+	cout << "L1 residual below tolerance " << tolerance << "; stopping propagation" << endl; 
+	break; 
+      }
+    }
+    if (partitioned != NULL){
+      partitioned->copyDistributions(src_phrases); 
+      delete partitioned; 
+    }
+    if (spmm){
+      src_graph->copyDistributions(src_phrases); 
+      src_graph->releaseLabelMatrix(); 
+    }
+    cout << "Residual curve:"; 
+    for (unsigned int i = 0; i < residuals.size(); i++)
+      cout << " " << residuals[i]; 
+    cout << endl; 
+  }
+  else
+    cerr << "Error: invalid option for graph propagation method.  Valid choices are 'LabelProp', 'LabelPropSpMM', and 'StructLabelProp'" << endl; 
+  Metrics::recordMemory("propagateGraph", propagationMemoryUsage(src_phrases, src_graph, tgt_sim)); 
+  if (tgt_sim != NULL)
+    tgt_sim->recordMetrics(); 
+  cout << "Graph propagation complete; Time taken: " << gp_timer.stop() << " seconds" << endl; 
+  ScopedTimer write_timer("writePhraseTable"); 
+  src_phrases->writePhraseTable(tgt_phrases, conf["phrase_table_format"].as<string>(), conf["expanded_phrase_table_loc"].as<string>(), lex); 
+  cout << "Expanded phrase table written to file; Time taken: " << write_timer.stop() << " seconds" << endl; 
+  if (checkpoint != NULL)
+    writer.remove(); 
+  delete checkpoint; 
+}
+
+//fingerprint for the phrases read in at the start of every stage; NULL if caching is disabled
+StageCache* phrasesCache(po::variables_map& conf){
+  if (!conf.count("use_cache") || conf["write_unlabeled"].as<string>() == "")
+    return NULL; 
+  StageCache* cache = new StageCache(conf["write_unlabeled"].as<string>() + PHRASES_SNAPSHOT_EXT); 
+  cache->addOutput(conf["write_unlabeled"].as<string>()); 
+  cache->addFile("phrase_table", conf["phrase_table"].as<string>()); 
+  cache->addFile("evaluation_corpus", conf["evaluation_corpus"].as<string>()); 
+  cache->addValue("phrase_table_format", conf["phrase_table_format"].as<string>()); 
+  cache->addValue("phrase_length", to_string(conf["phrase_length"].as<int>())); 
+  return cache; 
+}
+
+//fingerprint for graph construction on one side, kept next to that side's similarity matrix
+StageCache* graphCache(po::variables_map& conf, const string side){
+  StageCache* cache = new StageCache(conf[side + "_similarity_matrix"].as<string>()); 
+  cache->addFile(side + "_feature_matrix", conf[side + "_feature_matrix"].as<string>()); 
+  cache->addFile(side + "_feature_extractor", conf[side + "_feature_extractor"].as<string>()); 
+  cache->addValue("k_nearest_neighbors", to_string(conf["k_nearest_neighbors"].as<int>())); 
+  cache->addValue("dynamic_similarity_matrix", conf.count("dynamic_similarity_matrix") ? "true" : "false"); 
+  cache->addValue("similarity_matrix_precision", conf["similarity_matrix_precision"].as<string>()); 
+  cache->addValue("restrict_graph_to_unlabeled", (side == "source" && conf.count("restrict_graph_to_unlabeled")) ? "true" : "false"); 
+  return cache; 
+}
 
 int main(int argc, char** argv){  
-  cout << "Graph Propagation for Phrase Table Expansion" << endl; 
-  cout << "Avneesh Saluja (avneesh@cs.cmu.edu), 2014" << endl; 
   Options* opts = new Options(argc, argv); //reads in config file  
   po::variables_map conf = opts->getConf();
+  string stage = conf["stage"].as<string>();
+  transform(stage.begin(), stage.end(), stage.begin(), ::tolower);
+  streambuf* stdout_buf = cout.rdbuf(); 
+  if (stage == "serve" && conf["serve_socket"].as<string>() == "")
+    cout.rdbuf(cerr.rdbuf()); //stdout only carries the served phrase table entries
+  cout << "Graph Propagation for Phrase Table Expansion" << endl; 
+  cout << "Avneesh Saluja (avneesh@cs.cmu.edu), 2014" << endl; 
   unsigned int numThreads = conf["number_threads"].as<int>();
   omp_set_num_threads(numThreads); 
+  ProgressReporter::setInterval(conf["progress_interval"].as<double>()); 
+  Metrics::setMemoryBudget(conf["memory_budget"].as<double>()); 
   Phrases* src_phrases = new Phrases();
   int pl = conf["phrase_length"].as<int>();
-  cout << "Reading in phrase table" << endl; 
-  clock_t start = clock();  
-  src_phrases->addLabeledPhrasesFromFile(conf["phrase_table"].as<string>(), pl, conf["phrase_table_format"].as<string>());
-  cout << "Time taken: " << duration(start, clock()) << " seconds" << endl; 
-  src_phrases->normalizeLabelDistributions();
-  src_phrases->addUnlabeledPhrasesFromFile(conf["evaluation_corpus"].as<string>(), pl, conf["write_unlabeled"].as<string>(), conf.count("analyze_unlabeled"));   
+  StageCache* phrase_cache = phrasesCache(conf); 
+  if (phrase_cache != NULL && phrase_cache->isValid()){
+    cout << "Phrase table and evaluation corpus unchanged; reading phrases from snapshot" << endl; 
+    Metrics::addCount("stage_cache_hits", 1); 
+    ScopedTimer timer("readPhrasesSnapshot"); 
+    src_phrases->readSnapshot(conf["write_unlabeled"].as<string>() + PHRASES_SNAPSHOT_EXT); 
+    cout << "Time taken: " << timer.stop() << " seconds" << endl; 
+  }
+  else {
+    if (phrase_cache != NULL)
+      Metrics::addCount("stage_cache_misses", 1); 
+    cout << "Reading in phrase table" << endl; 
+    ScopedTimer pt_timer("readPhraseTable"); 
+    src_phrases->addLabeledPhrasesFromFile(conf["phrase_table"].as<string>(), pl, conf["phrase_table_format"].as<string>());
+    cout << "Time taken: " << pt_timer.stop() << " seconds" << endl; 
+    src_phrases->normalizeLabelDistributions();
+    ScopedTimer eval_timer("readEvaluationCorpus"); 
+    src_phrases->addUnlabeledPhrasesFromFile(conf["evaluation_corpus"].as<string>(), pl, conf["write_unlabeled"].as<string>(), conf.count("analyze_unlabeled"));   
+    eval_timer.stop(); 
+    if (phrase_cache != NULL){
+      src_phrases->writeSnapshot(conf["write_unlabeled"].as<string>() + PHRASES_SNAPSHOT_EXT); 
+      phrase_cache->commit(); 
+    }
+  }
+  delete phrase_cache; 
   Phrases* tgt_phrases = new Phrases(src_phrases); 
-  string stage = conf["stage"].as<string>();
-  transform(stage.begin(), stage.end(), stage.begin(), ::tolower);
   if (stage == "selectcorpora"){
     string side = conf["corpora_selection_side"].as<string>();
     transform(side.begin(), side.end(), side.begin(), ::tolower);
     FeatureExtractor* corpus_selector = new FeatureExtractor();
     if (side == "source"){
       cout << "Beginning corpus filtering for source side" << endl; 
-      start = clock();
+      ScopedTimer timer("source.filterSentences"); 
       corpus_selector->filterSentences(conf["source_mono_dir"].as<string>(), src_phrases, pl, pl, conf["max_phrase_count"].as<int>(), conf["source_monolingual"].as<string>());
-      cout << "Time taken: " << duration(start, clock()) / numThreads << " seconds" << endl;             
+      cout << "Time taken: " << timer.stop() << " seconds" << endl;             
     }
     else if (side == "target"){
       cout << "Beginning corpus filtering for target side" << endl; 
-      start = clock();
+      ScopedTimer timer("target.filterSentences"); 
       Phrases* mbest_phrases = new Phrases();
       int maxPL = mbest_phrases->readMBestListFromFile(conf["mbest_fromdecoder_location"].as<string>(), conf["mbest_processed_location"].as<string>(), src_phrases->getUnlabeledPhrases()); 
       if (maxPL > conf["max_target_phrase_length"].as<int>()){
@@ -53,7 +407,7 @@ int main(int argc, char** argv){
 	cout << "Setting to value in config file: " << conf["max_target_phrase_length"].as<int>() << endl; 
       }
       vector<string> generated_candidates = corpus_selector->filterSentences(conf["target_mono_dir"].as<string>(), mbest_phrases, 1, maxPL, conf["max_phrase_count"].as<int>(), conf["target_monolingual"].as<string>());
-      cout << "Time taken: " << duration(start, clock()) / numThreads << " seconds" << endl; 
+      cout << "Time taken: " << timer.stop() << " seconds" << endl;             
       cout << "Number of m-best phrases with count > 0: " << generated_candidates.size() << endl; 
       tgt_phrases->addGeneratedPhrases(generated_candidates); 
       tgt_phrases->writePhraseIDsToFile(conf["target_phraseIDs"].as<string>(), false);    
@@ -66,142 +420,143 @@ int main(int argc, char** argv){
     delete corpus_selector;
   }
   else if (stage == "extractfeatures"){
-    cout << "Beginning source-side feature extraction" << endl; 
-    start = clock();
-    FeatureExtractor* source_extractor = new FeatureExtractor();
-    source_extractor->readStopWords(conf["source_stopwords"].as<string>(), conf["stop_list_size"].as<int>()); 
-    source_extractor->extractFeatures(src_phrases, conf["source_monolingual"].as<string>(), conf["window_size"].as<int>(), pl, pl);
-    if (conf["minimum_feature_count"].as<int>() > 1)
-      source_extractor->pruneFeaturesByCount(conf["minimum_feature_count"].as<int>());
-    if (conf.count("analyze_feature_matrix"))
-      source_extractor->analyzeFeatureMatrix(src_phrases->getUnlabeledPhrases());
-    cout << "Time taken: " << duration(start, clock()) << " seconds" << endl; 
-    start = clock();
-    source_extractor->writeCoocToFile(conf["source_cooc_matrix"].as<string>()); 
-    cout << "Time taken to write out co-oc file: " << duration(start, clock()) << " seconds" << endl; 
-    start = clock(); 
-    source_extractor->rescaleCoocToPMI();
-    cout << "Time taken: " << duration(start, clock())<< " seconds" << endl; 
-    start = clock(); 
-    source_extractor->writeToFile(conf["source_feature_matrix"].as<string>(), conf["source_feature_extractor"].as<string>()); 
-    cout << "Time taken to write out feature matrix: " << duration(start, clock()) << " seconds" << endl; 
+    FeatureExtractor* source_extractor = extractFeatures(conf, src_phrases, "source", pl, pl); 
     delete source_extractor; 
-    cout << "Beginning target-side feature extraction" << endl; 
-    start = clock();
-    FeatureExtractor* target_extractor = new FeatureExtractor();
     tgt_phrases->readPhraseIDsFromFile(conf["target_phraseIDs"].as<string>(), false); 
-    target_extractor->readStopWords(conf["target_stopwords"].as<string>(), conf["stop_list_size"].as<int>()); 
-    target_extractor->extractFeatures(tgt_phrases, conf["target_monolingual"].as<string>(), conf["window_size"].as<int>(), 1, conf["max_target_phrase_length"].as<int>()); 
-    if (conf["minimum_feature_count"].as<int>() > 0)
-      target_extractor->pruneFeaturesByCount(conf["minimum_feature_count"].as<int>());
-    if (conf.count("analyze_feature_matrix"))
-      target_extractor->analyzeFeatureMatrix(tgt_phrases->getUnlabeledPhrases());
-    cout << "Time taken: " << duration(start, clock()) << " seconds" << endl; 
-    start = clock();
-    target_extractor->writeCoocToFile(conf["target_cooc_matrix"].as<string>()); 
-    cout << "Time taken to write out co-oc file: " << duration(start, clock()) << " seconds" << endl; 
-    start = clock(); 
-    target_extractor->rescaleCoocToPMI();
-    cout << "Time taken: " << duration(start, clock())<< " seconds" << endl; 
-    start = clock(); 
-    target_extractor->writeToFile(conf["target_feature_matrix"].as<string>(), conf["target_feature_extractor"].as<string>()); 
-    cout << "Time taken: " << duration(start, clock()) << " seconds" << endl;
+    FeatureExtractor* target_extractor = extractFeatures(conf, tgt_phrases, "target", 1, conf["max_target_phrase_length"].as<int>()); 
     delete target_extractor; 
   }
   else if (stage == "constructgraphs"){
-    FeatureExtractor* featuresFromFile = new FeatureExtractor();
     string side = conf["graph_construction_side"].as<string>();
     transform(side.begin(), side.end(), side.begin(), ::tolower);
-    if (side == "source"){
-      cout << "Starting graph construction on source side" << endl; 
-      start = clock();
-      featuresFromFile->readFromFile(conf["source_feature_matrix"].as<string>(), conf["source_feature_extractor"].as<string>()); 
-      Graph* src_graph = new Graph(featuresFromFile, conf["k_nearest_neighbors"].as<int>()); 
-      if (conf.count("analyze_similarity_matrix"))
-	src_graph->analyzeSimilarityMatrix(src_phrases->getUnlabeledPhrases());
-      cout << "Time taken: " << duration(start, clock()) << " seconds" << endl; 
-      start = clock();
-      src_graph->writeToFile(conf["source_similarity_matrix"].as<string>()); 
-      cout << "Time taken for writing out matrix: " << duration(start, clock()) << " seconds" << endl; 
-      delete src_graph; 
+    const bool sharded = conf.count("shard") || conf.count("merge_shards"); 
+    const bool embeddings = side == "target" && conf["target_embeddings_text"].as<string>() != ""; 
+    StageCache* graph_cache = (conf.count("use_cache") && !sharded && !embeddings && (side == "source" || side == "target")) ? graphCache(conf, side) : NULL; 
+    if (graph_cache != NULL && graph_cache->isValid()){
+      cout << "Feature matrix and graph construction options unchanged; keeping similarity matrix at " << conf[side + "_similarity_matrix"].as<string>() << endl; 
+      Metrics::addCount("stage_cache_hits", 1); 
     }
-    else if (side == "target"){
-      cout << "Starting graph construction on target side" << endl; 
-      start = clock(); 
-      featuresFromFile->readFromFile(conf["target_feature_matrix"].as<string>(), conf["target_feature_extractor"].as<string>());       
-      if (conf.count("dynamic_similarity_matrix")){
-	DynamicGraph* tgt_graph = new DynamicGraph(featuresFromFile); 
-	cout << "Time taken: " << duration(start, clock()) << " seconds" << endl; 
-	start = clock(); 
-	tgt_graph->writeToFile(conf["target_similarity_matrix"].as<string>()); 
-	cout << "Time taken for writing out matrix: " << duration(start, clock()) << " seconds" << endl; 
-	delete tgt_graph;
+    else {
+      if (graph_cache != NULL)
+	Metrics::addCount("stage_cache_misses", 1); 
+      FeatureExtractor* featuresFromFile = new FeatureExtractor();
+      if (conf.count("merge_shards") && (side == "source" || side == "target"))
+	mergeGraphShards(conf, side); 
+      else if (embeddings){ //instead of a target graph
+	tgt_phrases->readPhraseIDsFromFile(conf["target_phraseIDs"].as<string>(), false); 
+	delete readTargetEmbeddings(conf, tgt_phrases); 
       }
-      else {
-	Graph* tgt_graph = new Graph(featuresFromFile, conf["k_nearest_neighbors"].as<int>()); 
-	if (conf.count("analyze_similarity_matrix")){
-	  tgt_phrases->readPhraseIDsFromFile(conf["target_phraseIDs"].as<string>(), false); //check if defined in opts
-	  tgt_graph->analyzeSimilarityMatrix(tgt_phrases->getUnlabeledPhrases());
+      else if ((side == "source" || (side == "target" && !conf.count("dynamic_similarity_matrix"))) && (conf.count("out_of_core_graph_construction") || conf.count("shard") || !fitsInMemoryBudget(conf, side)))
+	constructGraphOutOfCore(conf, side); 
+      else if (side == "source"){
+	ScopedTimer timer("source.readFeatureMatrix"); 
+	featuresFromFile->readFromFile(conf["source_feature_matrix"].as<string>(), conf["source_feature_extractor"].as<string>()); 
+	cout << "Time taken to read in source feature matrix: " << timer.stop() << " seconds" << endl; 
+	Graph* src_graph = constructGraph(conf, featuresFromFile, src_phrases, "source"); 
+	delete src_graph; 
+      }
+      else if (side == "target"){
+	ScopedTimer timer("target.readFeatureMatrix"); 
+	featuresFromFile->readFromFile(conf["target_feature_matrix"].as<string>(), conf["target_feature_extractor"].as<string>());       
+	cout << "Time taken to read in target feature matrix: " << timer.stop() << " seconds" << endl; 
+	if (conf.count("dynamic_similarity_matrix")){
+	  DynamicGraph* tgt_graph = constructDynamicGraph(conf, featuresFromFile); 
+	  delete tgt_graph;
 	}
-	cout << "Time taken: " << duration(start, clock()) << " seconds" << endl; 
-	start = clock(); 
-	tgt_graph->writeToFile(conf["target_similarity_matrix"].as<string>()); 
-	cout << "Time taken for writing out matrix: " << duration(start, clock()) << " seconds" << endl; 
-	delete tgt_graph;
+	else {
+	  if (conf.count("analyze_similarity_matrix"))
+	    tgt_phrases->readPhraseIDsFromFile(conf["target_phraseIDs"].as<string>(), false); //check if defined in opts
+	  Graph* tgt_graph = constructGraph(conf, featuresFromFile, tgt_phrases, "target"); 
+	  delete tgt_graph;
+	}
+      }
+      else {
+	cerr << "Incorrect argument for 'graph_construction_side' field" << endl; 
+	exit(0);
       }
+      delete featuresFromFile; 
+      if (graph_cache != NULL)
+	graph_cache->commit(); 
     }
-    else {
-      cerr << "Incorrect argument for 'graph_construction_side' field" << endl; 
-      exit(0);
-    }    
+    delete graph_cache; 
   }
   else if (stage == "propagategraph"){
     LexicalScorer* lex = new LexicalScorer(conf["lexical_model_location"].as<string>()); 
     tgt_phrases->readPhraseIDsFromFile(conf["target_phraseIDs"].as<string>(), false); 
     src_phrases->readLabelPhraseIDsFromFile(conf["target_phraseIDs"].as<string>()); //also add to label space
-    start = clock(); 
+    ScopedTimer read_timer("source.readSimilarityMatrix"); 
     Graph* src_graph = new Graph(conf["source_similarity_matrix"].as<string>()); 
-    cout << "Time taken to read in source similarity matrix: " << duration(start, clock()) << " seconds" << endl; 
-    set<int> labelStopPhrases; 
-    if (conf.count("filter_stop_words"))
-      labelStopPhrases = FeatureExtractor::readStopWordsAsPhrases(conf["target_stopwords"].as<string>(), conf["stop_list_size"].as<int>(), tgt_phrases); 
-    start = clock(); 
-    src_graph->initLabelsWithLexScore(src_phrases, conf["mbest_processed_location"].as<string>(), lex, conf["maximum_candidate_size"].as<int>(), conf.count("filter_stop_words"), labelStopPhrases);      
-    cout << "Time taken to initialize unlabeled phrases' candidates: " << duration(start, clock()) << " seconds" << endl; 
-    start = clock();     
+    cout << "Time taken to read in source similarity matrix: " << read_timer.stop() << " seconds" << endl; 
+    ScopedTimer src_marginals_timer("source.computeMarginals"); 
     src_phrases->computeMarginals(conf["source_cooc_matrix"].as<string>()); 
-    cout << "Source phrase marginals computed from co-occurrence matrix; Time taken: " << duration(start, clock()) << " seconds" << endl; 
-    start = clock(); 
+    cout << "Source phrase marginals computed from co-occurrence matrix; Time taken: " << src_marginals_timer.stop() << " seconds" << endl; 
+    ScopedTimer tgt_marginals_timer("target.computeMarginals"); 
     tgt_phrases->computeMarginals(conf["target_cooc_matrix"].as<string>()); 
-    cout << "Target phrase marginals computed from co-occurrence matrix; Time taken: " << duration(start, clock()) << " seconds" << endl; 
-    cout << "Beginning graph propagation" << endl; 
-    clock_t gp_start = clock();     
+    cout << "Target phrase marginals computed from co-occurrence matrix; Time taken: " << tgt_marginals_timer.stop() << " seconds" << endl; 
     string algo = conf["graph_propagation_algorithm"].as<string>();
     transform(algo.begin(), algo.end(), algo.begin(), ::tolower);
-    if (algo == "structlabelprop"){
-      bool dynamic = conf.count("dynamic_similarity_matrix"); 
-      start = clock(); 
-      void* tgt_graph; 
-      tgt_graph = (dynamic) ? static_cast<void*>(new DynamicGraph(conf["target_similarity_matrix"].as<string>())) : static_cast<void*>(new Graph(conf["target_similarity_matrix"].as<string>())); 
-      cout << "Time taken to read in target similarity matrix: " << duration(start, clock()) << " seconds" << endl; 
-      for (int i = 0; i < conf["graph_propagation_iterations"].as<int>(); i++){
-	src_graph->structLabelProp(src_phrases, tgt_graph, dynamic);
-	cout << "Graph Propagation iteration " << i << " complete" << endl; 
-      }
+    TargetSimilarity* tgt_sim = NULL; 
+    if (algo == "structlabelprop" && conf["target_embeddings"].as<string>() != "")
+      tgt_sim = new EmbeddingSimilarity(conf["target_embeddings"].as<string>()); 
+    else if (algo == "structlabelprop"){
+      ScopedTimer timer("target.readSimilarityMatrix"); 
+      if (conf.count("dynamic_similarity_matrix"))
+	tgt_sim = new DynamicGraph(conf["target_similarity_matrix"].as<string>()); 
+      else
+	tgt_sim = new Graph(conf["target_similarity_matrix"].as<string>()); 
+      cout << "Time taken to read in target similarity matrix: " << timer.stop() << " seconds" << endl; 
+    }
+    propagateGraph(conf, src_phrases, tgt_phrases, src_graph, tgt_sim, lex); 
+    delete tgt_sim; 
+    delete src_graph; 
+    delete lex; 
+  }
+  else if (stage == "pipeline" || stage == "serve"){ //ExtractFeatures -> ConstructGraphs (both sides) -> PropagateGraph, all in memory
+    LexicalScorer* lex = new LexicalScorer(conf["lexical_model_location"].as<string>()); 
+    tgt_phrases->readPhraseIDsFromFile(conf["target_phraseIDs"].as<string>(), false); 
+    src_phrases->readLabelPhraseIDsFromFile(conf["target_phraseIDs"].as<string>()); //also add to label space
+    FeatureExtractor* source_extractor = extractFeatures(conf, src_phrases, "source", pl, pl); 
+    Graph* src_graph = constructGraph(conf, source_extractor, src_phrases, "source"); 
+    if (stage == "pipeline"){
+      delete source_extractor; 
+      source_extractor = NULL; 
     }
-    else if (algo == "labelprop"){
-      for (int i = 0; i < conf["graph_propagation_iterations"].as<int>(); i++){
-	src_graph->labelProp(src_phrases);
-	cout << "Graph Propagation iteration " << i << " complete" << endl; 
+    string algo = conf["graph_propagation_algorithm"].as<string>();
+    transform(algo.begin(), algo.end(), algo.begin(), ::tolower);
+    TargetSimilarity* tgt_sim = NULL; 
+    FeatureExtractor* target_extractor = extractFeatures(conf, tgt_phrases, "target", 1, conf["max_target_phrase_length"].as<int>()); 
+    if (algo == "structlabelprop" && conf["target_embeddings"].as<string>() != "")
+      tgt_sim = readTargetEmbeddings(conf, tgt_phrases); 
+    else if (algo == "structlabelprop" && conf.count("dynamic_similarity_matrix"))
+      tgt_sim = constructDynamicGraph(conf, target_extractor); 
+    else if (algo == "structlabelprop")
+      tgt_sim = constructGraph(conf, target_extractor, tgt_phrases, "target"); 
+    delete target_extractor; 
+    propagateGraph(conf, src_phrases, tgt_phrases, src_graph, tgt_sim, lex); 
+    if (stage == "serve"){ //the graph is then kept in memory to label new phrases
+      PhraseServer server(conf, src_phrases, tgt_phrases, source_extractor, src_graph, tgt_sim, lex); 
+      if (conf["serve_socket"].as<string>() != "")
+	server.listen(conf["serve_socket"].as<string>()); 
+      else {
+	ostream responses(stdout_buf); 
+	cout << "Serving phrases from standard input" << endl; 
+	server.serve(cin, responses); 
       }
+      delete source_extractor; 
     }
-    else
-	cerr << "Error: invalid option for graph propagation method.  Valid choices are 'LabelProp' and 'StructLabelProp'" << endl; 
-    cout << "Graph propagation complete; Time taken: " << duration(gp_start, clock()) << " seconds" << endl; 
-    src_phrases->writePhraseTable(tgt_phrases, conf["phrase_table_format"].as<string>(), conf["expanded_phrase_table_loc"].as<string>(), lex); 
-    cout << "Expanded phrase table written to file" << endl; 
+    delete tgt_sim; 
+    delete src_graph; 
     delete lex; 
   }
+  if (conf["metrics_report"].as<string>() != ""){
+    map<string, string> run_info = map<string, string>(); 
+    run_info["stage"] = conf["stage"].as<string>(); 
+    if (conf.count("config"))
+      run_info["config"] = conf["config"].as<string>(); 
+    Metrics::writeReport(conf["metrics_report"].as<string>(), run_info); 
+    cout << "Metrics report written to " << conf["metrics_report"].as<string>() << endl; 
+  }
+  cout.rdbuf(stdout_buf); 
   delete opts;
   delete src_phrases;
   delete tgt_phrases;
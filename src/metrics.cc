@@ -0,0 +1,266 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdio.h>
+#include <algorithm>
+#include <time.h>
+#include <sys/resource.h>
+#include <omp.h>
+#include "metrics.h"
+
+using namespace std; 
+
+mutex Metrics::lock; 
+chrono::steady_clock::time_point Metrics::process_start = chrono::steady_clock::now(); 
+vector<Metrics::Stage> Metrics::stages = vector<Metrics::Stage>(); 
+vector<pair<string, map<string, long> > > Metrics::open_stages = vector<pair<string, map<string, long> > >(); 
+map<string, long> Metrics::counters = map<string, long>(); 
+long Metrics::memory_budget = 0; 
+vector<pair<string, map<string, long> > > Metrics::memory_snapshots = vector<pair<string, map<string, long> > >(); 
+
+static double toSeconds(const struct timespec& ts){
+  return ts.tv_sec + ts.tv_nsec * 1e-9; 
+}
+
+static double processCPUSeconds(){
+  struct timespec ts; 
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts); 
+  return toSeconds(ts); 
+}
+
+//CPU time of each thread of the OpenMP pool, read from within a parallel region
+static vector<double> threadCPUSeconds(){
+  vector<double> seconds(omp_get_max_threads(), 0.0); 
+  #pragma omp parallel
+  {
+    struct timespec ts; 
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts); 
+    if (omp_get_thread_num() < (int) seconds.size())
+      seconds[omp_get_thread_num()] = toSeconds(ts); 
+  }
+  return seconds; 
+}
+
+void Metrics::addCount(const string counter, const long value){
+  lock_guard<mutex> guard(lock); 
+  counters[counter] += value; 
+  if (!open_stages.empty())
+    open_stages.back().second[counter] += value; 
+}
+
+double Metrics::peakMemoryMB(){
+  struct rusage usage; 
+  getrusage(RUSAGE_SELF, &usage); 
+  return usage.ru_maxrss / 1024.0; //ru_maxrss is in KB on Linux
+}
+
+void Metrics::beginStage(const string name){
+  lock_guard<mutex> guard(lock); 
+  open_stages.push_back(make_pair(name, map<string, long>())); 
+}
+
+//timers end in reverse order of starting, so the stage is the innermost open one
+void Metrics::endStage(Stage& stage){
+  lock_guard<mutex> guard(lock); 
+  for (int i = open_stages.size() - 1; i >= 0; i--){
+    if (open_stages[i].first == stage.name){
+      stage.counters = open_stages[i].second; 
+      open_stages.erase(open_stages.begin() + i); 
+      break; 
+    }
+  }
+  stages.push_back(stage); 
+}
+
+void Metrics::setMemoryBudget(const double mb){
+  memory_budget = (long) (mb * 1024 * 1024); 
+}
+
+//prints the estimates, largest first, and warns if they add up to more than the budget (the process also holds 
+//memory that is not accounted for, so the warning comes before the budget is actually reached)
+void Metrics::recordMemory(const string at, const map<string, long>& bytes){
+  vector<pair<long, string> > by_size = vector<pair<long, string> >(); 
+  long total = 0; 
+  for (map<string, long>::const_iterator it = bytes.begin(); it != bytes.end(); it++){
+    if (it->second > 0)
+      by_size.push_back(make_pair(it->second, it->first)); 
+    total += it->second; 
+  }
+  sort(by_size.rbegin(), by_size.rend()); 
+  cout << "Memory after " << at << " (estimated):"; 
+  for (unsigned int i = 0; i < by_size.size(); i++)
+    cout << ((i > 0) ? "," : "") << " " << by_size[i].second << " " << by_size[i].first / (1024.0 * 1024.0) << " MB"; 
+  cout << "; total " << total / (1024.0 * 1024.0) << " MB; peak RSS " << peakMemoryMB() << " MB" << endl; 
+  if (memory_budget > 0 && total > memory_budget && !by_size.empty())
+    cerr << "Warning: data structures after " << at << " take an estimated " << total / (1024.0 * 1024.0) << " MB, over the memory budget of " << memory_budget / (1024.0 * 1024.0) << " MB; the largest is " << by_size[0].second << endl; 
+  lock_guard<mutex> guard(lock); 
+  memory_snapshots.push_back(make_pair(at, bytes)); 
+}
+
+static string jsonString(const string str){
+  string escaped = "\""; 
+  for (unsigned int i = 0; i < str.size(); i++){
+    if (str[i] == '"' || str[i] == '\\')
+      escaped += '\\'; 
+    if ((unsigned char) str[i] < 0x20){
+      char buf[8]; 
+      snprintf(buf, sizeof(buf), "\\u%04x", str[i]); 
+      escaped += buf; 
+    }
+    else
+      escaped += str[i]; 
+  }
+  return escaped + "\""; 
+}
+
+static string jsonNumber(const double val){
+  char buf[32]; 
+  snprintf(buf, sizeof(buf), "%.6g", val); 
+  return string(buf); 
+}
+
+static void writeCounters(ofstream& out, const map<string, long>& counters){
+  out << "{"; 
+  for (map<string, long>::const_iterator it = counters.begin(); it != counters.end(); it++)
+    out << ((it != counters.begin()) ? ", " : "") << jsonString(it->first) << ": " << it->second; 
+  out << "}"; 
+}
+
+//run_info: string-valued fields for the top level of the report (e.g., stage and configuration file)
+void Metrics::writeReport(const string reportLoc, const map<string, string>& run_info){
+  lock_guard<mutex> guard(lock); 
+  ofstream out(reportLoc.c_str()); 
+  if (!out.is_open()){ cerr << "Could not write metrics report to location " << reportLoc << endl; return; }
+  out << "{" << endl; 
+  for (map<string, string>::const_iterator it = run_info.begin(); it != run_info.end(); it++)
+    out << "  " << jsonString(it->first) << ": " << jsonString(it->second) << "," << endl; 
+  out << "  \"number_threads\": " << omp_get_max_threads() << "," << endl; 
+  out << "  \"wall_seconds\": " << jsonNumber(chrono::duration<double>(chrono::steady_clock::now() - process_start).count()) << "," << endl; 
+  out << "  \"cpu_seconds\": " << jsonNumber(processCPUSeconds()) << "," << endl; 
+  out << "  \"peak_rss_mb\": " << jsonNumber(peakMemoryMB()) << "," << endl; 
+  if (memory_budget > 0)
+    out << "  \"memory_budget_mb\": " << jsonNumber(memory_budget / (1024.0 * 1024.0)) << "," << endl; 
+  out << "  \"counters\": "; 
+  writeCounters(out, counters); 
+  out << "," << endl << "  \"stages\": ["; 
+  for (unsigned int i = 0; i < stages.size(); i++){
+    const Stage& stage = stages[i]; 
+    out << ((i > 0) ? "," : "") << endl << "    {\"name\": " << jsonString(stage.name) << ", \"wall_seconds\": " << jsonNumber(stage.wall_seconds); 
+    out << ", \"cpu_seconds\": " << jsonNumber(stage.cpu_seconds) << ", \"thread_busy_seconds\": ["; 
+    for (unsigned int t = 0; t < stage.thread_busy_seconds.size(); t++)
+      out << ((t > 0) ? ", " : "") << jsonNumber(stage.thread_busy_seconds[t]); 
+    out << "], \"peak_rss_mb\": " << jsonNumber(stage.peak_rss_mb) << ", \"counters\": "; 
+    writeCounters(out, stage.counters); 
+    out << "}"; 
+  }
+  out << endl << "  ]," << endl << "  \"memory_mb\": ["; 
+  for (unsigned int i = 0; i < memory_snapshots.size(); i++){
+    out << ((i > 0) ? "," : "") << endl << "    {\"after\": " << jsonString(memory_snapshots[i].first) << ", \"structures\": {"; 
+    const map<string, long>& bytes = memory_snapshots[i].second; 
+    for (map<string, long>::const_iterator it = bytes.begin(); it != bytes.end(); it++)
+      out << ((it != bytes.begin()) ? ", " : "") << jsonString(it->first) << ": " << jsonNumber(it->second / (1024.0 * 1024.0)); 
+    out << "}}"; 
+  }
+  out << endl << "  ]" << endl << "}" << endl; 
+  out.close(); 
+}
+
+ScopedTimer::ScopedTimer(const string name) :
+  name(name) {
+  stopped = false; 
+  Metrics::beginStage(name); 
+  thread_start = threadCPUSeconds(); 
+  cpu_start = processCPUSeconds(); 
+  start = chrono::steady_clock::now(); 
+}
+
+ScopedTimer::~ScopedTimer(){
+  if (!stopped)
+    stop(); 
+}
+
+double ScopedTimer::elapsed(){
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count(); 
+}
+
+double ScopedTimer::stop(){
+  if (stopped)
+    return elapsed(); 
+  Metrics::Stage stage; 
+  stage.name = name; 
+  stage.wall_seconds = elapsed(); 
+  stage.cpu_seconds = processCPUSeconds() - cpu_start; 
+  const vector<double> thread_end = threadCPUSeconds(); 
+  for (unsigned int t = 0; t < thread_end.size(); t++)
+    stage.thread_busy_seconds.push_back(max(0.0, thread_end[t] - ((t < thread_start.size()) ? thread_start[t] : 0.0))); 
+  stage.peak_rss_mb = Metrics::peakMemoryMB(); 
+  Metrics::endStage(stage); 
+  stopped = true; 
+  return stage.wall_seconds; 
+}
+
+double ProgressReporter::interval = 60.0; 
+
+void ProgressReporter::setInterval(const double seconds){
+  interval = seconds; 
+}
+
+ProgressReporter::ProgressReporter(const string name, const long total, const string unit) :
+  name(name), total(total), unit(unit), done(0) {
+  start = chrono::steady_clock::now(); 
+  reported = false; 
+  finished = false; 
+  if (interval > 0)
+    reporter = thread(&ProgressReporter::run, this); 
+}
+
+ProgressReporter::~ProgressReporter(){
+  if (reporter.joinable()){
+    {
+      lock_guard<mutex> guard(finish_lock); 
+      finished = true; 
+    }
+    finish_cv.notify_one(); 
+    reporter.join(); 
+    if (reported) //only loops that printed progress report their completion
+      report(true); 
+  }
+}
+
+//wakes up every interval until the loop finishes
+void ProgressReporter::run(){
+  unique_lock<mutex> guard(finish_lock); 
+  const chrono::duration<double> period(interval); 
+  while (!finish_cv.wait_for(guard, period, [this]{ return finished; })){
+    report(false); 
+    reported = true; 
+  }
+}
+
+static string formatDuration(const double seconds){
+  const long secs = (long) (seconds + 0.5); 
+  char buf[32]; 
+  snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", secs / 3600, (secs / 60) % 60, secs % 60); 
+  return string(buf); 
+}
+
+void ProgressReporter::report(const bool final){
+  const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count(); 
+  const long count = done.load(memory_order_relaxed); 
+  const long total = this->total.load(memory_order_relaxed); 
+  const double rate = (elapsed > 0) ? count / elapsed : 0.0; 
+  ostringstream line; 
+  line << fixed << setprecision(1) << "[progress] " << name << ": " << count; 
+  if (total > 0)
+    line << "/" << total; 
+  line << " " << unit << ", " << rate << " " << unit << "/s"; 
+  if (final)
+    line << ", done in " << formatDuration(elapsed); 
+  else if (total > 0){
+    line << ", " << 100 * min(1.0, (double) count / total) << "%"; 
+    if (rate > 0)
+      line << ", ETA " << formatDuration(max(0L, total - count) / rate); 
+  }
+  cerr << line.str() << endl; 
+}
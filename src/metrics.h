@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+using namespace std; 
+
+//process-wide record of one run: wall-clock stage timings, per-thread busy times, counters, and peak memory, which can
+//be written out as a JSON report. counters added while a stage is being timed are also attributed to that stage
+class Metrics {
+ public:
+  struct Stage {
+    string name; 
+    double wall_seconds; //monotonic clock
+    double cpu_seconds; //all threads of the process
+    vector<double> thread_busy_seconds; //CPU time of each OpenMP thread, including time spent spinning at barriers
+    double peak_rss_mb; //high-water mark of the process at the end of the stage
+    map<string, long> counters; 
+  }; 
+  static void addCount(const string counter, const long value); //thread-safe; call once per batch in hot loops
+  static double peakMemoryMB(); 
+  static void writeReport(const string reportLoc, const map<string, string>& run_info); 
+  static void setMemoryBudget(const double mb); //0 for no budget
+  static long getMemoryBudget(){ return memory_budget; } //in bytes
+  static void recordMemory(const string at, const map<string, long>& bytes); //estimated bytes per data structure
+
+ private:
+  friend class ScopedTimer; 
+  static void beginStage(const string name); 
+  static void endStage(Stage& stage); 
+  static mutex lock; 
+  static chrono::steady_clock::time_point process_start; 
+  static vector<Stage> stages; //in order of completion
+  static vector<pair<string, map<string, long> > > open_stages; //innermost last
+  static map<string, long> counters; //totals over the run
+  static long memory_budget; 
+  static vector<pair<string, map<string, long> > > memory_snapshots; //in order of recording
+}; 
+
+//size estimates for the memory accounting: a std::map or std::set node holds its value plus a color and three pointers
+//(libstdc++), and a std::string only allocates beyond its short string buffer
+inline long treeNodeBytes(const long value_bytes){ return 32 + ((value_bytes + 7) / 8) * 8; }
+inline long stringHeapBytes(const string& str){ return (str.capacity() > 15) ? str.capacity() + 1 : 0; }
+template<typename SparseMatrixType> long sparseMatrixBytes(const SparseMatrixType& mat){ //values, inner indices and outer index arrays
+  const long inner_nnz_bytes = mat.isCompressed() ? 0 : mat.outerSize() * sizeof(int); 
+  return mat.data().allocatedSize() * (sizeof(typename SparseMatrixType::Scalar) + sizeof(int)) + (mat.outerSize() + 1) * sizeof(int) + inner_nnz_bytes; 
+}
+
+//times a stage from construction until stop() or destruction
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(const string name); 
+  ~ScopedTimer(); 
+  double stop(); //records the stage; returns its wall time in seconds
+  double elapsed(); //wall time so far, in seconds
+
+ private:
+  string name; 
+  chrono::steady_clock::time_point start; 
+  double cpu_start; 
+  vector<double> thread_start; 
+  bool stopped; 
+}; 
+
+//live progress of a long loop: workers add() to an atomic counter, and a background thread prints the count, rate, 
+//percent complete and ETA to stderr every interval seconds. a loop that finishes within one interval prints nothing
+class ProgressReporter {
+ public:
+  ProgressReporter(const string name, const long total, const string unit="items"); //total <= 0 if unknown (no percent or ETA)
+  ~ProgressReporter(); 
+  void add(const long count){ done.fetch_add(count, memory_order_relaxed); }
+  void addTotal(const long count){ total.fetch_add(count, memory_order_relaxed); } //for loops whose work grows as they run
+  static void setInterval(const double seconds); //0 disables reporting
+
+ private:
+  void run(); 
+  void report(const bool final); 
+  static double interval; 
+  string name; 
+  atomic<long> total; 
+  string unit; 
+  atomic<long> done; 
+  chrono::steady_clock::time_point start; 
+  bool reported; 
+  bool finished; 
+  mutex finish_lock; 
+  condition_variable finish_cv; 
+  thread reporter; 
+}; 
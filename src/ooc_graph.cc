@@ -0,0 +1,480 @@
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <functional>
+#include <math.h>
+#include <stdio.h>
+#include <omp.h>
+#include "ooc_graph.h"
+#include "graph.h"
+#include "featext.h"
+#include "sparse_cosine.h"
+#include "csr_util.h"
+#include "compact_matrix.h"
+#include "metrics.h"
+#include "line_reader.h"
+
+using namespace std; 
+
+const string ROW_COLS_EXT = ".ooc.cols"; 
+const string ROW_VALS_EXT = ".ooc.vals"; 
+const string POSTINGS_EXT = ".ooc.postings"; 
+const string RUN_EXT = ".ooc.run"; 
+const string BODY_EXT = ".ooc.body"; 
+const string SHARD_EXT = ".shard"; 
+
+OutOfCoreGraph::OutOfCoreGraph(const string tmp_prefix, const unsigned int block_rows, const unsigned long buffer_entries, const string precision) :
+  tmp_prefix(tmp_prefix), block_rows(block_rows), buffer_entries(buffer_entries), precision(precision) {
+  num_rows = 0, num_features = 0; 
+  row_offsets = vector<long>(); 
+  row_norms = vector<double>(); 
+  posting_offsets = vector<long>(); 
+  run_files = vector<string>(); 
+}
+
+OutOfCoreGraph::~OutOfCoreGraph(){
+  remove((tmp_prefix + ROW_COLS_EXT).c_str()); 
+  remove((tmp_prefix + ROW_VALS_EXT).c_str()); 
+  remove((tmp_prefix + POSTINGS_EXT).c_str()); 
+}
+
+bool OutOfCoreGraph::readDimensions(const string featMatLoc, long& rows, long& cols, long& nnz){
+  LineReader featMatFile(featMatLoc); 
+  string line; 
+  while (featMatFile.getline(line)){
+    if (!line.empty() && line[0] != '%') //first non-comment line: rows cols nnz
+      return sscanf(line.c_str(), "%ld %ld %ld", &rows, &cols, &nnz) == 3; 
+  }
+  return false; 
+}
+
+//one streaming pass over the MatrixMarket feature matrix (which must be in row-major order, as saveMarket writes it)
+//into the on-disk row file, keeping only row offsets and norms in memory; then builds the posting lists
+void OutOfCoreGraph::readFeatures(const string featMatLoc, const string invIdxLoc){
+  LineReader featMatFile(featMatLoc); //parsed while the next batch is read
+  if (!featMatFile.is_open()){ cerr << "Could not read feature matrix at location " << featMatLoc << endl; exit(0); }
+  ofstream colsFile((tmp_prefix + ROW_COLS_EXT).c_str(), ios_base::out | ios_base::binary); 
+  ofstream valsFile((tmp_prefix + ROW_VALS_EXT).c_str(), ios_base::out | ios_base::binary); 
+  if (!colsFile.is_open() || !valsFile.is_open()){ cerr << "Could not write temporary files with prefix " << tmp_prefix << endl; exit(0); }
+  bool readDims = false; 
+  long last_row = -1, last_col = -1; 
+  string line; 
+  while (featMatFile.getline(line)){
+    if (line.empty() || line[0] == '%') //header and comments
+      continue; 
+    char* next; 
+    const long row = strtol(line.c_str(), &next, 10); 
+    const long col = strtol(next, &next, 10); 
+    if (!readDims){ //first non-comment line: rows cols nnz
+      num_rows = row, num_features = col; 
+      row_offsets.assign(num_rows + 1, 0); 
+      row_norms.assign(num_rows, 0.0); 
+      readDims = true; 
+      continue; 
+    }
+    const double val = strtod(next, NULL); 
+    if (row < last_row || (row == last_row && col <= last_col)){
+      cerr << "Out-of-core graph construction needs the feature matrix in row-major order, as written by the ExtractFeatures stage" << endl; 
+      exit(0); 
+    }
+    last_row = row, last_col = col; 
+    const int col_idx = col - 1; //MatrixMarket indices are 1-based
+    colsFile.write(reinterpret_cast<const char*>(&col_idx), sizeof(int)); 
+    valsFile.write(reinterpret_cast<const char*>(&val), sizeof(double)); 
+    row_offsets[row]++; 
+    row_norms[row-1] += val*val; 
+  }
+  colsFile.close(); 
+  valsFile.close(); 
+  for (int i = 0; i < num_rows; i++){
+    row_offsets[i+1] += row_offsets[i]; 
+    row_norms[i] = sqrt(row_norms[i]); 
+  }
+  cout << "Feature matrix written to disk: " << num_rows << " x " << num_features << "; NNZs: " << row_offsets[num_rows] << endl; 
+  set<unsigned int> stop_features = set<unsigned int>(); 
+  if (!FeatureExtractor::readStopFeatures(invIdxLoc, stop_features))
+    cout << "Warning: no stop feature list next to " << invIdxLoc << " (re-run the ExtractFeatures stage to write one); stop word features will also generate neighbors" << endl; 
+  writePostingFile(stop_features); 
+}
+
+//the posting list of a feature holds the rows (phrases) with that feature, i.e., the inverted index; stop features
+//are left out, as in FeatureExtractor. lists are filled in feature ranges that fit in buffer_entries, with one pass
+//over the row file per range
+void OutOfCoreGraph::writePostingFile(const set<unsigned int>& stop_features){
+  vector<bool> is_stop(num_features, false); 
+  for (set<unsigned int>::const_iterator it = stop_features.begin(); it != stop_features.end(); it++){
+    if ((int) *it < num_features)
+      is_stop[*it] = true; 
+  }
+  posting_offsets.assign(num_features + 1, 0); 
+  const long nnz = row_offsets[num_rows]; 
+  vector<int> cols = vector<int>(); 
+  ifstream colsFile((tmp_prefix + ROW_COLS_EXT).c_str(), ios_base::in | ios_base::binary); 
+  for (long p = 0; p < nnz; p += cols.size()){ //count
+    cols.resize(min((long) buffer_entries, nnz - p)); 
+    colsFile.read(reinterpret_cast<char*>(&cols[0]), cols.size()*sizeof(int)); 
+    for (unsigned int i = 0; i < cols.size(); i++){
+      if (!is_stop[cols[i]])
+	posting_offsets[cols[i]+1]++; 
+    }
+  }
+  for (int f = 0; f < num_features; f++)
+    posting_offsets[f+1] += posting_offsets[f]; 
+  ofstream postingsFile((tmp_prefix + POSTINGS_EXT).c_str(), ios_base::out | ios_base::binary); 
+  int num_passes = 0; 
+  for (int f_start = 0; f_start < num_features; ){
+    int f_end = f_start + 1; 
+    while (f_end < num_features && posting_offsets[f_end+1] - posting_offsets[f_start] <= (long) buffer_entries)
+      f_end++; 
+    vector<int> postings(posting_offsets[f_end] - posting_offsets[f_start]); 
+    vector<long> fill(posting_offsets.begin() + f_start, posting_offsets.begin() + f_end); 
+    colsFile.clear(); 
+    colsFile.seekg(0); 
+    int row = 0; 
+    for (long p = 0; p < nnz; p += cols.size()){
+      cols.resize(min((long) buffer_entries, nnz - p)); 
+      colsFile.read(reinterpret_cast<char*>(&cols[0]), cols.size()*sizeof(int)); 
+      for (unsigned int i = 0; i < cols.size(); i++){
+	while (row_offsets[row+1] <= p + i)
+	  row++; 
+	if (cols[i] >= f_start && cols[i] < f_end && !is_stop[cols[i]])
+	  postings[fill[cols[i] - f_start]++ - posting_offsets[f_start]] = row; 
+      }
+    }
+    if (postings.size() > 0)
+      postingsFile.write(reinterpret_cast<const char*>(&postings[0]), postings.size()*sizeof(int)); 
+    f_start = f_end; 
+    num_passes++; 
+  }
+  colsFile.close(); 
+  postingsFile.close(); 
+  cout << "Posting lists written to disk in " << num_passes << " passes; NNZs: " << posting_offsets[num_features] << endl; 
+}
+
+//reads rows [start, end) from the row file; offsets are relative to the first row read
+void OutOfCoreGraph::readRows(const int start, const int end, vector<long>& offsets, vector<int>& cols, vector<double>& vals){
+  offsets.resize(end - start + 1); 
+  for (int i = start; i <= end; i++)
+    offsets[i - start] = row_offsets[i] - row_offsets[start]; 
+  cols.resize(offsets.back()); 
+  vals.resize(offsets.back()); 
+  if (cols.size() == 0)
+    return; 
+  ifstream colsFile((tmp_prefix + ROW_COLS_EXT).c_str(), ios_base::in | ios_base::binary); 
+  colsFile.seekg(row_offsets[start]*sizeof(int)); 
+  colsFile.read(reinterpret_cast<char*>(&cols[0]), cols.size()*sizeof(int)); 
+  ifstream valsFile((tmp_prefix + ROW_VALS_EXT).c_str(), ios_base::in | ios_base::binary); 
+  valsFile.seekg(row_offsets[start]*sizeof(double)); 
+  valsFile.read(reinterpret_cast<char*>(&vals[0]), vals.size()*sizeof(double)); 
+}
+
+//top-k neighbors of rows [start, end), with the same candidate generation, similarity computation, and tie
+//handling as Graph::addNearestNeighbors. candidate rows are streamed from the row file in ascending order
+void OutOfCoreGraph::spillBlock(const int start, const int end, const unsigned int k){
+  const int n = end - start; 
+  vector<long> offsets; 
+  vector<int> cols; 
+  vector<double> vals; 
+  readRows(start, end, offsets, cols, vals); 
+  vector<pair<int,int> > feature_rows = vector<pair<int,int> >(); //(feature, row in block)
+  for (int i = 0; i < n; i++){
+    for (long p = offsets[i]; p < offsets[i+1]; p++){
+      if (posting_offsets[cols[p]+1] > posting_offsets[cols[p]])
+	feature_rows.push_back(make_pair(cols[p], i)); 
+    }
+  }
+  sort(feature_rows.begin(), feature_rows.end()); 
+  vector<vector<int> > candidates(n); 
+  vector<unsigned int> dedup_size(n, 1024); 
+  ifstream postingsFile((tmp_prefix + POSTINGS_EXT).c_str(), ios_base::in | ios_base::binary); 
+  vector<int> posting = vector<int>(); 
+  for (unsigned int g = 0; g < feature_rows.size(); ){ //one read per posting list
+    const int f = feature_rows[g].first; 
+    posting.resize(posting_offsets[f+1] - posting_offsets[f]); 
+    postingsFile.seekg(posting_offsets[f]*sizeof(int)); 
+    postingsFile.read(reinterpret_cast<char*>(&posting[0]), posting.size()*sizeof(int)); 
+    for (; g < feature_rows.size() && feature_rows[g].first == f; g++){
+      vector<int>& row_candidates = candidates[feature_rows[g].second]; 
+      row_candidates.insert(row_candidates.end(), posting.begin(), posting.end()); 
+      if (row_candidates.size() > dedup_size[feature_rows[g].second]){ //keep candidate lists bounded
+	sort(row_candidates.begin(), row_candidates.end()); 
+	row_candidates.erase(unique(row_candidates.begin(), row_candidates.end()), row_candidates.end()); 
+	dedup_size[feature_rows[g].second] = max(dedup_size[feature_rows[g].second], 2 * (unsigned int) row_candidates.size()); 
+      }
+    }
+  }
+  postingsFile.close(); 
+  vector<pair<int,int> >().swap(feature_rows); 
+  vector<bool> has_candidates(n, false); 
+  vector<pair<int,int> > pairs = vector<pair<int,int> >(); //(candidate row, row in block)
+  for (int i = 0; i < n; i++){
+    sort(candidates[i].begin(), candidates[i].end()); 
+    candidates[i].erase(unique(candidates[i].begin(), candidates[i].end()), candidates[i].end()); 
+    has_candidates[i] = candidates[i].size() > 0; 
+    for (unsigned int c = 0; c < candidates[i].size(); c++){
+      if (candidates[i][c] != start + i) //filtering for self similarity
+	pairs.push_back(make_pair(candidates[i][c], i)); 
+    }
+    vector<int>().swap(candidates[i]); 
+  }
+  sort(pairs.begin(), pairs.end()); 
+  vector<double> sims(pairs.size(), 0.0); 
+  vector<long> chunk_offsets; 
+  vector<int> chunk_cols; 
+  vector<double> chunk_vals; 
+  for (unsigned int p = 0; p < pairs.size(); ){ //stream the candidate rows in chunks of at most buffer_entries entries
+    const int chunk_start = pairs[p].first; 
+    int chunk_end = chunk_start + 1; 
+    while (chunk_end < num_rows && row_offsets[chunk_end+1] - row_offsets[chunk_start] <= (long) buffer_entries)
+      chunk_end++; 
+    readRows(chunk_start, chunk_end, chunk_offsets, chunk_cols, chunk_vals); 
+    unsigned int p_end = p; 
+    while (p_end < pairs.size() && pairs[p_end].first < chunk_end)
+      p_end++; 
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (unsigned int q = p; q < p_end; q++){
+      const int i = pairs[q].second, j = pairs[q].first - chunk_start; 
+      const SparseRow row_i = {cols.data() + offsets[i], vals.data() + offsets[i], (int) (offsets[i+1] - offsets[i])}; 
+      const SparseRow row_j = {chunk_cols.data() + chunk_offsets[j], chunk_vals.data() + chunk_offsets[j], (int) (chunk_offsets[j+1] - chunk_offsets[j])}; 
+      sims[q] = cosineSimilarity(row_i, row_j, row_norms[start + i], row_norms[pairs[q].first]); 
+    }
+    p = p_end; 
+  }
+  vector<vector<pair<unsigned int, double> > > idxsAndDotProds(n); 
+  for (unsigned int p = 0; p < pairs.size(); p++){ //in ascending candidate order, as in Graph
+    if (sims[p] > 0)
+      idxsAndDotProds[pairs[p].second].push_back(make_pair(pairs[p].first, sims[p])); 
+  }
+  vector<pair<int,int> >().swap(pairs); 
+  vector<double>().swap(sims); 
+  vector<Edge> edges = vector<Edge>(); 
+  for (int i = 0; i < n; i++){
+    const int row = start + i; 
+    if (idxsAndDotProds[i].size() > 0){
+      sort(idxsAndDotProds[i].begin(), idxsAndDotProds[i].end(), moreSimilar); //in descending order, as in Graph
+      unsigned int topN = (k < idxsAndDotProds[i].size()) ? k : idxsAndDotProds[i].size(); 
+      for (unsigned int j = 0; j < topN; j++){ //each kNN edge and its transpose, halved, as in Graph::symmetrizeAndNormalize
+	Edge edge = {row, (int) idxsAndDotProds[i][j].first, 0.5*idxsAndDotProds[i][j].second}; 
+	Edge edge_t = {edge.col, row, edge.value}; 
+	edges.push_back(edge); 
+	edges.push_back(edge_t); 
+      }
+    }
+    else if (has_candidates[i])
+      negative_similarities++; 
+    else
+      featureless_phrases++; 
+    Edge self = {row, row, 0.5}; 
+    edges.push_back(self); 
+    edges.push_back(self); 
+    vector<pair<unsigned int, double> >().swap(idxsAndDotProds[i]); 
+  }
+  sort(edges.begin(), edges.end()); 
+  const string run_loc = tmp_prefix + RUN_EXT + to_string(run_files.size()); 
+  ofstream runFile(run_loc.c_str(), ios_base::out | ios_base::binary); 
+  if (!runFile.is_open()){ cerr << "Could not write temporary file " << run_loc << endl; exit(0); }
+  runFile.write(reinterpret_cast<const char*>(&num_rows), sizeof(int)); //runs start with the matrix dimension
+  if (edges.size() > 0)
+    runFile.write(reinterpret_cast<const char*>(&edges[0]), edges.size()*sizeof(Edge)); 
+  runFile.close(); 
+  run_files.push_back(run_loc); 
+}
+
+//k-way merge of the sorted runs. when normalizing, each row is complete once the merge moves past it, so it is
+//merged, normalized, and written out straight away; the body goes to a temporary file since the header needs the
+//final NNZ count. otherwise the merged edges are written as a single run (a partial graph from one shard)
+void OutOfCoreGraph::mergeRuns(const string outLoc, const bool normalize){
+  struct RunReader {
+    ifstream file; 
+    vector<Edge> buf; 
+    unsigned int pos, size; 
+    bool next(Edge& edge){
+      if (pos == size){
+	file.read(reinterpret_cast<char*>(&buf[0]), buf.size()*sizeof(Edge)); 
+	size = file.gcount() / sizeof(Edge); 
+	pos = 0; 
+	if (size == 0)
+	  return false; 
+      }
+      edge = buf[pos++]; 
+      return true; 
+    }
+  }; 
+  const unsigned int run_buffer = max(4096ul, buffer_entries / max((unsigned long) run_files.size(), 1ul)); 
+  vector<RunReader*> readers = vector<RunReader*>(); 
+  typedef pair<Edge, unsigned int> HeapEntry; 
+  auto later = [](const HeapEntry& lhs, const HeapEntry& rhs){ return rhs.first < lhs.first; }; 
+  priority_queue<HeapEntry, vector<HeapEntry>, decltype(later)> heap(later); 
+  for (unsigned int r = 0; r < run_files.size(); r++){
+    RunReader* reader = new RunReader(); 
+    reader->file.open(run_files[r].c_str(), ios_base::in | ios_base::binary); 
+    int run_rows = -1; 
+    reader->file.read(reinterpret_cast<char*>(&run_rows), sizeof(int)); 
+    if (!reader->file || (num_rows > 0 && run_rows != num_rows)){
+      cerr << "Could not read a " << num_rows << " row graph from " << run_files[r] << endl; 
+      exit(0); 
+    }
+    num_rows = run_rows; 
+    reader->buf.resize(run_buffer); 
+    reader->pos = 0, reader->size = 0; 
+    readers.push_back(reader); 
+    Edge edge; 
+    if (reader->next(edge))
+      heap.push(make_pair(edge, r)); 
+  }
+  long nnz = 0; 
+  const string body_loc = outLoc + BODY_EXT; 
+  const bool compact = CompactMatrixWriter::isCompactPrecision(precision); 
+  if (!normalize){
+    ofstream outFile(outLoc.c_str(), ios_base::out | ios_base::binary); 
+    if (!outFile.is_open()){ cerr << "Could not write partial graph to location " << outLoc << endl; exit(0); }
+    outFile.write(reinterpret_cast<const char*>(&num_rows), sizeof(int)); 
+    vector<Edge> out_buf = vector<Edge>(); 
+    out_buf.reserve(run_buffer); 
+    while (!heap.empty()){
+      HeapEntry top = heap.top(); 
+      heap.pop(); 
+      out_buf.push_back(top.first); 
+      if (out_buf.size() == run_buffer || heap.empty()){
+	outFile.write(reinterpret_cast<const char*>(&out_buf[0]), out_buf.size()*sizeof(Edge)); 
+	nnz += out_buf.size(); 
+	out_buf.clear(); 
+      }
+      Edge edge; 
+      if (readers[top.second]->next(edge))
+	heap.push(make_pair(edge, top.second)); 
+    }
+    outFile.close(); 
+  }
+  else {
+    CompactMatrixWriter* compactFile = compact ? new CompactMatrixWriter(outLoc, num_rows, num_rows, precision) : NULL; //its header is patched at the end, so no body file
+    ofstream bodyFile; 
+    if (!compact){
+      bodyFile.open(body_loc.c_str()); 
+      if (!bodyFile.is_open()){ cerr << "Could not write temporary file " << body_loc << endl; exit(0); }
+      bodyFile.flags(ios_base::scientific); 
+      bodyFile.precision(numeric_limits<double>::digits10 + 2); //as saveMarket
+    }
+    vector<pair<int,double> > row_entries = vector<pair<int,double> >(); 
+    vector<int> row_cols = vector<int>(); 
+    vector<double> row_vals = vector<double>(); 
+    int row = -1, rows_written = 0; 
+    while (true){
+      const bool done = heap.empty(); 
+      if (done || heap.top().first.row != row){ //flush the previous row
+	if (row >= 0 && !row_entries.empty()){ //nothing to flush before the first row
+	  double row_sum = 0.0; 
+	  for (unsigned int p = 0; p < row_entries.size(); p++)
+	    row_sum += row_entries[p].second; 
+	  const double row_sum_inv = 1.0 / row_sum; 
+	  if (compactFile != NULL){
+	    row_cols.clear(); 
+	    row_vals.clear(); 
+	    for (unsigned int p = 0; p < row_entries.size(); p++){
+	      row_cols.push_back(row_entries[p].first); 
+	      row_vals.push_back(row_entries[p].second * row_sum_inv); 
+	    }
+	    for (; rows_written < row; rows_written++) //rows without entries
+	      compactFile->writeRow(NULL, NULL, 0); 
+	    compactFile->writeRow(row_cols.data(), row_vals.data(), row_cols.size()); 
+	    rows_written++; 
+	  }
+	  else {
+	    for (unsigned int p = 0; p < row_entries.size(); p++)
+	      bodyFile << row + 1 << " " << row_entries[p].first + 1 << " " << row_entries[p].second * row_sum_inv << "\n"; 
+	  }
+	  nnz += row_entries.size(); 
+	  row_entries.clear(); 
+	}
+	if (done)
+	  break; 
+	row = heap.top().first.row; 
+      }
+      HeapEntry top = heap.top(); 
+      heap.pop(); 
+      if (row_entries.size() > 0 && row_entries.back().first == top.first.col) //an edge present in both K and K^T appears twice
+	row_entries.back().second += top.first.value; 
+      else
+	row_entries.push_back(make_pair(top.first.col, top.first.value)); 
+      Edge edge; 
+      if (readers[top.second]->next(edge))
+	heap.push(make_pair(edge, top.second)); 
+    }
+    if (compactFile != NULL){
+      compactFile->close(); 
+      delete compactFile; 
+    }
+    else
+      bodyFile.close(); 
+  }
+  for (unsigned int r = 0; r < readers.size(); r++){
+    readers[r]->file.close(); 
+    delete readers[r]; 
+    remove(run_files[r].c_str()); 
+  }
+  run_files.clear(); 
+  if (!normalize){
+    cout << "Partial graph with " << nnz << " edges written to " << outLoc << endl; 
+    return; 
+  }
+  if (!compact){
+    ofstream simMatFile(outLoc.c_str()); 
+    if (!simMatFile.is_open()){ cerr << "Could not write similarity matrix to location " << outLoc << endl; exit(0); }
+    string header; 
+    Eigen::internal::putMarketHeader<double>(header, 0); 
+    simMatFile << header << endl; 
+    simMatFile << num_rows << " " << num_rows << " " << nnz << "\n"; 
+    ifstream bodyIn(body_loc.c_str()); 
+    if (nnz > 0)
+      simMatFile << bodyIn.rdbuf(); 
+    bodyIn.close(); 
+    simMatFile.close(); 
+    remove(body_loc.c_str()); 
+  }
+  cout << "After symmetrizing (and normalizing), total NNZs in random walk matrix: " << nnz << endl; 
+}
+
+void OutOfCoreGraph::construct(const unsigned int k, const string simMatLoc){
+  computeRows(0, num_rows, k); 
+  mergeRuns(simMatLoc, true); 
+}
+
+//rows [start, end) in blocks of block_rows
+void OutOfCoreGraph::computeRows(const int start, const int end, const unsigned int k){
+  featureless_phrases = 0, negative_similarities = 0; 
+  ProgressReporter progress("constructGraphOutOfCore", end - start, "phrases"); 
+  for (int block_start = start; block_start < end; block_start += block_rows){
+    const int block_end = min(block_start + (int) block_rows, end); 
+    spillBlock(block_start, block_end, k); 
+    progress.add(block_end - block_start); 
+    cout << "Computed nearest neighbors for rows " << block_start << " to " << block_end - 1 << " of " << num_rows << endl; 
+  }
+  cout << "Number of phrases without neighbors (i.e., other phrases sharing one common non stop-word feature): " << featureless_phrases << endl; 
+  cout << "Number of phrases that have negative similarities with all neighbors: " << negative_similarities << endl; 
+}
+
+string OutOfCoreGraph::shardLocation(const string simMatLoc, const int shard, const int num_shards){
+  return simMatLoc + SHARD_EXT + to_string(shard) + "of" + to_string(num_shards); 
+}
+
+//the kNN lists of shard i of N, i.e., rows [i*R/N, (i+1)*R/N), with their transposes, as one sorted partial graph.
+//the kNN list of a row does not depend on the other rows' lists, so the shards can be computed independently
+void OutOfCoreGraph::constructShard(const unsigned int k, const int shard, const int num_shards, const string simMatLoc){
+  const int start = (long) num_rows * shard / num_shards; 
+  const int end = (long) num_rows * (shard + 1) / num_shards; 
+  cout << "Shard " << shard << " of " << num_shards << ": rows " << start << " to " << end - 1 << endl; 
+  computeRows(start, end, k); 
+  mergeRuns(shardLocation(simMatLoc, shard, num_shards), false); 
+}
+
+//symmetrizes and normalizes the N partial graphs into the similarity matrix; the result is the same as construct()
+void OutOfCoreGraph::mergeShards(const int num_shards, const string simMatLoc){
+  for (int shard = 0; shard < num_shards; shard++){
+    const string shard_loc = shardLocation(simMatLoc, shard, num_shards); 
+    ifstream shardFile(shard_loc.c_str()); 
+    if (!shardFile.is_open()){ cerr << "Could not find partial graph of shard " << shard << " at location " << shard_loc << endl; exit(0); }
+    run_files.push_back(shard_loc); 
+  }
+  mergeRuns(simMatLoc, true); 
+}
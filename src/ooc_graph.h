@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+
+using namespace std; 
+
+//kNN graph construction for feature matrices that do not fit in memory. the feature matrix is converted to on-disk
+//row (CSR) and posting list (CSC) files; rows are then processed in blocks against the posting lists, and each
+//block's top-k neighbors (and their transposes) are spilled to disk as a sorted run. merging the runs yields the
+//symmetrized, row-normalized similarity matrix one row at a time, so only the per-row offsets and norms, one block,
+//and one read buffer per run are in memory at once. the result is the same as Graph(features, k). the rows can also
+//be split into shards that are computed by separate processes (constructShard) and merged afterwards (mergeShards)
+class OutOfCoreGraph {
+ public:
+  OutOfCoreGraph(const string tmp_prefix, const unsigned int block_rows, const unsigned long buffer_entries, const string precision="double"); //precision of the similarity matrix file, as Graph::writeToFile
+  ~OutOfCoreGraph(); 
+  void readFeatures(const string featMatLoc, const string invIdxLoc); 
+  void construct(const unsigned int k, const string simMatLoc); 
+  void constructShard(const unsigned int k, const int shard, const int num_shards, const string simMatLoc); 
+  void mergeShards(const int num_shards, const string simMatLoc); 
+  static string shardLocation(const string simMatLoc, const int shard, const int num_shards); 
+  static bool readDimensions(const string featMatLoc, long& rows, long& cols, long& nnz); //from the MatrixMarket header
+
+ private:
+  struct Edge {
+    int row; 
+    int col; 
+    double value; 
+    bool operator<(const Edge& other) const { return (row != other.row) ? row < other.row : col < other.col; }
+  }; 
+  void writePostingFile(const set<unsigned int>& stop_features); 
+  void readRows(const int start, const int end, vector<long>& offsets, vector<int>& cols, vector<double>& vals); 
+  void spillBlock(const int start, const int end, const unsigned int k); 
+  void computeRows(const int start, const int end, const unsigned int k); 
+  void mergeRuns(const string outLoc, const bool normalize); 
+  string tmp_prefix; 
+  unsigned int block_rows; //rows per block
+  unsigned long buffer_entries; //feature matrix entries per read buffer
+  string precision; 
+  int num_rows; 
+  int num_features; 
+  vector<long> row_offsets; 
+  vector<double> row_norms; 
+  vector<long> posting_offsets; 
+  vector<string> run_files; 
+  unsigned int featureless_phrases; 
+  unsigned int negative_similarities; 
+}; 
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <stdio.h>
 #include <boost/program_options.hpp>
 #include <boost/program_options/variables_map.hpp>
 
@@ -14,17 +15,25 @@ Options::Options(int argc, char** argv){
   po::options_description clo("command line options");
   clo.add_options()
     ("config,c", po::value<string>(), "Configuration file")
+    ("shard", po::value<string>(), "For the 'ConstructGraphs' stage, given as i/N (0 <= i < N), only compute the nearest neighbors of the i-th of N row ranges and write them as a partial graph next to the similarity matrix; uses the out-of-core construction")
+    ("merge_shards", po::value<int>(), "For the 'ConstructGraphs' stage, symmetrize and normalize the partial graphs of this many shards (written with --shard) into the similarity matrix")
     ("help,?", "Print this help message and exit");
 
   po::options_description opts("configuration options");
   opts.add_options() //list all config options here
-    ("stage", po::value<string>(), "What stage to execute; values include SelectUnlabeled, SelectCorpora, ExtractFeatures, ConstructGraph, PropagateGraph")
+    ("stage", po::value<string>(), "What stage to execute; values include SelectUnlabeled, SelectCorpora, ExtractFeatures, ConstructGraph, PropagateGraph, Pipeline (ExtractFeatures through PropagateGraph in one process), and Serve (Pipeline, after which new source phrases are labeled against the graph kept in memory)")
     ("number_threads", po::value<int>()->default_value(8), "Number of threads to spawn for the parallelized processes (default: 8)")
+    ("metrics_report", po::value<string>()->default_value(""), "If defined, location to write a JSON report of the run to: the wall-clock time, CPU time, per-thread busy time and peak memory of each step, along with counters such as lines read, n-grams, candidates, cache hits and nonzeros (default: none)")
+    ("progress_interval", po::value<double>()->default_value(60), "Seconds between progress reports (count, rate, percent complete and ETA, on stderr) of long loops such as feature extraction, graph construction and propagation sweeps; 0 disables them (default: 60)")
+    ("memory_budget", po::value<double>()->default_value(0), "Memory budget in MB: feature extraction merges its buffered counts into the feature matrix before they take a quarter of it, graph construction switches to out-of-core if its estimate does not fit, and the dynamic target similarity cache is cleared before it takes a quarter of it; estimated sizes of the major data structures are printed after each step either way (default: 0, i.e., no budget)")
     ("phrase_table", po::value<string>()->default_value("-"), "Baseline phrase table location")
     ("phrase_table_format", po::value<string>()->default_value("cdec"), "Format of phrase table (default: cdec; accepted values: cdec, moses)")
     ("evaluation_corpus", po::value<string>()->default_value("-"), "Location of evaluation set, from which we extract our unknown phrases that we wish to label")
     ("phrase_length", po::value<int>()->default_value(2), "Phrase length for source-side phrases (default: 2)")
     ("write_unlabeled", po::value<string>()->default_value(""), "If defined, writes out unlabeled phrases from evaluation corpus to the specified location.  Needs to be defined if 'Stage' is 'SelectUnlabeled'")
+    ("use_cache", "Fingerprint the inputs of the phrase loading and graph construction steps, and reuse their outputs (phrase snapshot next to 'write_unlabeled', similarity matrix) when the inputs and relevant options are unchanged (default: false)")
+    ("checkpoint_prefix", po::value<string>()->default_value(""), "If defined, feature extraction writes a checkpoint to '<prefix>.source.extraction' or '<prefix>.target.extraction' every 'checkpoint_interval_lines' lines, and graph propagation to '<prefix>.propagation' after every iteration; a rerun with the same inputs and options resumes from the latest checkpoint. Checkpoints are removed once their step completes (default: none)")
+    ("checkpoint_interval_lines", po::value<int>()->default_value(1000000), "With 'checkpoint_prefix', number of monolingual corpus lines between feature extraction checkpoints (default: 1000000)")
     ("analyze_unlabeled", "Categorize unlabeled phrases into all unigrams known, no unigrams known, or some unigrams known")    
     ("corpora_selection_side", po::value<string>()->default_value("Source"), "For corpora selection, which side we are are selecting for; values include Source and Target")    
     ("source_mono_dir", po::value<string>()->default_value(""), "For source-side corpora selection, location of directory containing monolingual files")
@@ -51,16 +60,29 @@ Options::Options(int argc, char** argv){
     ("graph_construction_side", po::value<string>()->default_value("Source"), "For graph construction, which side to construct; values include Source and Target")
     ("graph_construction_method", po::value<string>()->default_value("CosineSim"), "For graph construction, which method to use (default: CosineSim)")
     ("k_nearest_neighbors", po::value<int>()->default_value(500), "Number of nearest neighbors to include when constructing the similarity graphs (default: 500)")    
-    ("source_similarity_matrix", po::value<string>()->default_value(""), "Location of source similarity matrix, in X format")
+    ("restrict_graph_to_unlabeled", "When constructing the source graph, only compute and store similarity rows for unlabeled phrases (plus the neighbor lists of their labeled neighbors, for symmetrizing); labeled phrases' rows are never read during propagation. Edges from labeled phrases that are not nearest neighbors of any unlabeled phrase are dropped (default: false)")
+    ("similarity_matrix_precision", po::value<string>()->default_value("double"), "Precision of the similarity matrices written by the 'ConstructGraphs' stage: double (MatrixMarket), or float, int16, or int8 for a compact binary file with delta-encoded column indices and 32-bit floats, or 16- or 8-bit values relative to each row's largest; later stages read either format (default: double)")
+    ("out_of_core_graph_construction", "For the 'ConstructGraphs' stage, build the similarity matrix block by block from on-disk copies of the feature matrix and posting lists, for feature matrices that do not fit in memory; temporary files are written next to the similarity matrix (default: false)")
+    ("out_of_core_block_rows", po::value<int>()->default_value(100000), "For out-of-core graph construction, number of rows whose nearest neighbors are computed (and spilled to disk) at a time (default: 100000)")
+    ("out_of_core_buffer_entries", po::value<int>()->default_value(1 << 25), "For out-of-core graph construction, maximum number of feature matrix or posting list entries read into memory at a time (default: 33554432)")
+    ("source_similarity_matrix", po::value<string>()->default_value(""), "Location of source similarity matrix, in X format; in the 'Serve' stage, the graph rows changed since the stage started are also written to '<location>.delta' after each batch (in the 'similarity_matrix_precision' format), and the new phrases' IDs are appended to '<location>.delta.phrases'")
     ("target_similarity_matrix", po::value<string>()->default_value(""), "Location of target similarity matrix, in X format")
     ("dynamic_similarity_matrix", "Whether to compute target phrase similarities on the fly and cache (true), or pre-compute target similarity matrix (false) (default: false)")
+    ("target_embeddings", po::value<string>()->default_value(""), "Location of dense target phrase embeddings in binary form (one unit-length float32 row per target phrase ID, memory-mapped); if defined, StructLabelProp uses the cosine similarities of the embeddings, computed on demand, instead of a target similarity matrix (default: none)")
+    ("target_embeddings_text", po::value<string>()->default_value(""), "Text file of target phrase embeddings, one 'phrase ||| v1 v2 ... vd' per line; the 'ConstructGraphs' stage on the target side converts it to 'target_embeddings', with rows by the IDs in 'target_phraseIDs', instead of building a target graph, and so do the 'Pipeline' and 'Serve' stages (default: none)")
+    ("precompute_target_similarities", "With 'dynamic_similarity_matrix' and StructLabelProp, compute the target similarities of exactly the candidate pairs that propagation will look up (each unlabeled phrase's candidates against its neighbors' labels) in parallel before propagating, instead of lazily (default: false)")
     ("analyze_similarity_matrix", "Whether to analyze the similarity matrix after it is constructed (default: false)")
     ("lexical_model_location", po::value<string>()->default_value(""), "Location of lexical model, which is used when sorting translation candidates for unlabeled phrases and also as a feature value when writing out the additional phrase table")
-    ("graph_propagation_algorithm", po::value<string>()->default_value("LabelProp"), "What graph propagation algorithm to use; choices include: LabelProp and StructLabelProp (default: LabelProp)")
+    ("graph_propagation_algorithm", po::value<string>()->default_value("LabelProp"), "What graph propagation algorithm to use; choices include: LabelProp, LabelPropSpMM (LabelProp as a parallel masked sparse matrix product; Jacobi rather than in-place updates), and StructLabelProp (default: LabelProp)")
     ("graph_propagation_iterations", po::value<int>()->default_value(3), "Number of iterations to propagate for (default: 3)")
+    ("propagation_processes", po::value<int>()->default_value(1), "For 'LabelPropSpMM', number of processes to split the propagation across on this machine; each process updates a range of the unlabeled phrases, and the label distributions are kept in shared memory (default: 1)")
+    ("propagation_tolerance", po::value<double>()->default_value(0), "Stop propagating once the total L1 change of the unlabeled phrases' label distributions in an iteration falls below this value; phrases whose own change is at most this value (and whose neighbors did not change) are skipped in later iterations (default: 0, i.e., run all 'graph_propagation_iterations')")
     ("filter_stop_words", "If true, then when we initialize the translation candidate lists for the unlabeled phrases we filter out candidates that only consist of stop words (default: false)")
     ("maximum_candidate_size", po::value<int>()->default_value(50), "Maximum number of candidates to consider for each unlabeled phrase (default: 50)")
-    ("expanded_phrase_table_loc", po::value<string>()->default_value(""), "Location to write the new phrases along with their features"); 
+    ("expanded_phrase_table_loc", po::value<string>()->default_value(""), "Location to write the new phrases along with their features")
+    ("serve_socket", po::value<string>()->default_value(""), "For the 'Serve' stage, path of a unix domain socket to accept connections on, one at a time; each connection sends source phrases one per line, with an empty line after each batch, and gets back the phrase table entries of the batch's phrases that are not in the phrase table, followed by an empty line (default: none, i.e., the same protocol on standard input and output, with log messages on standard error)")
+    ("serve_propagation_hops", po::value<int>()->default_value(0), "For the 'Serve' stage, the unlabeled phrases up to this many edges away from a batch's new phrases are also updated by its propagation sweeps; the distributions of all other phrases are left as they are (default: 0, i.e., only the new phrases)")
+    ("serve_monolingual", po::value<string>()->default_value(""), "For the 'Serve' stage, uncompressed source monolingual corpus to extract the contexts of new phrases from (default: 'source_monolingual')"); 
 
   if (argc > 1){    
     po::store(po::parse_command_line(argc, argv, clo), conf); 
@@ -70,6 +92,10 @@ Options::Options(int argc, char** argv){
       exit(0); 
     }
     else if (conf.count("config")){    
+      if (conf.count("shard") && conf.count("merge_shards")){
+	cerr << "Cannot compute a shard and merge the shards in the same run; run with --shard i/N once per shard, then with --merge_shards N" << endl; 
+	exit(0); 
+      }
       string config_loc = conf["config"].as<string>();
       ifstream config_FH(config_loc.c_str());
       po::store(po::parse_config_file(config_FH, opts), conf); 
@@ -110,6 +136,31 @@ void Options::checkParameterConsistency(){
   else {
     string stage = conf["stage"].as<string>();
     transform(stage.begin(), stage.end(), stage.begin(), ::tolower);
+    if ((conf.count("shard") || conf.count("merge_shards")) && stage != "constructgraphs"){
+      cerr << "'--shard' and '--merge_shards' are only valid for the 'ConstructGraphs' stage" << endl; 
+      exit(0); 
+    }
+    if (stage == "propagategraph" || stage == "pipeline" || stage == "serve"){
+      string algo = conf["graph_propagation_algorithm"].as<string>(); 
+      transform(algo.begin(), algo.end(), algo.begin(), ::tolower); 
+      if (conf["propagation_processes"].as<int>() < 1 || (conf["propagation_processes"].as<int>() > 1 && algo != "labelpropspmm")){
+	cerr << "'propagation_processes' should be at least 1, and more than one process is only supported for the 'LabelPropSpMM' algorithm" << endl; 
+	exit(0); 
+      }
+      if (conf["target_embeddings"].as<string>() != "" && conf.count("dynamic_similarity_matrix")){
+	cerr << "'target_embeddings' replaces the target similarity matrix; it cannot be combined with 'dynamic_similarity_matrix'" << endl; 
+	exit(0); 
+      }
+    }
+    if (conf["target_embeddings_text"].as<string>() != "" && conf["target_embeddings"].as<string>() == ""){
+      cerr << "'target_embeddings_text' is converted to the binary embeddings at 'target_embeddings'; please define that field as well" << endl; 
+      exit(0); 
+    }
+    string precision = conf["similarity_matrix_precision"].as<string>(); 
+    if (precision != "double" && precision != "float" && precision != "int16" && precision != "int8"){
+      cerr << "The only values supported for the 'similarity_matrix_precision' field are 'double', 'float', 'int16', and 'int8'" << endl; 
+      exit(0); 
+    }
     if (stage == "selectunlabeled"){
       if (!(conf.count("phrase_table")) || !(conf.count("phrase_table_format")) || !(conf.count("write_unlabeled")) || !(conf.count("evaluation_corpus"))){
 	cerr << "For 'SelectUnlabeled' stage, need to define 'phrase_table', 'phrase_table_format', 'write_unlabeled', and 'evaluation_corpus' fields" << endl; 
@@ -160,6 +211,25 @@ void Options::checkParameterConsistency(){
 	cerr << "Cannot analyze dynamic similarity matrix; please disable 'analyze_similarity_matrix' flag" << endl; 
 	exit(0); 
       }
+      else if (conf.count("out_of_core_graph_construction") && (conf.count("analyze_similarity_matrix") || conf.count("restrict_graph_to_unlabeled"))){
+	cerr << "'out_of_core_graph_construction' does not keep the similarity matrix in memory; it cannot be combined with 'analyze_similarity_matrix' or 'restrict_graph_to_unlabeled'" << endl; 
+	exit(0); 
+      }
+      else if ((conf.count("shard") || conf.count("merge_shards")) && (conf.count("dynamic_similarity_matrix") || conf.count("analyze_similarity_matrix") || conf.count("restrict_graph_to_unlabeled"))){
+	cerr << "Sharded graph construction cannot be combined with 'dynamic_similarity_matrix', 'analyze_similarity_matrix', or 'restrict_graph_to_unlabeled'" << endl; 
+	exit(0); 
+      }
+      else if (conf.count("shard")){
+	int shard = -1, num_shards = 0; 
+	if (sscanf(conf["shard"].as<string>().c_str(), "%d/%d", &shard, &num_shards) != 2 || shard < 0 || shard >= num_shards){
+	  cerr << "The '--shard' argument should be of the form i/N, with 0 <= i < N" << endl; 
+	  exit(0); 
+	}
+      }
+      else if (conf.count("merge_shards") && conf["merge_shards"].as<int>() < 1){
+	cerr << "The '--merge_shards' argument should be the (positive) number of shards" << endl; 
+	exit(0); 
+      }
     }
     else if (stage == "propagategraph"){
       if (!(conf.count("source_similarity_matrix")) || !(conf.count("target_phraseIDs")) || !(conf.count("lexical_model_location"))){
@@ -168,8 +238,8 @@ void Options::checkParameterConsistency(){
       }
       string algo = conf["graph_propagation_algorithm"].as<string>();
       transform(stage.begin(), stage.end(), stage.begin(), ::tolower);
-      if ((algo == "structlabelprop") && !(conf.count("target_similarity_matrix"))){
-	cerr << "For 'PropagateGraphs' stage, if 'StructLabelProp' is the graph propagation algorithm, then you must define 'target_similarity_matrix' field" << endl; 
+      if ((algo == "structlabelprop") && !(conf.count("target_similarity_matrix") || conf["target_embeddings"].as<string>() != "")){
+	cerr << "For 'PropagateGraphs' stage, if 'StructLabelProp' is the graph propagation algorithm, then you must define the 'target_similarity_matrix' or 'target_embeddings' field" << endl; 
 	exit(0);	
       }
       if (!(conf.count("phrase_table_format"))){
@@ -177,6 +247,21 @@ void Options::checkParameterConsistency(){
 	exit(0); 
       }
     }
+    else if (stage == "pipeline" || stage == "serve"){
+      if (!(conf.count("source_monolingual")) || !(conf.count("target_monolingual")) || !(conf.count("target_phraseIDs")) || !(conf.count("source_stopwords")) || !(conf.count("target_stopwords"))){
+	cerr << "For 'Pipeline' and 'Serve' stages, need to define the same inputs as the 'ExtractFeatures' stage: 'source_monolingual', 'target_monolingual', 'target_phraseIDs', 'source_stopwords', and 'target_stopwords'" << endl; 
+	exit(0);
+      }
+      if (!(conf.count("lexical_model_location")) || !(conf.count("mbest_processed_location")) || !(conf.count("expanded_phrase_table_loc"))){
+	cerr << "For 'Pipeline' and 'Serve' stages, need to define the lexical model location, the processed m-best list location, and the output location for new phrases" << endl; 
+	exit(0);
+      }
+      if (stage == "serve" && conf.count("restrict_graph_to_unlabeled")){
+	cerr << "The 'Serve' stage inserts new phrases into the full source graph; it cannot be combined with 'restrict_graph_to_unlabeled'" << endl; 
+	exit(0); 
+      }
+      //intermediate matrices ('*_cooc_matrix', '*_feature_matrix', '*_feature_extractor', '*_similarity_matrix') are optional checkpoints in this stage
+    }
     else {
       cerr << "Invalid stage defined in config file; Please have a look at ./graph_prop --help" << endl; 
       exit(0);
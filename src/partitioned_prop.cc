@@ -0,0 +1,209 @@
+#include <iostream>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "partitioned_prop.h"
+
+using namespace std; 
+
+PartitionedLabelProp::PartitionedLabelProp(Graph* graph, Phrases* src_phrases, const int num_processes) :
+  sim_mat(graph->getSimilarityMatrix()), num_processes(num_processes) {
+  num_rows = sim_mat.rows(); 
+  offsets.assign(num_rows + 1, 0); 
+  labeled.assign(num_rows, false); 
+  int num_unlabeled = 0; 
+  for (int i = 0; i < num_rows; i++){
+    Phrases::Phrase* phrase = src_phrases->getNthPhrase(i); 
+    labeled[i] = phrase->isLabeled(); 
+    offsets[i+1] = offsets[i] + phrase->label_distribution.size(); 
+    if (!labeled[i])
+      num_unlabeled++; 
+  }
+  row_ranges.assign(num_processes + 1, num_rows); //balanced by the number of unlabeled phrases
+  row_ranges[0] = 0; 
+  int seen = 0, p = 1; 
+  for (int i = 0; i < num_rows; i++){
+    while (p < num_processes && seen >= (long) num_unlabeled * p / num_processes)
+      row_ranges[p++] = i; 
+    if (!labeled[i])
+      seen++; 
+  }
+  const long nnz = offsets[num_rows]; 
+  shared_bytes = sizeof(Control) + 2*nnz*sizeof(double) + num_processes*sizeof(double) + 2*nnz*sizeof(int) + 2*num_rows*sizeof(int) + 2*num_rows; 
+  shared = mmap(NULL, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0); 
+  if (shared == MAP_FAILED){ cerr << "Could not allocate " << shared_bytes << " bytes of shared memory for partitioned propagation" << endl; exit(0); }
+  control = static_cast<Control*>(shared); 
+  probs[0] = reinterpret_cast<double*>(control + 1); //doubles first, then ints, then flags, so everything stays aligned
+  probs[1] = probs[0] + nnz; 
+  residuals = probs[1] + nnz; 
+  labels[0] = reinterpret_cast<int*>(residuals + num_processes); 
+  labels[1] = labels[0] + nnz; 
+  lens[0] = labels[1] + nnz; 
+  lens[1] = lens[0] + num_rows; 
+  active = reinterpret_cast<char*>(lens[1] + num_rows); 
+  active_next = active + num_rows; 
+  for (int i = 0; i < num_rows; i++){
+    map<int,double>& distr = src_phrases->getNthPhrase(i)->label_distribution; 
+    long slot = offsets[i]; 
+    for (map<int,double>::const_iterator it = distr.begin(); it != distr.end(); it++, slot++){
+      labels[0][slot] = labels[1][slot] = it->first; 
+      probs[0][slot] = probs[1][slot] = it->second; 
+    }
+    lens[0][i] = lens[1][i] = distr.size(); 
+    if (!labeled[i]) //held in shared memory until copyDistributions
+      map<int,double>().swap(distr); 
+  }
+  pthread_barrierattr_t attr; 
+  pthread_barrierattr_init(&attr); 
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED); 
+  pthread_barrier_init(&control->barrier, &attr, num_processes); 
+  pthread_barrierattr_destroy(&attr); 
+  control->stop = 0; 
+  cur = 0; 
+  cout.flush(); //otherwise the workers would repeat buffered output
+  workers = vector<pid_t>(); 
+  for (int p = 1; p < num_processes; p++){ //this process is worker 0
+    pid_t pid = fork(); 
+    if (pid < 0){ cerr << "Could not fork propagation worker " << p << endl; exit(0); }
+    if (pid == 0){
+      work(p); 
+      _exit(0); //skip the parent's destructors and exit handlers
+    }
+    workers.push_back(pid); 
+  }
+  cout << "Partitioned propagation over " << num_processes << " processes; label distributions in shared memory: " << shared_bytes / (1024.0 * 1024.0) << " MB" << endl; 
+}
+
+PartitionedLabelProp::~PartitionedLabelProp(){
+  control->stop = 1; 
+  pthread_barrier_wait(&control->barrier); 
+  for (unsigned int p = 0; p < workers.size(); p++)
+    waitpid(workers[p], NULL, 0); 
+  pthread_barrier_destroy(&control->barrier); 
+  munmap(shared, shared_bytes); 
+}
+
+//worker loop: one update of the owned rows per iteration, until the parent stops propagation. no OpenMP here, since
+//the workers are forked from a process that has already used it
+void PartitionedLabelProp::work(const int process){
+  while (true){
+    pthread_barrier_wait(&control->barrier); //iteration start (active flags and tolerance set)
+    if (control->stop)
+      return; 
+    residuals[process] = updateRows(process, control->tolerance); 
+    pthread_barrier_wait(&control->barrier); //all rows written to the next buffer
+    cur = 1 - cur; 
+  }
+}
+
+double PartitionedLabelProp::labelProp(vector<unsigned int>& active_set, const double tolerance){
+  memset(active, 0, num_rows); 
+  for (unsigned int i = 0; i < active_set.size(); i++)
+    active[active_set[i]] = 1; 
+  control->tolerance = tolerance; 
+  pthread_barrier_wait(&control->barrier); 
+  residuals[0] = updateRows(0, tolerance); 
+  pthread_barrier_wait(&control->barrier); 
+  cur = 1 - cur; 
+  double residual = 0.0; 
+  for (int p = 0; p < num_processes; p++)
+    residual += residuals[p]; 
+  active_set.clear(); 
+  for (int i = 0; i < num_rows; i++){
+    if (active_next[i])
+      active_set.push_back(i); 
+  }
+  memset(active_next, 0, num_rows); 
+  return residual; 
+}
+
+//the masked product of Graph::labelPropSpMM for the active rows this process owns, reading the current buffer and
+//writing the next one; inactive rows are carried over. returns the L1 change of the owned rows
+double PartitionedLabelProp::updateRows(const int process, const double tolerance){
+  const int next = 1 - cur; 
+  double residual = 0.0; 
+  vector<double> labelMass = vector<double>(); 
+  vector<bool> reached = vector<bool>(); 
+  for (int row = row_ranges[process]; row < row_ranges[process+1]; row++){
+    if (labeled[row]) //same in both buffers
+      continue; 
+    const long slot = offsets[row]; 
+    const int len = lens[cur][row]; 
+    memcpy(labels[next] + slot, labels[cur] + slot, len*sizeof(int)); 
+    memcpy(probs[next] + slot, probs[cur] + slot, len*sizeof(double)); 
+    lens[next][row] = len; 
+    if (!active[row] || sim_mat.row(row).nonZeros() <= 1) //inactive, or no neighbors
+      continue; 
+    const int* ownLabels = labels[cur] + slot; 
+    labelMass.assign(len, 0.0); 
+    reached.assign(len, false); 
+    for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, row); it; ++it){
+      if (it.col() == row) //filtering for self-similarity
+	continue; 
+      const long n_slot = offsets[it.col()]; 
+      const int n_len = lens[cur][it.col()]; 
+      int k = 0, m = 0; 
+      while (m < n_len && k < len){ //both label lists are sorted
+	if (labels[cur][n_slot + m] < ownLabels[k])
+	  m++; 
+	else if (ownLabels[k] < labels[cur][n_slot + m])
+	  k++; 
+	else {
+	  labelMass[k] += probs[cur][n_slot + m]*it.value(); 
+	  reached[k] = true; 
+	  m++; 
+	  k++; 
+	}
+      }
+    }
+    int new_len = 0; 
+    double normalizer = 0.0; 
+    for (int k = 0; k < len; k++){
+      if (reached[k]){
+	labels[next][slot + new_len] = ownLabels[k]; 
+	probs[next][slot + new_len] = labelMass[k]; 
+	normalizer += labelMass[k]; 
+	new_len++; 
+      }
+    }
+    if (new_len == 0) //keep the carried over distribution
+      continue; 
+    for (int q = 0; q < new_len; q++)
+      probs[next][slot + q] /= normalizer; 
+    lens[next][row] = new_len; 
+    double row_residual = 0.0; //L1 distance, as Graph::l1Distance
+    int l = 0, r = 0; 
+    const int* old_labels = labels[cur] + slot; 
+    const int* new_labels = labels[next] + slot; 
+    while (l < len || r < new_len){
+      if (r == new_len || (l < len && old_labels[l] < new_labels[r]))
+	row_residual += fabs(probs[cur][slot + l++]); 
+      else if (l == len || new_labels[r] < old_labels[l])
+	row_residual += fabs(probs[next][slot + r++]); 
+      else
+	row_residual += fabs(probs[cur][slot + l++] - probs[next][slot + r++]); 
+    }
+    residual += row_residual; 
+    if (!(row_residual <= tolerance)){ //as Graph::activateNeighbors; flags may be set by several processes at once
+      active_next[row] = 1; 
+      for (SparseMatrix<double,RowMajor>::InnerIterator it(sim_mat, row); it; ++it){
+	if (it.col() != row && !labeled[it.col()])
+	  active_next[it.col()] = 1; 
+      }
+    }
+  }
+  return residual; 
+}
+
+void PartitionedLabelProp::copyDistributions(Phrases* src_phrases){
+  for (int i = 0; i < num_rows; i++){
+    if (labeled[i])
+      continue; 
+    map<int,double>& distr = src_phrases->getNthPhrase(i)->label_distribution; 
+    distr.clear(); 
+    for (long slot = offsets[i]; slot < offsets[i] + lens[cur][i]; slot++)
+      distr.insert(distr.end(), make_pair(labels[cur][slot], probs[cur][slot])); 
+  }
+}
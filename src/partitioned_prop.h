@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include "graph.h"
+
+using namespace std; 
+
+//LabelPropSpMM split across worker processes forked on one machine. during propagation the label distributions live
+//in a shared memory, double-buffered CSR array instead of per-phrase maps: every phrase has a fixed slot sized for its
+//initial candidates (label sets only shrink). each process owns a range of unlabeled phrases and writes their new
+//distributions into the next buffer, reading its neighbors' distributions (the halo, possibly owned by other
+//processes) from the current one; the buffers swap at a process-shared barrier. the result is the same as
+//Graph::labelPropSpMM
+class PartitionedLabelProp {
+ public:
+  PartitionedLabelProp(Graph* graph, Phrases* src_phrases, const int num_processes); //moves the unlabeled phrases' distributions into shared memory
+  ~PartitionedLabelProp(); 
+  double labelProp(vector<unsigned int>& active_set, const double tolerance); //same contract as Graph::labelProp
+  void copyDistributions(Phrases* src_phrases); //writes the current distributions back to the unlabeled phrases
+
+ private:
+  struct Control {
+    pthread_barrier_t barrier; 
+    int stop; 
+    double tolerance; 
+  }; 
+  void work(const int process); 
+  double updateRows(const int process, const double tolerance); 
+  const SparseMatrix<double,RowMajor>& sim_mat; 
+  int num_processes; 
+  int num_rows; 
+  vector<long> offsets; //slot of each phrase in the label arrays
+  vector<bool> labeled; 
+  vector<int> row_ranges; //process p owns the unlabeled phrases in rows [row_ranges[p], row_ranges[p+1])
+  vector<pid_t> workers; 
+  int cur; //which of the two buffers holds the current distributions
+  void* shared; 
+  size_t shared_bytes; 
+  Control* control; 
+  double* probs[2]; 
+  int* labels[2]; 
+  int* lens[2]; 
+  double* residuals; //one per process
+  char* active; 
+  char* active_next; 
+}; 
@@ -1,24 +1,32 @@
 #include "phrases.h"
 #include "featext.h"
+#include "metrics.h"
+#include "line_reader.h"
 #include <iostream>
 #include <fstream>
 #include <numeric>
 #include <set>
 #include <math.h>
+#include <stdio.h>
+#include <omp.h>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/vector.hpp>
-#include <boost/lexical_cast.hpp>
+#include <boost/serialization/string.hpp>
 
 namespace io = boost::iostreams;
 namespace fs = boost::filesystem;
 using namespace std;
 const string delimiter = " ||| "; 
+const unsigned int PT_WRITE_CHUNK_SIZE = 256; //unlabeled phrases per output chunk when writing the phrase table
+const double MAX_NEG_LOG_PROB = 99; 
 
 //standard constructor
 Phrases::Phrases(){
@@ -75,10 +83,10 @@ void Phrases::readPhraseIDsFromFile(const string filename, const bool readLabele
   if (readLabeled)
     cerr << "Error: 'readLabeled' = true for readPhraseIDs not implemented" << endl; 
   else { 
-    ifstream phraseIDs(filename.c_str());
+    LineReader phraseIDs(filename);
     if (phraseIDs.is_open()){
       string line;
-      while (getline(phraseIDs, line)){
+      while (phraseIDs.getline(line)){
 	boost::trim(line);
 	vector<string> elements = multiCharSplitter(line);
 	assert(elements.size() == 2);
@@ -87,7 +95,6 @@ void Phrases::readPhraseIDsFromFile(const string filename, const bool readLabele
 	if (phrStr2ID.find(elements[0]) == phrStr2ID.end()) //i.e., we have not taken the label from the phrase table, it is a generated label that we are reading from file
 	  initPhrase(elements[0], tokens, atoi(elements[1].c_str()), false); 
       }
-      phraseIDs.close();    
     }
     else { cerr << "Could not read phrase IDs at location " << filename << endl; exit(0); }
   }
@@ -96,10 +103,10 @@ void Phrases::readPhraseIDsFromFile(const string filename, const bool readLabele
 
 //N.B.: temporary change to this function - revert back later
 void Phrases::readLabelPhraseIDsFromFile(const string filename){
-  ifstream phraseIDs(filename.c_str()); 
+  LineReader phraseIDs(filename); 
   if (phraseIDs.is_open()){
     string line; 
-    while (getline(phraseIDs, line)){
+    while (phraseIDs.getline(line)){
       boost::trim(line);
       vector<string> elements = multiCharSplitter(line); 
       assert(elements.size() == 2); 
@@ -109,59 +116,177 @@ void Phrases::readLabelPhraseIDsFromFile(const string filename){
 	label_phrID2Str[atoi(elements[1].c_str())] = elements[0]; 
       }
     }
-    phraseIDs.close(); 
     cout << "Total number of label phrases now: " << label_phrStr2ID.size() << endl; 
   }
   else { cerr << "Could not read phrase IDs for labels at location " << filename << endl; exit(0); }
 }
 
+//appends a double to a line with the same precision lexical_cast would use, but without a stringstream
+static void appendDouble(string& line, const double val){
+  char buf[32]; 
+  const int len = snprintf(buf, sizeof(buf), "%.17g", val); 
+  line.append(buf, len); 
+}
+
+//cdec grammars store features as -log10 probabilities
+static double negLog10(const double prob){
+  return (prob > 0) ? -log10(prob) : MAX_NEG_LOG_PROB; 
+}
+
+//formats all phrase pairs for one unlabeled phrase and appends them to buf; returns the number of lines added
+unsigned int Phrases::formatPhrasePairs(Phrase* phrase, Phrases* tgt_phrases, const string& pt_format, LexicalScorer* const lex, string& buf, int& num_tgt_marginal_pos){
+  vector<string> srcPhrases = vector<string>();
+  vector<string> tgtPhrases = vector<string>(); 
+  vector<pair<double, double> > fwd_bwd_prob = vector<pair<double, double> >(); 
+  for (map<int,double>::const_iterator it = phrase->label_distribution.begin(); it != phrase->label_distribution.end(); it++){
+    const double tgt_marginal = tgt_phrases->getNthPhrase(it->first)->marginal; 
+    if (tgt_marginal > 0){
+      num_tgt_marginal_pos++; 
+      srcPhrases.push_back(phrase->phrase_str); 
+      tgtPhrases.push_back(getLabelPhraseStr(it->first)); 
+      double fwd_prob = it->second;
+      if (fwd_prob == 0){
+        #pragma omp critical(writeStatsToStdOut)
+	cout << "Phrase pair '" << phrase->phrase_str << " ||| " << tgtPhrases.back() << "' with IDs (" << phrase->id << "," << it->first <<") has P(e|f) = 0" << endl; 
+      }
+      double bwd_prob = fwd_prob * (phrase->marginal / tgt_marginal); 
+      fwd_bwd_prob.push_back(make_pair(fwd_prob, bwd_prob)); 
+    }
+  }
+  vector<pair<double, double> > lex_scores = lex->scorePhrasePairs(srcPhrases, tgtPhrases); 
+  unsigned int num_lines = 0; 
+  for (unsigned int j = 0; j < srcPhrases.size(); j++){
+    if (fwd_bwd_prob[j].first > 0){
+      num_lines++; 
+      if (pt_format == "cdec"){ //cdec order: [X] ||| f ||| e ||| named features as -log10 values
+	buf += "[X]" + delimiter + srcPhrases[j] + delimiter + tgtPhrases[j] + delimiter; 
+	buf += "EgivenFCoherent="; 
+	appendDouble(buf, negLog10(fwd_bwd_prob[j].first)); 
+	buf += " FgivenE="; 
+	appendDouble(buf, negLog10(fwd_bwd_prob[j].second)); 
+	buf += " MaxLexFgivenE="; 
+	appendDouble(buf, negLog10(lex_scores[j].second)); 
+	buf += " MaxLexEgivenF="; 
+	appendDouble(buf, negLog10(lex_scores[j].first)); 
+	buf += '\n'; 
+      }
+      else { //moses order is P(f|e) lex(f|e) P(e|f) lex(e|f)
+	buf += srcPhrases[j] + delimiter + tgtPhrases[j] + delimiter; 
+	appendDouble(buf, fwd_bwd_prob[j].second); 
+	buf += ' '; 
+	appendDouble(buf, lex_scores[j].second); 
+	buf += ' '; 
+	appendDouble(buf, fwd_bwd_prob[j].first); 
+	buf += ' '; 
+	appendDouble(buf, lex_scores[j].first); 
+	buf += delimiter + "\n"; 
+      }
+    }
+    //don't think i need to do anything with alignments or counts      
+  }
+  return num_lines; 
+}
+
+string Phrases::formatPhraseTableEntries(Phrase* phrase, Phrases* tgt_phrases, const string pt_format, LexicalScorer* const lex){
+  string buf = ""; 
+  int num_tgt_marginal_pos = 0; 
+  if (phrase->marginal > 0) //otherwise we have not seen the phrase in the monolingual corpus at all
+    formatPhrasePairs(phrase, tgt_phrases, pt_format, lex, buf, num_tgt_marginal_pos); 
+  return buf; 
+}
+
+//unlabeled phrases are formatted in parallel in fixed-size chunks; each chunk goes to its own buffer
+//and buffers are flushed in order, so output is identical to a sequential pass. '.gz' output is compressed inline. 
 void Phrases::writePhraseTable(Phrases* tgt_phrases, const string pt_format, const string new_pt_loc, LexicalScorer* const lex){
-  ofstream out(new_pt_loc.c_str());  
-  assert(out != NULL); 
+  assert(pt_format == "moses" || pt_format == "cdec"); 
+  ofstream out_file(new_pt_loc.c_str(), ios_base::out | ios_base::binary);  
+  if (!out_file.is_open()){ cerr << "Could not write expanded phrase table to location " << new_pt_loc << endl; exit(0); }
+  io::filtering_stream<io::output> out; 
+  if (fs::path(new_pt_loc).extension() == ".gz")
+    out.push(io::gzip_compressor()); 
+  out.push(out_file); 
   vector<Phrase*> unlabeled_phrases = getUnlabeledPhrases();
   int num_src_marginal_pos = 0;
   int num_tgt_marginal_pos = 0; 
   int num_prob_pos = 0; 
   cout << "Number of unlabeled phrases to write out: " << unlabeled_phrases.size() << endl; 
-  for (unsigned int i = 0; i < unlabeled_phrases.size(); i++){
-    Phrase* phrase = unlabeled_phrases[i]; 
-    if (phrase->marginal > 0){ //otherwise we have not seen the phrase in the monolingual corpus at all
-      num_src_marginal_pos++; 
-      set<int> labels = phrase->getLabels(); 
-      vector<string> srcPhrases = vector<string>();
-      vector<string> tgtPhrases = vector<string>(); 
-      vector<pair<double, double> > fwd_bwd_prob = vector<pair<double, double> >(); 
-      for (set<int>::iterator it = labels.begin(); it != labels.end(); it++){
-	if (tgt_phrases->getNthPhrase(*it)->marginal > 0){
-	  num_tgt_marginal_pos++; 
-	  srcPhrases.push_back(phrase->phrase_str); 
-	  tgtPhrases.push_back(getLabelPhraseStr(*it)); 
-	  double fwd_prob = phrase->label_distribution[*it];
-	  if (fwd_prob == 0)
-	    cout << "Phrase pair '" << phrase->phrase_str << " ||| " << getLabelPhraseStr(*it) << "' with IDs (" << phrase->id << "," << *it <<") has P(e|f) = 0" << endl; 
-	  double bwd_prob = fwd_prob * (phrase->marginal / tgt_phrases->getNthPhrase(*it)->marginal); 
-	  fwd_bwd_prob.push_back(make_pair(fwd_prob, bwd_prob)); 
+  const unsigned int numChunks = (unlabeled_phrases.size() + PT_WRITE_CHUNK_SIZE - 1) / PT_WRITE_CHUNK_SIZE; 
+  const unsigned int chunksPerBatch = 4*omp_get_max_threads(); //bounds the amount of formatted text held in memory
+  vector<string> chunk_buffers(chunksPerBatch); 
+  for (unsigned int batchStart = 0; batchStart < numChunks; batchStart += chunksPerBatch){
+    const unsigned int batchEnd = min(numChunks, batchStart + chunksPerBatch); 
+    #pragma omp parallel for schedule(dynamic) reduction(+:num_src_marginal_pos,num_tgt_marginal_pos,num_prob_pos)
+    for (unsigned int c = batchStart; c < batchEnd; c++){
+      string& buf = chunk_buffers[c - batchStart]; 
+      buf.clear(); 
+      const unsigned int end = min((unsigned int) unlabeled_phrases.size(), (c+1)*PT_WRITE_CHUNK_SIZE); 
+      for (unsigned int i = c*PT_WRITE_CHUNK_SIZE; i < end; i++){
+	Phrase* phrase = unlabeled_phrases[i]; 
+	if (phrase->marginal > 0){ //otherwise we have not seen the phrase in the monolingual corpus at all
+	  num_src_marginal_pos++; 
+	  num_prob_pos += formatPhrasePairs(phrase, tgt_phrases, pt_format, lex, buf, num_tgt_marginal_pos); 
 	}
       }
-      vector<pair<double, double> > lex_scores = lex->scorePhrasePairs(srcPhrases, tgtPhrases); 
-      //need to incorporate cdec style grammar writing here, but for now just work with moses
-      assert(pt_format == "moses"); //moses order is P(f|e) lex(f|e) P(e|f) lex(e|f)
-      for (unsigned int j = 0; j < srcPhrases.size(); j++){
-	if (fwd_bwd_prob[j].first > 0){
-	  num_prob_pos++; 
-	  string output_line = srcPhrases[j] + " ||| " + tgtPhrases[j] + " ||| " + boost::lexical_cast<string>(fwd_bwd_prob[j].second) + " " + boost::lexical_cast<string>(lex_scores[j].second) + " " + boost::lexical_cast<string>(fwd_bwd_prob[j].first) + " " + boost::lexical_cast<string>(lex_scores[j].first) + " ||| ";
-	  out << output_line << endl; 
-	}
-	//don't think i need to do anything with alignments or counts      
-      }
     }
+    for (unsigned int c = batchStart; c < batchEnd; c++)
+      out.write(chunk_buffers[c - batchStart].data(), chunk_buffers[c - batchStart].size()); 
   }
-  out.close(); 
+  out.reset(); //flushes the compressor (if any) and closes the file
+  Metrics::addCount("phrase_pairs_written", num_prob_pos); 
   cout << "Number of source marginal positive phrases: " << num_src_marginal_pos << endl; 
   cout << "Number of target marginal positive phrases out of valid phrase pairs: " << num_tgt_marginal_pos << endl; 
   cout << "Number of valid lexical score phrase pairs: " << num_prob_pos << endl; 
 }
 
+//binary snapshot of the phrase inventory (phrases, label distributions, and the label/vocab maps), 
+//used to skip re-reading the phrase table and evaluation corpus when they have not changed
+void Phrases::writeSnapshot(const string filename){
+  ofstream outFile(filename.c_str(), ios_base::out | ios_base::binary); 
+  if (!outFile.is_open()){ cerr << "Could not write phrases snapshot to location " << filename << endl; return; }
+  boost::archive::binary_oarchive oa(outFile); 
+  const unsigned int numPhrases = all_phrases.size(); 
+  oa << numPhrases; 
+  for (unsigned int i = 0; i < numPhrases; i++){
+    const Phrase* phrase = all_phrases[i]; 
+    oa << phrase->id << phrase->phrase_str << phrase->labeled << phrase->label_distribution; 
+  }
+  string maxSrc, maxTgt; 
+  unsigned int maxPL; 
+  tie(maxSrc, maxTgt, maxPL) = max_tgtPL; 
+  oa << label_phrStr2ID << vocab << maxSrc << maxTgt << maxPL; 
+  outFile.close(); 
+}
+
+void Phrases::readSnapshot(const string filename){
+  ifstream inFile(filename.c_str(), ios_base::in | ios_base::binary); 
+  if (!inFile.is_open()){ cerr << "Could not read phrases snapshot from location " << filename << endl; exit(0); }
+  boost::archive::binary_iarchive ia(inFile); 
+  unsigned int numPhrases; 
+  ia >> numPhrases; 
+  for (unsigned int i = 0; i < numPhrases; i++){
+    int id; 
+    string phrase_str; 
+    bool labeled; 
+    ia >> id >> phrase_str >> labeled; 
+    Phrase* phrase = new Phrase(id, phrase_str, labeled); 
+    ia >> phrase->label_distribution; 
+    phrStr2ID[phrase_str] = id; 
+    all_phrases.push_back(phrase); 
+    if (labeled)
+      numLabeled++;
+    else
+      numUnlabeled++; 
+  }
+  string maxSrc, maxTgt; 
+  unsigned int maxPL; 
+  ia >> label_phrStr2ID >> vocab >> maxSrc >> maxTgt >> maxPL; 
+  max_tgtPL = make_tuple(maxSrc, maxTgt, maxPL); 
+  for (map<string, unsigned int>::const_iterator it = label_phrStr2ID.begin(); it != label_phrStr2ID.end(); it++)
+    label_phrID2Str[it->second] = it->first; 
+  inFile.close(); 
+  cout << "Read " << numLabeled << " labeled and " << numUnlabeled << " unlabeled phrases from snapshot" << endl; 
+}
+
 //goes through label distribution for each labeled soure phrase and normalizes (sum = 1)
 void Phrases::normalizeLabelDistributions(){  
   for (unsigned int i = 0; i < all_phrases.size(); i++ )
@@ -186,16 +311,24 @@ void Phrases::addGeneratedPhrases(const vector<string> generated_phrases){
   }
 }
 
+//a new unlabeled phrase, e.g., one sent to the Serve stage; the phrase must not be in the inventory yet
+Phrases::Phrase* Phrases::addUnlabeledPhrase(const string phraseStr){
+  assert(phrStr2ID.find(phraseStr) == phrStr2ID.end()); 
+  vector<string> tokens; 
+  boost::split(tokens, phraseStr, boost::is_any_of(" ")); 
+  return initPhrase(phraseStr, tokens, all_phrases.size(), false); 
+}
+
 //this format assumes a cdec/moses decoder style output format
 //for the mbest-list phrases (delimited by ' ||| ')
 int Phrases::readMBestListFromFile(const string filename_in, const string filename_out, const vector<Phrase*> unlabeled_phrases){
   unsigned int maxPL = 0; 
   map<const string, vector<string> > mbest_by_src = map<const string, vector<string> >();
   typedef map<const string, vector<string> >::iterator iter;
-  ifstream mbest_list(filename_in.c_str()); 
+  LineReader mbest_list(filename_in); 
   string line;    
   if (mbest_list.is_open()){
-    while (getline(mbest_list, line)){    
+    while (mbest_list.getline(line)){    
       boost::trim(line); 
       vector<string> elements = multiCharSplitter(line); 
       assert(elements.size() > 2); 
@@ -218,7 +351,6 @@ int Phrases::readMBestListFromFile(const string filename_in, const string filena
 	mbest_vec->second.push_back(mbest_hyp); 
       numUnlabeled++; 
     }
-    mbest_list.close(); 
   }
   else { cerr << "Could not open mbest list at location: " << filename_in << endl; exit(0); }
   cout << "Total number of mbest list candidates generated: " << all_phrases.size() << endl; 
@@ -242,12 +374,37 @@ map<const string, vector<string> > Phrases::readFormattedMBestListFromFile(const
   else { cerr << "Could not read formatted m-best list from location " << mbest_processed_loc << endl; exit(0); }
 }
 
-void::Phrases::computeMarginals(const string cooc_loc){
-  SparseMatrix<double,RowMajor> cooc_matrix = SparseMatrix<double,RowMajor>();   
-  loadMarket(cooc_matrix, cooc_loc); 
-  VectorXd indFeatSumRow = cooc_matrix*VectorXd::Ones(cooc_matrix.cols()); //sum over features for each phrase
+//uses the marginals sidecar written during feature extraction if available, 
+//otherwise streams over the co-occurrence matrix once to get the row sums
+void Phrases::computeMarginals(const string cooc_loc){
+  vector<double> indFeatSumRow = vector<double>(); 
+  if (!FeatureExtractor::readCoocRowSums(cooc_loc, indFeatSumRow)){
+    cout << "No marginals file found next to " << cooc_loc << "; computing marginals from co-occurrence matrix" << endl; 
+    indFeatSumRow = FeatureExtractor::computeCoocRowSums(cooc_loc); 
+  }
+  setMarginals(indFeatSumRow); 
+}
+
+map<string, long> Phrases::memoryUsage(const string prefix){
+  map<string, long> bytes = map<string, long>(); 
+  long distr_bytes = 0, phrase_bytes = 0; 
+  for (unsigned int i = 0; i < all_phrases.size(); i++){
+    distr_bytes += all_phrases[i]->label_distribution.size() * treeNodeBytes(sizeof(pair<const int, double>)); 
+    phrase_bytes += sizeof(Phrase) + stringHeapBytes(all_phrases[i]->phrase_str); 
+  }
+  for (map<string, unsigned int>::const_iterator it = phrStr2ID.begin(); it != phrStr2ID.end(); it++)
+    phrase_bytes += treeNodeBytes(sizeof(pair<const string, unsigned int>)) + stringHeapBytes(it->first); 
+  for (map<string, unsigned int>::const_iterator it = label_phrStr2ID.begin(); it != label_phrStr2ID.end(); it++) //IDs to strings take the same
+    phrase_bytes += 2 * (treeNodeBytes(sizeof(pair<const string, unsigned int>)) + stringHeapBytes(it->first)); 
+  bytes[prefix + "label_distributions"] = distr_bytes; 
+  bytes[prefix + "phrases"] = phrase_bytes; 
+  return bytes; 
+}
+
+//normalizes per-phrase co-occurrence counts into marginals
+void Phrases::setMarginals(const vector<double>& indFeatSumRow){
   assert(indFeatSumRow.size() == all_phrases.size());   
-  double normalizer = indFeatSumRow.sum(); 
+  const double normalizer = accumulate(indFeatSumRow.begin(), indFeatSumRow.end(), 0.0); 
   for (unsigned int i = 0; i < indFeatSumRow.size(); i++){
     all_phrases[i]->marginal = indFeatSumRow[i] / normalizer; 
   }
@@ -257,24 +414,25 @@ void::Phrases::computeMarginals(const string cooc_loc){
 //n-grams that aren't in phrase tablea s unlabeled n-grams. 
 void Phrases::addUnlabeledPhrasesFromFile(const string filename, const unsigned int PL, const string out_filename, const bool analyze){
   map<const string, unsigned int> ngram_count = map<const string, unsigned int>();  
-  ifstream eval_corpus(filename.c_str());
-  if (eval_corpus.good()){
+  long num_lines = 0, num_ngrams = 0; 
+  LineReader eval_corpus(filename);
+  if (eval_corpus.is_open()){
     string line;
-    if (eval_corpus.is_open()){
-      while (getline(eval_corpus, line)){
-	boost::trim(line);
-	const vector<ngram_triple> ngrams_from_line = FeatureExtractor::extractNGrams(PL, line); 
-	string ngram;
-	for (unsigned int i = 0; i < ngrams_from_line.size(); i++ ){
-	  tie(ngram, ignore, ignore) = ngrams_from_line[i]; 
-	  pair<map<const string, unsigned int>::iterator,bool> ret; 
-	  ret = ngram_count.insert(pair<const string, unsigned int>(ngram, 1)); 
-	  if (ret.second == false)
-	    ngram_count[ngram]++;
-	}
+    while (eval_corpus.getline(line)){
+      boost::trim(line);
+      const vector<ngram_triple> ngrams_from_line = FeatureExtractor::extractNGrams(PL, line); 
+      num_lines++, num_ngrams += ngrams_from_line.size(); 
+      string ngram;
+      for (unsigned int i = 0; i < ngrams_from_line.size(); i++ ){
+	tie(ngram, ignore, ignore) = ngrams_from_line[i]; 
+	pair<map<const string, unsigned int>::iterator,bool> ret; 
+	ret = ngram_count.insert(pair<const string, unsigned int>(ngram, 1)); 
+	if (ret.second == false)
+	  ngram_count[ngram]++;
       }
-      eval_corpus.close();
     }
+    Metrics::addCount("evaluation_lines", num_lines); 
+    Metrics::addCount("evaluation_ngrams", num_ngrams); 
     cout << "Number of " << PL << "-grams in evaluation corpus: " << ngram_count.size() << endl;   
   }
   else { cerr << "Could not find evaluation corpus at " << filename << endl; exit(0); }
@@ -336,36 +494,22 @@ void Phrases::analyzeUnlabeledPhrases(map<const string, unsigned int>& ngram_cou
 
 //function that goes through phrase table file and initializes labeled phrases
 void Phrases::addLabeledPhrasesFromFile(const string filename, const unsigned int PL, const string format){
-  ifstream pt_file(filename.c_str()); //file handle for phrase table
+  LineReader pt_file(filename); //file handle for phrase table; .gz files are decompressed on the reader's thread
   unsigned int numPhrases = 0; 
 
-  if (pt_file.good()){
-    const fs::path p(filename); //do we need to clean this up somewhere? 
-    if (p.extension() == ".gz"){ //special handling for .gz files
-      io::filtering_stream<io::input> decompressor;
-      decompressor.push(io::gzip_decompressor());
-      decompressor.push(pt_file);
-      for (string line; getline(decompressor, line);){
-	initPhraseFromFile(line, PL, format); 
+  if (pt_file.is_open()){
+    for (const LineBatch* batch = pt_file.next(); batch != NULL; batch = pt_file.next()){
+      for (unsigned int i = 0; i < batch->lines.size(); i++){
+	initPhraseFromFile(batch->lines[i].to_string(), PL, format); 
 	numPhrases++; 
       }
-      pt_file.close(); 
-    }
-    else { //for non .gz files --> test this out properly!
-      string line;
-      if (pt_file.is_open()){
-	while (getline(pt_file, line)){
-	  initPhraseFromFile(line, PL, format);
-	  numPhrases++; 
-	}
-	pt_file.close(); 
-      }
     }
   }
   else { 
     cerr << "Cannot find phrase table at " << filename << endl; 
     exit(0); 
   }
+  Metrics::addCount("phrase_table_lines", numPhrases); 
   cout << "Source vocabulary size: " << vocab.size() << endl; 
   cout << "Number of phrases in phrase table: " << numPhrases << endl; 
   cout << "Number of phrases with desired phrase length " << PL << ": " << all_phrases.size() << endl; 
@@ -434,7 +578,7 @@ void Phrases::addLabelCdec(Phrase* phrase, vector<string> elements){
   boost::split(featStrVec, featStr, boost::is_any_of(" ")); 
   for (unsigned int i = 0; i < featStrVec.size(); i++ ){
     vector<string> keyValPair; 
-    boost::split(keyValPair, featStrVec[i], boost::is_any_of(" ")); 
+    boost::split(keyValPair, featStrVec[i], boost::is_any_of("=")); 
     if (keyValPair[0] == "EgivenFCoherent"){
       const double fwdPhrLogProb = -atof(keyValPair[1].c_str()); 
       fwdPhrProb = pow(10, fwdPhrLogProb); 
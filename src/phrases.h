@@ -58,9 +58,12 @@ class Phrases {
   int readMBestListFromFile(const string filename_in, const string filename_out, const vector<Phrase*> unlabeled_phrases); 
   static map<const string, vector<string> > readFormattedMBestListFromFile(const string mbest_processed_loc);   
   void addGeneratedPhrases(const vector<string> generated_phrases); 
+  Phrase* addUnlabeledPhrase(const string phraseStr); 
   void readPhraseIDsFromFile(const string filename, const bool readLabeled);   
   void writePhraseIDsToFile(const string filename, const bool writeLabeled); 
   void readLabelPhraseIDsFromFile(const string filename); 
+  void writeSnapshot(const string filename); 
+  void readSnapshot(const string filename); 
   Phrase* getNthPhrase(const unsigned int N){ return all_phrases[N]; }
   unsigned int getNumUnlabeledPhrases() { return numUnlabeled; }  
   unsigned int getNumLabeledPhrases() { return numLabeled; }
@@ -78,8 +81,11 @@ class Phrases {
     return labeled_phrases; 
   }
   void computeMarginals(const string cooc_loc); 
+  void setMarginals(const vector<double>& indFeatSumRow); 
+  map<string, long> memoryUsage(const string prefix); //estimated bytes, keyed by prefix + data structure
   
   void writePhraseTable(Phrases* tgt_phrases, const string pt_format, const string new_pt_loc, LexicalScorer* const lex); 
+  string formatPhraseTableEntries(Phrase* phrase, Phrases* tgt_phrases, const string pt_format, LexicalScorer* const lex); //as written by writePhraseTable
 
  private:
   void initPhraseFromFile(string line, const unsigned int phrase_length, const string format);
@@ -88,6 +94,7 @@ class Phrases {
   void addLabelCdec(Phrase* phrase, vector<string> elements); 
   vector<string> multiCharSplitter(string line); 
   void analyzeUnlabeledPhrases(map<const string, unsigned int>& ngram_count); 
+  unsigned int formatPhrasePairs(Phrase* phrase, Phrases* tgt_phrases, const string& pt_format, LexicalScorer* const lex, string& buf, int& num_tgt_marginal_pos); 
 
   vector<Phrase*> all_phrases;
   map<string, unsigned int> phrStr2ID;
@@ -0,0 +1,217 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include "server.h"
+#include "line_reader.h"
+#include "sparse_cosine.h"
+#include "metrics.h"
+
+using namespace std; 
+namespace io = boost::iostreams; 
+
+const string DELTA_EXT = ".delta"; 
+const string DELTA_PHRASES_EXT = ".phrases"; 
+
+PhraseServer::PhraseServer(po::variables_map& conf, Phrases* src_phrases, Phrases* tgt_phrases, FeatureExtractor* src_features, Graph* src_graph, TargetSimilarity* tgt_sim, LexicalScorer* const lex) :
+  src_phrases(src_phrases), tgt_phrases(tgt_phrases), src_features(src_features), src_graph(src_graph), tgt_sim(tgt_sim), lex(lex) {
+  corpus_loc = (conf["serve_monolingual"].as<string>() != "") ? conf["serve_monolingual"].as<string>() : conf["source_monolingual"].as<string>(); 
+  pt_format = conf["phrase_table_format"].as<string>(); 
+  algo = conf["graph_propagation_algorithm"].as<string>(); 
+  transform(algo.begin(), algo.end(), algo.begin(), ::tolower); 
+  phrase_length = conf["phrase_length"].as<int>(); 
+  winsize = conf["window_size"].as<int>(); 
+  delta_loc = (conf["source_similarity_matrix"].as<string>() != "") ? conf["source_similarity_matrix"].as<string>() + DELTA_EXT : ""; 
+  precision = conf["similarity_matrix_precision"].as<string>(); 
+  maxCand_size = conf["maximum_candidate_size"].as<int>(); 
+  filter_sw = conf.count("filter_stop_words"); 
+  if (filter_sw)
+    label_stop_phrases = FeatureExtractor::readStopWordsAsPhrases(conf["target_stopwords"].as<string>(), conf["stop_list_size"].as<int>(), tgt_phrases); 
+  iterations = conf["graph_propagation_iterations"].as<int>(); 
+  tolerance = conf["propagation_tolerance"].as<double>(); 
+  hops = conf["serve_propagation_hops"].as<int>(); 
+  norms = rowNorms(src_features->getFeatureMatrix()); 
+  indexCorpus(); 
+  if (delta_loc != ""){
+    remove(delta_loc.c_str()); //of an earlier run, against another similarity matrix
+    delta_phrases.open((delta_loc + DELTA_PHRASES_EXT).c_str()); 
+    if (!delta_phrases.is_open()){ cerr << "Could not write served phrases to " << delta_loc << DELTA_PHRASES_EXT << endl; exit(0); }
+  }
+}
+
+//line offsets and per-word line lists, so that the lines a new phrase occurs in can be read back directly
+void PhraseServer::indexCorpus(){
+  ScopedTimer timer("serve.indexCorpus"); 
+  if (corpus_loc.size() > 3 && corpus_loc.compare(corpus_loc.size() - 3, 3, ".gz") == 0){ cerr << "The monolingual corpus for the 'Serve' stage needs to be uncompressed, so that its lines can be read back: " << corpus_loc << endl; exit(0); }
+  LineReader mono_file(corpus_loc); 
+  corpus.open(corpus_loc.c_str()); 
+  if (!mono_file.is_open() || !corpus.is_open()){ cerr << "Could not open monolingual corpus at location " << corpus_loc << endl; exit(0); }
+  long offset = 0; 
+  for (const LineBatch* batch = mono_file.next(); batch != NULL; batch = mono_file.next()){
+    for (unsigned int l = 0; l < batch->lines.size(); l++){
+      const unsigned int line_num = line_offsets.size(); 
+      line_offsets.push_back(offset); 
+      offset = batch->endOffset(l); 
+      string line = batch->lines[l].to_string(); 
+      boost::trim(line); 
+      vector<string> words; 
+      boost::split(words, line, boost::is_any_of(" ")); 
+      for (unsigned int i = 0; i < words.size(); i++){
+	vector<unsigned int>& lines = word_lines[words[i]]; 
+	if (lines.empty() || lines.back() != line_num) //a word may occur more than once in a line
+	  lines.push_back(line_num); 
+      }
+    }
+  }
+  Metrics::addCount("serve_corpus_lines", line_offsets.size()); 
+  cout << "Indexed " << line_offsets.size() << " lines and " << word_lines.size() << " word types of " << corpus_loc << "; Time taken: " << timer.stop() << " seconds" << endl; 
+}
+
+//lines that contain all of the phrase's words; the phrase itself is matched when its contexts are extracted
+set<unsigned int> PhraseServer::linesContaining(const string& phrase){
+  vector<string> words; 
+  boost::split(words, phrase, boost::is_any_of(" ")); 
+  vector<unsigned int> lines = vector<unsigned int>(); 
+  for (unsigned int i = 0; i < words.size(); i++){
+    unordered_map<string, vector<unsigned int> >::const_iterator it = word_lines.find(words[i]); 
+    if (it == word_lines.end())
+      return set<unsigned int>(); 
+    if (i == 0)
+      lines = it->second; 
+    else {
+      vector<unsigned int> common = vector<unsigned int>(); 
+      set_intersection(lines.begin(), lines.end(), it->second.begin(), it->second.end(), back_inserter(common)); 
+      lines.swap(common); 
+    }
+  }
+  return set<unsigned int>(lines.begin(), lines.end()); 
+}
+
+string PhraseServer::labelBatch(const vector<string>& phrases){
+  chrono::steady_clock::time_point start = chrono::steady_clock::now(); 
+  const unsigned int first_new = src_features->getNumPoints(); 
+  vector<Phrases::Phrase*> new_phrases = vector<Phrases::Phrase*>(); 
+  set<unsigned int> lines = set<unsigned int>(); //of all new phrases, so that a line with two of them is read once
+  for (unsigned int i = 0; i < phrases.size(); i++){
+    vector<string> tokens; 
+    boost::split(tokens, phrases[i], boost::is_any_of(" ")); 
+    if (tokens.size() != phrase_length){
+      cerr << "Skipping phrase '" << phrases[i] << "': only phrases of length " << phrase_length << " can be labeled" << endl; 
+      continue; 
+    }
+    if ((int) src_phrases->getPhraseID(phrases[i]) > -1) //in the phrase table, or in the inventory already
+      continue; 
+    new_phrases.push_back(src_phrases->addUnlabeledPhrase(phrases[i])); 
+    set<unsigned int> phrase_lines = linesContaining(phrases[i]); 
+    lines.insert(phrase_lines.begin(), phrase_lines.end()); 
+  }
+  if (new_phrases.size() > 0){
+    vector<string> texts = vector<string>(); 
+    texts.reserve(lines.size()); 
+    for (set<unsigned int>::const_iterator it = lines.begin(); it != lines.end(); it++){
+      string line; 
+      corpus.clear(); //after a last line without a newline
+      corpus.seekg(line_offsets[*it]); 
+      getline(corpus, line); 
+      texts.push_back(line); 
+    }
+    const vector<double> counts = src_features->addPhraseRows(src_phrases, texts, first_new, winsize, phrase_length, phrase_length); 
+    for (unsigned int i = 0; i < new_phrases.size(); i++){
+      new_phrases[i]->marginal = counts[i] / src_features->getTotalCount(); 
+      norms.push_back(sparseNorm(sparseRow(src_features->getFeatureMatrix(), new_phrases[i]->id))); 
+    }
+    src_graph->insertNodes(src_features, norms, first_new); 
+    src_graph->initLabels(src_phrases, new_phrases, lex, maxCand_size, filter_sw, label_stop_phrases); 
+    vector<unsigned int> seeds = vector<unsigned int>(); 
+    for (unsigned int i = 0; i < new_phrases.size(); i++)
+      seeds.push_back(new_phrases[i]->id); 
+    src_graph->propagateLocally(src_phrases, seeds, hops, iterations, tolerance, (algo == "structlabelprop") ? tgt_sim : NULL); 
+    if (delta_loc != "")
+      writeDelta(new_phrases); 
+    Metrics::addCount("served_new_phrases", new_phrases.size()); 
+    Metrics::addCount("served_corpus_lines", texts.size()); 
+  }
+  string entries = ""; 
+  set<string> written = set<string>(); 
+  for (unsigned int i = 0; i < phrases.size(); i++){
+    const int phrID = src_phrases->getPhraseID(phrases[i]); 
+    if (phrID > -1 && !src_phrases->getNthPhrase(phrID)->isLabeled() && written.insert(phrases[i]).second)
+      entries += src_phrases->formatPhraseTableEntries(src_phrases->getNthPhrase(phrID), tgt_phrases, pt_format, lex); 
+  }
+  Metrics::addCount("served_phrases", phrases.size()); 
+  cout << "Served " << phrases.size() << " phrases (" << new_phrases.size() << " new, from " << lines.size() << " corpus lines); Time taken: " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " seconds" << endl; 
+  return entries; 
+}
+
+//the graph rows changed since the Serve stage started, next to the similarity matrix (Graph::applyDelta turns the
+//matrix into the served graph). the delta is replaced atomically; the new phrases' IDs are appended to a list next to it
+void PhraseServer::writeDelta(const vector<Phrases::Phrase*>& new_phrases){
+  ScopedTimer timer("serve.writeDelta"); 
+  src_graph->writeDelta(delta_loc + ".tmp", precision); 
+  if (rename((delta_loc + ".tmp").c_str(), delta_loc.c_str()) != 0){ cerr << "Could not write graph delta to " << delta_loc << ": " << strerror(errno) << endl; exit(0); }
+  for (unsigned int i = 0; i < new_phrases.size(); i++)
+    delta_phrases << new_phrases[i]->phrase_str << " ||| " << new_phrases[i]->id << '\n'; 
+  delta_phrases.flush(); 
+  timer.stop(); 
+}
+
+//one phrase per line. a batch ends at an empty line or at the end of the input, and its response is the phrase table
+//entries of its phrases followed by an empty line
+void PhraseServer::serve(istream& in, ostream& out){
+  vector<string> batch = vector<string>(); 
+  string line; 
+  bool more = true; 
+  while (more){
+    more = !getline(in, line).fail(); 
+    boost::trim(line); 
+    if (more && !line.empty()){
+      batch.push_back(line); 
+      continue; 
+    }
+    if (more || batch.size() > 0){
+      out << labelBatch(batch) << '\n' << flush; 
+      batch.clear(); 
+    }
+  }
+}
+
+void PhraseServer::listen(const string socket_loc){
+  sockaddr_un addr; 
+  memset(&addr, 0, sizeof(addr)); 
+  addr.sun_family = AF_UNIX; 
+  if (socket_loc.size() >= sizeof(addr.sun_path)){ cerr << "Socket path " << socket_loc << " is too long" << endl; exit(0); }
+  strcpy(addr.sun_path, socket_loc.c_str()); 
+  const int server_fd = socket(AF_UNIX, SOCK_STREAM, 0); 
+  unlink(socket_loc.c_str()); //left behind by an earlier run
+  if (server_fd < 0 || bind(server_fd, (sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(server_fd, 16) < 0){ cerr << "Could not listen on socket " << socket_loc << ": " << strerror(errno) << endl; exit(0); }
+  signal(SIGPIPE, SIG_IGN); //a client that goes away only ends its connection
+  cout << "Serving on socket " << socket_loc << endl; 
+  while (true){
+    const int conn = accept(server_fd, NULL, NULL); 
+    if (conn < 0){
+      if (errno == EINTR)
+	continue; 
+      cerr << "Could not accept connection on socket " << socket_loc << ": " << strerror(errno) << endl; 
+      break; 
+    }
+    try {
+      io::stream<io::file_descriptor_source> in(conn, io::never_close_handle); 
+      io::stream<io::file_descriptor_sink> out(conn, io::never_close_handle); 
+      serve(in, out); 
+    }
+    catch (const exception& e){
+      cerr << "Connection closed: " << e.what() << endl; 
+    }
+    close(conn); 
+  }
+  close(server_fd); 
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <unordered_map>
+#include "options.h"
+#include "phrases.h"
+#include "featext.h"
+#include "graph.h"
+#include "lexical.h"
+
+using namespace std; 
+
+//labels new source phrases against the feature matrix, inverted index, source graph and label distributions that the
+//Serve stage keeps in memory. each new phrase gets a feature row from its contexts in the (indexed) monolingual corpus,
+//is inserted into the source graph (see Graph::insertNodes), gets candidates from its labeled neighbors, and is updated
+//by propagation sweeps from the new phrases (see Graph::propagateLocally) that leave the distributions of phrases 
+//further away than the configured number of hops as they are
+class PhraseServer {
+ public:
+  PhraseServer(po::variables_map& conf, Phrases* src_phrases, Phrases* tgt_phrases, FeatureExtractor* src_features, Graph* src_graph, TargetSimilarity* tgt_sim, LexicalScorer* const lex); //indexes the monolingual corpus
+  void serve(istream& in, ostream& out); //until the end of the input
+  void listen(const string socket_loc); //serves connections to a unix domain socket, one at a time, until killed
+  string labelBatch(const vector<string>& phrases); //phrase table entries of the phrases that are not in the phrase table
+
+ private:
+  void indexCorpus(); 
+  set<unsigned int> linesContaining(const string& phrase); 
+  void writeDelta(const vector<Phrases::Phrase*>& new_phrases); 
+  Phrases* src_phrases; 
+  Phrases* tgt_phrases; 
+  FeatureExtractor* src_features; 
+  Graph* src_graph; 
+  TargetSimilarity* tgt_sim; 
+  LexicalScorer* lex; 
+  string corpus_loc; 
+  string pt_format; 
+  string algo; 
+  unsigned int phrase_length; 
+  unsigned int winsize; 
+  int maxCand_size; 
+  bool filter_sw; 
+  set<int> label_stop_phrases; 
+  int iterations; 
+  double tolerance; 
+  unsigned int hops; 
+  ifstream corpus; 
+  vector<long> line_offsets; 
+  unordered_map<string, vector<unsigned int> > word_lines; //lines each word occurs in, in ascending order
+  vector<double> norms; //feature row norms
+  string delta_loc; //empty if the source similarity matrix is not written
+  string precision; 
+  ofstream delta_phrases; 
+}; 
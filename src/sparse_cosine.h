@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <Eigen/Sparse>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std; 
+using namespace Eigen; 
+
+//dot products and cosine similarities of sparse rows, read in place from the index and value arrays of a CSR matrix
+//(or any sorted index/value arrays) instead of through SparseVector copies. matching entries are found with an SSE2
+//block intersection, or with galloping search when one row is much longer than the other; products are still summed
+//in ascending feature order, so the results are the same as SparseVector::dot and SparseVector::norm
+
+const int GALLOP_RATIO = 32; //gallop through the longer row once it is this many times longer
+
+struct SparseRow {
+  const int* idx; 
+  const double* val; 
+  int size; 
+}; 
+
+inline SparseRow sparseRow(const SparseMatrix<double,RowMajor>& mat, const int row){
+  const int begin = mat.outerIndexPtr()[row]; 
+  const int size = mat.isCompressed() ? mat.outerIndexPtr()[row+1] - begin : mat.innerNonZeroPtr()[row]; 
+  SparseRow view = {mat.innerIndexPtr() + begin, mat.valuePtr() + begin, size}; 
+  return view; 
+}
+
+inline double sparseNorm(const SparseRow& row){
+  double squared = 0.0; 
+  for (int k = 0; k < row.size; k++)
+    squared += row.val[k] * row.val[k]; 
+  return sqrt(squared); 
+}
+
+inline vector<double> rowNorms(const SparseMatrix<double,RowMajor>& mat){
+  vector<double> norms(mat.rows()); 
+  #pragma omp parallel for
+  for (int i = 0; i < mat.rows(); i++)
+    norms[i] = sparseNorm(sparseRow(mat, i)); 
+  return norms; 
+}
+
+//for each entry of the shorter row, an exponential then binary search forward through the longer one
+inline double gallopingDot(const SparseRow& shorter, const SparseRow& longer){
+  double dp = 0; 
+  int j = 0; 
+  for (int i = 0; i < shorter.size && j < longer.size; i++){
+    const int target = shorter.idx[i]; 
+    int lo = j, hi = j, step = 1; 
+    while (hi < longer.size && longer.idx[hi] < target){
+      lo = hi + 1; 
+      hi += step; 
+      step <<= 1; 
+    }
+    j = lower_bound(longer.idx + lo, longer.idx + min(hi + 1, longer.size), target) - longer.idx; 
+    if (j < longer.size && longer.idx[j] == target)
+      dp += shorter.val[i] * longer.val[j++]; 
+  }
+  return dp; 
+}
+
+//compares blocks of 4 indices from each row all-against-all (the second block in its 4 rotations), then advances the
+//block(s) with the smaller last index; matches within a block come out in ascending order
+inline double mergeDot(const SparseRow& a, const SparseRow& b){
+  double dp = 0; 
+  int i = 0, j = 0; 
+#ifdef __SSE2__
+  while (i + 4 <= a.size && j + 4 <= b.size){
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.idx + i)); 
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.idx + j)); 
+    __m128i eq = _mm_cmpeq_epi32(va, vb); 
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0,3,2,1)))); 
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1,0,3,2)))); 
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2,1,0,3)))); 
+    for (int mask = _mm_movemask_ps(_mm_castsi128_ps(eq)); mask; mask &= mask - 1){ //lanes of a with a match
+      const int k = i + __builtin_ctz(mask); 
+      const int* pos = find(b.idx + j, b.idx + j + 4, a.idx[k]); 
+      dp += a.val[k] * b.val[pos - b.idx]; 
+    }
+    const int a_last = a.idx[i+3], b_last = b.idx[j+3]; 
+    if (a_last <= b_last)
+      i += 4; 
+    if (b_last <= a_last)
+      j += 4; 
+  }
+#endif
+  while (i < a.size && j < b.size){ //remainder (or everything, without SSE2)
+    if (a.idx[i] == b.idx[j])
+      dp += a.val[i++] * b.val[j++]; 
+    else if (a.idx[i] < b.idx[j])
+      i++; 
+    else
+      j++; 
+  }
+  return dp; 
+}
+
+inline double sparseDot(const SparseRow& a, const SparseRow& b){
+  const SparseRow& shorter = (a.size <= b.size) ? a : b; 
+  const SparseRow& longer = (a.size <= b.size) ? b : a; 
+  if (shorter.size == 0)
+    return 0; 
+  if ((long) shorter.size * GALLOP_RATIO < longer.size)
+    return gallopingDot(shorter, longer); 
+  return mergeDot(shorter, longer); 
+}
+
+inline double cosineSimilarity(const SparseRow& a, const SparseRow& b, const double norm_a, const double norm_b){
+  return sparseDot(a, b) / (norm_a * norm_b); 
+}